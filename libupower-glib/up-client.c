@@ -37,11 +37,19 @@
 #include "up-client.h"
 #include "up-daemon-generated.h"
 #include "up-device.h"
+#include "up-device-private.h"
 
 static void	up_client_class_init		(UpClientClass	*klass);
 static void	up_client_initable_iface_init	(GInitableIface *iface);
 static void	up_client_init			(UpClient	*client);
 static void	up_client_finalize		(GObject	*object);
+static GType	up_client_get_proxy_type	(GDBusObjectManagerClient *manager,
+						 const gchar	*object_path,
+						 const gchar	*interface_name,
+						 gpointer	 user_data);
+
+#define UP_CLIENT_DEVICE_INTERFACE	"org.freedesktop.UPower.Device"
+#define UP_CLIENT_DISPLAY_DEVICE_PATH	"/org/freedesktop/UPower/devices/DisplayDevice"
 
 #define UP_CLIENT_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), UP_TYPE_CLIENT, UpClientPrivate))
 
@@ -52,7 +60,9 @@ static void	up_client_finalize		(GObject	*object);
  **/
 struct _UpClientPrivate
 {
-	UpExportedDaemon *proxy;
+	UpExportedDaemon	*proxy;
+	GDBusObjectManager	*manager;	/* NULL if not supported */
+	gboolean		 manager_tried;
 };
 
 enum {
@@ -75,6 +85,106 @@ static guint signals [UP_CLIENT_LAST_SIGNAL] = { 0 };
 G_DEFINE_TYPE_WITH_CODE (UpClient, up_client, G_TYPE_OBJECT,
                          G_IMPLEMENT_INTERFACE(G_TYPE_INITABLE, up_client_initable_iface_init))
 
+/*
+ * up_client_set_manager:
+ *
+ * Only a daemon without an ObjectManager is remembered as a failure;
+ * after any other error, e.g. a cancelled call, the next call tries again.
+ */
+static void
+up_client_set_manager (UpClient *client, GDBusObjectManager *manager, const GError *error)
+{
+	if (manager == NULL &&
+	    !g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD) &&
+	    !g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_INTERFACE) &&
+	    !g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_OBJECT)) {
+		g_debug ("failed to get the object manager: %s",
+			 error != NULL ? error->message : "unknown error");
+		return;
+	}
+	client->priv->manager_tried = TRUE;
+	client->priv->manager = manager;
+}
+
+/*
+ * up_client_get_manager:
+ *
+ * The object manager is only created the first time devices are needed,
+ * so clients that never look at devices don't pay for the round-trip.
+ * It fetches every device and its properties in one go, and shares one
+ * match rule between them; older daemons don't support this.
+ */
+static GDBusObjectManager *
+up_client_get_manager (UpClient *client)
+{
+	GDBusObjectManager *manager;
+	GError *error = NULL;
+
+	if (client->priv->manager_tried)
+		return client->priv->manager;
+
+	manager = g_dbus_object_manager_client_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
+								 G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_NONE,
+								 "org.freedesktop.UPower",
+								 "/org/freedesktop/UPower",
+								 up_client_get_proxy_type,
+								 NULL, NULL,
+								 NULL,
+								 &error);
+	up_client_set_manager (client, manager, error);
+	g_clear_error (&error);
+	return manager;
+}
+
+/*
+ * up_client_lookup_device:
+ *
+ * Returns a new device wrapping the proxy the object manager already
+ * holds for @object_path, or %NULL if there is no such proxy.
+ */
+static UpDevice *
+up_client_lookup_device (UpClient *client, const gchar *object_path)
+{
+	GDBusInterface *proxy;
+	UpDevice *device;
+
+	if (client->priv->manager == NULL)
+		return NULL;
+	proxy = g_dbus_object_manager_get_interface (client->priv->manager,
+						     object_path,
+						     UP_CLIENT_DEVICE_INTERFACE);
+	if (proxy == NULL)
+		return NULL;
+
+	device = _up_device_new_for_proxy (UP_EXPORTED_DEVICE (proxy));
+	g_object_unref (proxy);
+	return device;
+}
+
+/*
+ * up_client_get_device:
+ *
+ * Like up_client_lookup_device() but falls back to creating a proxy of
+ * its own, e.g. when the daemon does not implement the ObjectManager.
+ */
+static UpDevice *
+up_client_get_device (UpClient *client, const gchar *object_path)
+{
+	UpDevice *device;
+
+	up_client_get_manager (client);
+	device = up_client_lookup_device (client, object_path);
+	if (device != NULL)
+		return device;
+
+	device = up_device_new ();
+	if (!up_device_set_object_path_sync (device, object_path, NULL, NULL)) {
+		g_object_unref (device);
+		return NULL;
+	}
+	return device;
+}
+
 /**
  * up_client_get_devices:
  * @client: a #UpClient instance.
@@ -100,7 +210,9 @@ up_client_get_devices (UpClient *client)
  * up_client_get_devices2:
  * @client: a #UpClient instance.
  *
- * Get a copy of the device objects.
+ * Get a copy of the device objects. Each call returns new #UpDevice
+ * objects, but where the daemon supports it they share their D-Bus
+ * proxies, so this costs one round-trip however many devices there are.
  *
  * Return value: (element-type UpDevice) (transfer full): an array of #UpDevice objects, free with g_ptr_array_unref()
  *
@@ -129,15 +241,10 @@ up_client_get_devices2 (UpClient *client)
 
 	for (i = 0; devices[i] != NULL; i++) {
 		UpDevice *device;
-		const char *object_path = devices[i];
-		gboolean ret;
 
-		device = up_device_new ();
-		ret = up_device_set_object_path_sync (device, object_path, NULL, NULL);
-		if (!ret) {
-			g_object_unref (device);
+		device = up_client_get_device (client, devices[i]);
+		if (device == NULL)
 			continue;
-		}
 
 		g_ptr_array_add (array, device);
 	}
@@ -146,6 +253,187 @@ up_client_get_devices2 (UpClient *client)
 	return array;
 }
 
+typedef struct {
+	GPtrArray	*array;
+	guint		 pending;
+} UpClientGetDevicesData;
+
+static void
+up_client_get_devices_data_free (UpClientGetDevicesData *data)
+{
+	g_ptr_array_unref (data->array);
+	g_free (data);
+}
+
+/*
+ * up_client_get_devices_set_object_path_cb:
+ */
+static void
+up_client_get_devices_set_object_path_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	UpClientGetDevicesData *data = g_task_get_task_data (task);
+	UpDevice *device = UP_DEVICE (source_object);
+
+	/* devices that vanished in the meantime are skipped, like in
+	 * up_client_get_devices2() */
+	if (!up_device_set_object_path_finish (device, res, NULL))
+		g_ptr_array_remove (data->array, device);
+
+	if (--data->pending == 0)
+		g_task_return_pointer (task,
+				       g_ptr_array_ref (data->array),
+				       (GDestroyNotify) g_ptr_array_unref);
+	g_object_unref (task);
+}
+
+/*
+ * up_client_get_devices_enumerate_cb:
+ */
+static void
+up_client_get_devices_enumerate_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	UpClient *client = UP_CLIENT (g_task_get_source_object (task));
+	UpClientGetDevicesData *data = g_task_get_task_data (task);
+	GError *error = NULL;
+	char **devices;
+	guint i;
+
+	if (!up_exported_daemon_call_enumerate_devices_finish (UP_EXPORTED_DAEMON (source_object),
+							       &devices,
+							       res,
+							       &error)) {
+		g_task_return_error (task, error);
+		goto out;
+	}
+
+	/* create the missing proxies at once rather than one after the other */
+	for (i = 0; devices[i] != NULL; i++) {
+		UpDevice *device;
+
+		device = up_client_lookup_device (client, devices[i]);
+		if (device != NULL) {
+			g_ptr_array_add (data->array, device);
+			continue;
+		}
+
+		device = up_device_new ();
+		g_ptr_array_add (data->array, device);
+		data->pending++;
+		up_device_set_object_path_async (device,
+						 devices[i],
+						 g_task_get_cancellable (task),
+						 up_client_get_devices_set_object_path_cb,
+						 g_object_ref (task));
+	}
+	g_strfreev (devices);
+
+	/* every proxy was already there */
+	if (data->pending == 0)
+		g_task_return_pointer (task,
+				       g_ptr_array_ref (data->array),
+				       (GDestroyNotify) g_ptr_array_unref);
+out:
+	g_object_unref (task);
+}
+
+/*
+ * up_client_get_devices_manager_cb:
+ */
+static void
+up_client_get_devices_manager_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	UpClient *client = UP_CLIENT (g_task_get_source_object (task));
+	GDBusObjectManager *manager;
+	GError *error = NULL;
+
+	/* without it, the devices get proxies of their own */
+	manager = g_dbus_object_manager_client_new_for_bus_finish (res, &error);
+
+	/* another call got there first */
+	if (client->priv->manager_tried)
+		g_clear_object (&manager);
+	else
+		up_client_set_manager (client, manager, error);
+	g_clear_error (&error);
+
+	up_exported_daemon_call_enumerate_devices (client->priv->proxy,
+						   g_task_get_cancellable (task),
+						   up_client_get_devices_enumerate_cb,
+						   task);
+}
+
+/**
+ * up_client_get_devices_async:
+ * @client: a #UpClient instance.
+ * @cancellable: a #GCancellable or %NULL
+ * @callback: a #GAsyncReadyCallback to call when the request is satisfied
+ * @user_data: the data to pass to @callback
+ *
+ * Asynchronously gets a copy of the device objects. The devices come
+ * from the daemon's ObjectManager where it has one; otherwise all the
+ * device proxies are created in parallel, so this does not block the
+ * caller for one round-trip per device. Call up_client_get_devices_finish()
+ * from @callback to get the result.
+ *
+ * Since: 0.99.11
+ **/
+void
+up_client_get_devices_async (UpClient *client, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+	UpClientGetDevicesData *data;
+	GTask *task;
+
+	g_return_if_fail (UP_IS_CLIENT (client));
+
+	data = g_new0 (UpClientGetDevicesData, 1);
+	data->array = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+
+	task = g_task_new (client, cancellable, callback, user_data);
+	g_task_set_task_data (task, data, (GDestroyNotify) up_client_get_devices_data_free);
+
+	if (!client->priv->manager_tried) {
+		g_dbus_object_manager_client_new_for_bus (G_BUS_TYPE_SYSTEM,
+							  G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_NONE,
+							  "org.freedesktop.UPower",
+							  "/org/freedesktop/UPower",
+							  up_client_get_proxy_type,
+							  NULL, NULL,
+							  cancellable,
+							  up_client_get_devices_manager_cb,
+							  task);
+		return;
+	}
+
+	up_exported_daemon_call_enumerate_devices (client->priv->proxy,
+						   cancellable,
+						   up_client_get_devices_enumerate_cb,
+						   task);
+}
+
+/**
+ * up_client_get_devices_finish:
+ * @client: a #UpClient instance.
+ * @res: a #GAsyncResult
+ * @error: a #GError, or %NULL.
+ *
+ * Gets the result of up_client_get_devices_async().
+ *
+ * Return value: (element-type UpDevice) (transfer full): an array of #UpDevice objects, free with g_ptr_array_unref(), or %NULL on error
+ *
+ * Since: 0.99.11
+ **/
+GPtrArray *
+up_client_get_devices_finish (UpClient *client, GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail (UP_IS_CLIENT (client), NULL);
+	g_return_val_if_fail (g_task_is_valid (res, client), NULL);
+
+	return g_task_propagate_pointer (G_TASK (res), error);
+}
+
 /**
  * up_client_get_display_device:
  * @client: a #UpClient instance.
@@ -158,16 +446,8 @@ up_client_get_devices2 (UpClient *client)
 UpDevice *
 up_client_get_display_device (UpClient *client)
 {
-	gboolean ret;
-	UpDevice *device;
-
-	device = up_device_new ();
-	ret = up_device_set_object_path_sync (device, "/org/freedesktop/UPower/devices/DisplayDevice", NULL, NULL);
-	if (!ret) {
-		g_object_unref (G_OBJECT (device));
-		return NULL;
-	}
-	return device;
+	g_return_val_if_fail (UP_IS_CLIENT (client), NULL);
+	return up_client_get_device (client, UP_CLIENT_DISPLAY_DEVICE_PATH);
 }
 
 /**
@@ -270,12 +550,10 @@ static void
 up_client_add (UpClient *client, const gchar *object_path)
 {
 	UpDevice *device = NULL;
-	gboolean ret;
 
-	/* create new device */
-	device = up_device_new ();
-	ret = up_device_set_object_path_sync (device, object_path, NULL, NULL);
-	if (!ret)
+	/* wrap the shared proxy, or create a new one */
+	device = up_client_get_device (client, object_path);
+	if (device == NULL)
 		goto out;
 
 	/* add to array */
@@ -302,6 +580,22 @@ up_client_notify_cb (GObject    *gobject,
 	g_object_notify (G_OBJECT (client), pspec->name);
 }
 
+/*
+ * up_client_get_proxy_type:
+ */
+static GType
+up_client_get_proxy_type (GDBusObjectManagerClient *manager,
+			  const gchar *object_path,
+			  const gchar *interface_name,
+			  gpointer user_data)
+{
+	if (interface_name == NULL)
+		return G_TYPE_DBUS_OBJECT_PROXY;
+	if (g_strcmp0 (interface_name, UP_CLIENT_DEVICE_INTERFACE) == 0)
+		return UP_TYPE_EXPORTED_DEVICE_PROXY;
+	return G_TYPE_DBUS_PROXY;
+}
+
 /*
  * up_client_added_cb:
  */
@@ -514,6 +808,7 @@ up_client_finalize (GObject *object)
 	client = UP_CLIENT (object);
 
 	g_clear_object (&client->priv->proxy);
+	g_clear_object (&client->priv->manager);
 
 	G_OBJECT_CLASS (up_client_parent_class)->finalize (object);
 }
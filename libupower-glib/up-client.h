@@ -78,6 +78,15 @@ UpClient	*up_client_new_full			(GCancellable *cancellable, GError **error);
 UpDevice *	 up_client_get_display_device		(UpClient *client);
 char *		 up_client_get_critical_action		(UpClient *client);
 
+/* async versions */
+void		 up_client_get_devices_async		(UpClient		*client,
+							 GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+GPtrArray	*up_client_get_devices_finish		(UpClient		*client,
+							 GAsyncResult		*res,
+							 GError			**error);
+
 /* accessors */
 GPtrArray	*up_client_get_devices			(UpClient		*client) G_DEPRECATED_FOR(up_client_get_devices2);
 GPtrArray	*up_client_get_devices2			(UpClient		*client);
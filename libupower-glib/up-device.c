@@ -33,9 +33,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <glib-object.h>
+#include <gio/gunixfdlist.h>
 #include <string.h>
 
 #include "up-device.h"
+#include "up-device-private.h"
 #include "up-device-generated.h"
 #include "up-stats-item.h"
 #include "up-history-item.h"
@@ -97,6 +99,9 @@ enum {
 	PROP_LAST
 };
 
+/* D-Bus glue property name -> UpDevice GParamSpec, built in class_init */
+static GHashTable *up_device_property_map = NULL;
+
 G_DEFINE_TYPE (UpDevice, up_device, G_TYPE_OBJECT)
 
 /*
@@ -105,17 +110,49 @@ G_DEFINE_TYPE (UpDevice, up_device, G_TYPE_OBJECT)
 static void
 up_device_changed_cb (UpExportedDevice *proxy, GParamSpec *pspec, UpDevice *device)
 {
+	GParamSpec *device_pspec;
+
 	/* Proxy the notification from the D-Bus glue object
 	 * to the real one, but only if the property exists
-	 * for UpClient */
-	if (!g_object_class_find_property (G_OBJECT_GET_CLASS (device), pspec->name) &&
-	    !g_str_equal (pspec->name, "type"))
+	 * for UpDevice */
+	device_pspec = g_hash_table_lookup (up_device_property_map, pspec->name);
+	if (device_pspec == NULL)
 		return;
 
-	if (g_strcmp0 (pspec->name, "type") == 0)
-		g_object_notify (G_OBJECT (device), "kind");
-	else
-		g_object_notify (G_OBJECT (device), pspec->name);
+	g_object_notify_by_pspec (G_OBJECT (device), device_pspec);
+}
+
+/*
+ * up_device_set_proxy_device:
+ */
+static void
+up_device_set_proxy_device (UpDevice *device, UpExportedDevice *proxy_device)
+{
+	g_clear_pointer (&device->priv->offline_props, g_hash_table_unref);
+
+	/* listen to Changed; the proxy may be shared with other devices
+	 * and outlive this one */
+	g_signal_connect_object (proxy_device, "notify",
+				 G_CALLBACK (up_device_changed_cb), device, 0);
+
+	/* yay */
+	device->priv->proxy_device = proxy_device;
+}
+
+/*
+ * _up_device_new_for_proxy:
+ *
+ * Creates a #UpDevice for a proxy the caller already has, for instance
+ * one owned by the object manager in #UpClient.
+ */
+UpDevice *
+_up_device_new_for_proxy (UpExportedDevice *proxy_device)
+{
+	UpDevice *device;
+
+	device = up_device_new ();
+	up_device_set_proxy_device (device, g_object_ref (proxy_device));
+	return device;
 }
 
 /**
@@ -151,8 +188,6 @@ up_device_set_object_path_sync (UpDevice *device, const gchar *object_path, GCan
 		goto out;
 	}
 
-	g_clear_pointer (&device->priv->offline_props, g_hash_table_unref);
-
 	/* connect to the correct path for all the other methods */
 	proxy_device = up_exported_device_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
 								  G_DBUS_PROXY_FLAGS_NONE,
@@ -163,16 +198,113 @@ up_device_set_object_path_sync (UpDevice *device, const gchar *object_path, GCan
 	if (proxy_device == NULL)
 		return FALSE;
 
-	/* listen to Changed */
-	g_signal_connect (proxy_device, "notify",
-			  G_CALLBACK (up_device_changed_cb), device);
-
-	/* yay */
-	device->priv->proxy_device = proxy_device;
+	up_device_set_proxy_device (device, proxy_device);
 out:
 	return ret;
 }
 
+/*
+ * up_device_set_object_path_cb:
+ */
+static void
+up_device_set_object_path_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	UpDevice *device = UP_DEVICE (g_task_get_source_object (task));
+	UpExportedDevice *proxy_device;
+	GError *error = NULL;
+
+	proxy_device = up_exported_device_proxy_new_for_bus_finish (res, &error);
+	if (proxy_device == NULL) {
+		g_task_return_error (task, error);
+		goto out;
+	}
+
+	/* another caller won the race */
+	if (device->priv->proxy_device != NULL) {
+		g_object_unref (proxy_device);
+		g_task_return_new_error (task, 1, 0,
+					 "Object path already set: %s",
+					 up_device_get_object_path (device));
+		goto out;
+	}
+
+	up_device_set_proxy_device (device, proxy_device);
+	g_task_return_boolean (task, TRUE);
+out:
+	g_object_unref (task);
+}
+
+/**
+ * up_device_set_object_path_async:
+ * @device: a #UpDevice instance.
+ * @object_path: The UPower object path.
+ * @cancellable: a #GCancellable or %NULL
+ * @callback: a #GAsyncReadyCallback to call when the request is satisfied
+ * @user_data: the data to pass to @callback
+ *
+ * Asynchronously sets the object path of the object and fills up
+ * initial properties. Call up_device_set_object_path_finish() from
+ * @callback to get the result.
+ *
+ * Since: 0.99.11
+ **/
+void
+up_device_set_object_path_async (UpDevice *device, const gchar *object_path, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+	GTask *task;
+
+	g_return_if_fail (UP_IS_DEVICE (device));
+	g_return_if_fail (object_path != NULL);
+
+	task = g_task_new (device, cancellable, callback, user_data);
+
+	if (device->priv->proxy_device != NULL) {
+		g_task_return_new_error (task, 1, 0,
+					 "Object path already set: %s",
+					 up_device_get_object_path (device));
+		g_object_unref (task);
+		return;
+	}
+
+	/* check valid */
+	if (!g_variant_is_object_path (object_path)) {
+		g_task_return_new_error (task, 1, 0,
+					 "Object path invalid: %s", object_path);
+		g_object_unref (task);
+		return;
+	}
+
+	up_exported_device_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
+					      G_DBUS_PROXY_FLAGS_NONE,
+					      "org.freedesktop.UPower",
+					      object_path,
+					      cancellable,
+					      up_device_set_object_path_cb,
+					      task);
+}
+
+/**
+ * up_device_set_object_path_finish:
+ * @device: a #UpDevice instance.
+ * @res: a #GAsyncResult
+ * @error: a #GError, or %NULL.
+ *
+ * Gets the result of up_device_set_object_path_async().
+ *
+ * Return value: #TRUE for success, else #FALSE and @error is used
+ *
+ * Since: 0.99.11
+ **/
+gboolean
+up_device_set_object_path_finish (UpDevice *device, GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
+	g_return_val_if_fail (g_task_is_valid (res, device), FALSE);
+
+	return g_task_propagate_boolean (G_TASK (res), error);
+}
+
 /**
  * up_device_get_object_path:
  * @device: a #UpDevice instance.
@@ -512,6 +644,98 @@ out:
 	return array;
 }
 
+/*
+ * up_device_get_history_fd_cb:
+ */
+static void
+up_device_get_history_fd_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	GUnixFDList *fd_list = NULL;
+	GVariant *handle = NULL;
+	GError *error = NULL;
+	gint fd;
+
+	if (!up_exported_device_call_get_history_fd_finish (UP_EXPORTED_DEVICE (source_object),
+							    &handle,
+							    &fd_list,
+							    res,
+							    &error)) {
+		g_task_return_error (task, error);
+		goto out;
+	}
+
+	/* this is a dup of the descriptor, so owned by the caller */
+	fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (handle), &error);
+	if (fd < 0) {
+		g_task_return_error (task, error);
+		goto out;
+	}
+	g_task_return_int (task, fd);
+out:
+	g_clear_pointer (&handle, g_variant_unref);
+	g_clear_object (&fd_list);
+	g_object_unref (task);
+}
+
+/**
+ * up_device_get_history_fd_async:
+ * @device: a #UpDevice instance.
+ * @type: type of history, e.g. "rate" or "charge"
+ * @timespec: the amount of time to look back into time, or 0 for all.
+ * @cancellable: a #GCancellable or %NULL
+ * @callback: a #GAsyncReadyCallback to call when the request is satisfied
+ * @user_data: the data to pass to @callback
+ *
+ * Asynchronously gets a file descriptor the full resolution device
+ * history can be read from. Unlike up_device_get_history_sync() the
+ * data is streamed, so this is suitable for large ranges. Call
+ * up_device_get_history_fd_finish() from @callback to get the result.
+ *
+ * Since: 0.99.11
+ **/
+void
+up_device_get_history_fd_async (UpDevice *device, const gchar *type, guint timespec, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+	GTask *task;
+
+	g_return_if_fail (UP_IS_DEVICE (device));
+	g_return_if_fail (device->priv->proxy_device != NULL);
+
+	task = g_task_new (device, cancellable, callback, user_data);
+	up_exported_device_call_get_history_fd (device->priv->proxy_device,
+						type,
+						timespec,
+						NULL,
+						cancellable,
+						up_device_get_history_fd_cb,
+						task);
+}
+
+/**
+ * up_device_get_history_fd_finish:
+ * @device: a #UpDevice instance.
+ * @res: a #GAsyncResult
+ * @error: a #GError, or %NULL.
+ *
+ * Gets the result of up_device_get_history_fd_async(). Reading the
+ * descriptor until end-of-file returns packed 16 byte records, oldest
+ * first, each a 32 bit time in seconds, a 32 bit #UpDeviceState and a
+ * double value, all in host byte order.
+ *
+ * Return value: a file descriptor to close with close(), or -1 and @error is used
+ *
+ * Since: 0.99.11
+ **/
+gint
+up_device_get_history_fd_finish (UpDevice *device, GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail (UP_IS_DEVICE (device), -1);
+	g_return_val_if_fail (g_task_is_valid (res, device), -1);
+
+	return g_task_propagate_int (G_TASK (res), error);
+}
+
 /**
  * up_device_get_statistics_sync:
  * @device: a #UpDevice instance.
@@ -839,6 +1063,10 @@ static void
 up_device_class_init (UpDeviceClass *klass)
 {
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	GParamSpec **pspecs;
+	guint n_pspecs;
+	guint i;
+
 	object_class->finalize = up_device_finalize;
 	object_class->set_property = up_device_set_property;
 	object_class->get_property = up_device_get_property;
@@ -1266,6 +1494,16 @@ up_device_class_init (UpDeviceClass *klass)
 							      G_PARAM_READWRITE));
 
 	g_type_class_add_private (klass, sizeof (UpDevicePrivate));
+
+	/* the glue object uses the same property names, except for "type" */
+	up_device_property_map = g_hash_table_new (g_str_hash, g_str_equal);
+	pspecs = g_object_class_list_properties (object_class, &n_pspecs);
+	for (i = 0; i < n_pspecs; i++)
+		g_hash_table_insert (up_device_property_map,
+				     (gpointer) pspecs[i]->name, pspecs[i]);
+	g_hash_table_insert (up_device_property_map, (gpointer) "type",
+			     g_object_class_find_property (object_class, "kind"));
+	g_free (pspecs);
 }
 
 static void
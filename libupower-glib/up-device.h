@@ -87,6 +87,25 @@ GPtrArray	*up_device_get_statistics_sync		(UpDevice		*device,
 							 GCancellable		*cancellable,
 							 GError			**error);
 
+/* async versions */
+void		 up_device_set_object_path_async	(UpDevice		*device,
+							 const gchar		*object_path,
+							 GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+gboolean	 up_device_set_object_path_finish	(UpDevice		*device,
+							 GAsyncResult		*res,
+							 GError			**error);
+void		 up_device_get_history_fd_async		(UpDevice		*device,
+							 const gchar		*type,
+							 guint			 timespec,
+							 GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+gint		 up_device_get_history_fd_finish	(UpDevice		*device,
+							 GAsyncResult		*res,
+							 GError			**error);
+
 /* accessors */
 const gchar	*up_device_get_object_path		(UpDevice		*device);
 
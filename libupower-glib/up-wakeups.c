@@ -77,6 +77,53 @@ up_wakeups_get_total_sync (UpWakeups *wakeups, GCancellable *cancellable, GError
 	return total;
 }
 
+/**
+ * up_wakeups_subscribe_sync:
+ * @wakeups: a #UpWakeups instance.
+ * @interval: how often the data should be refreshed, in seconds, or 0 for the default
+ * @cancellable: a #GCancellable or %NULL
+ * @error: a #GError, or %NULL.
+ *
+ * Asks the daemon to collect wakeup data until up_wakeups_unsubscribe_sync()
+ * is called or this process exits. The daemon does not poll while nobody
+ * is subscribed.
+ *
+ * Return value: %TRUE for success
+ *
+ * Since: 0.99.11
+ **/
+gboolean
+up_wakeups_subscribe_sync (UpWakeups *wakeups, guint interval, GCancellable *cancellable, GError **error)
+{
+	g_return_val_if_fail (UP_IS_WAKEUPS (wakeups), FALSE);
+	g_return_val_if_fail (wakeups->priv->proxy != NULL, FALSE);
+
+	return up_exported_wakeups_call_subscribe_sync (wakeups->priv->proxy, interval,
+							cancellable, error);
+}
+
+/**
+ * up_wakeups_unsubscribe_sync:
+ * @wakeups: a #UpWakeups instance.
+ * @cancellable: a #GCancellable or %NULL
+ * @error: a #GError, or %NULL.
+ *
+ * Tells the daemon the wakeup data is no longer needed.
+ *
+ * Return value: %TRUE for success
+ *
+ * Since: 0.99.11
+ **/
+gboolean
+up_wakeups_unsubscribe_sync (UpWakeups *wakeups, GCancellable *cancellable, GError **error)
+{
+	g_return_val_if_fail (UP_IS_WAKEUPS (wakeups), FALSE);
+	g_return_val_if_fail (wakeups->priv->proxy != NULL, FALSE);
+
+	return up_exported_wakeups_call_unsubscribe_sync (wakeups->priv->proxy,
+							  cancellable, error);
+}
+
 /**
  * up_wakeups_get_data_sync:
  * @wakeups: a #UpWakeups instance.
@@ -67,6 +67,13 @@ UpWakeups	*up_wakeups_new				(void);
 guint		 up_wakeups_get_total_sync		(UpWakeups		*wakeups,
 							 GCancellable		*cancellable,
 							 GError			**error);
+gboolean	 up_wakeups_subscribe_sync		(UpWakeups		*wakeups,
+							 guint			 interval,
+							 GCancellable		*cancellable,
+							 GError			**error);
+gboolean	 up_wakeups_unsubscribe_sync		(UpWakeups		*wakeups,
+							 GCancellable		*cancellable,
+							 GError			**error);
 GPtrArray	*up_wakeups_get_data_sync		(UpWakeups		*wakeups,
 							 GCancellable		*cancellable,
 							 GError			**error);
@@ -32,6 +32,7 @@
 #include <errno.h>
 
 #include "hidpp-device.h"
+#include "up-probes.h"
 
 /* Arbitrary value used in ping */
 #define HIDPP_PING_DATA						0x42
@@ -332,13 +333,17 @@ hidpp_device_cmd (HidppDevice	*device,
 		  HidppMessage	*response,
 		  GError	**error)
 {
+	gboolean ret = FALSE;
 	gssize wrote;
 	guint msg_len;
+	gint64 start;
 	HidppDevicePrivate *priv = device->priv;
 
 	g_assert (request->type == HIDPP_MSG_TYPE_SHORT ||
 			request->type == HIDPP_MSG_TYPE_LONG);
 
+	start = UP_PROBE_CLOCK ();
+
 	hidpp_device_print_buffer (device, request);
 
 	msg_len = HIDPP_MSG_LENGTH(request);
@@ -358,15 +363,18 @@ hidpp_device_cmd (HidppDevice	*device,
 					"Could not fully write HID++ request, wrote %" G_GSIZE_FORMAT " bytes",
 					wrote);
 		}
-		return FALSE;
+		goto out;
 	}
 
-	return hidpp_device_read_resp (device,
+	ret = hidpp_device_read_resp (device,
 		request->device_idx,
 		request->feature_idx,
 		request->function_idx,
 		response,
 		error);
+out:
+	UP_PROBE3 (hidpp_cmd, priv->hidraw_device, g_get_monotonic_time () - start, ret);
+	return ret;
 }
 
 /**
@@ -42,6 +42,26 @@
 #include <glib.h>
 
 #include "sysfs-utils.h"
+#include "up-config.h"
+#include "up-stats.h"
+
+/* every attribute read goes through here so it can be counted */
+static gboolean
+sysfs_get_contents (const char *filename, char **contents)
+{
+	gboolean ret;
+	gint64 start;
+	gsize length = 0;
+	static UpStatsCounter *stats = NULL;
+
+	if (stats == NULL)
+		stats = up_stats_get_counter ("sysfs", "read");
+	start = g_get_monotonic_time ();
+	ret = g_file_get_contents (filename, contents, &length, NULL);
+	up_stats_counter_add (stats, start);
+	up_stats_counter_add_bytes (stats, length);
+	return ret;
+}
 
 gboolean
 sysfs_get_double_with_error (const char *dir,
@@ -55,8 +75,8 @@ sysfs_get_double_with_error (const char *dir,
 
 	g_return_val_if_fail (value != NULL, FALSE);
 
-	filename = g_build_filename (dir, attribute, NULL);
-	if (g_file_get_contents (filename, &contents, NULL, NULL)) {
+	filename = g_build_filename (up_config_get_root (), dir, attribute, NULL);
+	if (sysfs_get_contents (filename, &contents)) {
 		parsed = g_ascii_strtod (contents, NULL);
 		if (errno == 0)
 			ret = TRUE;
@@ -78,8 +98,8 @@ sysfs_get_double (const char *dir, const char *attribute)
 	char *filename;
 
 	result = 0.0;
-	filename = g_build_filename (dir, attribute, NULL);
-	if (g_file_get_contents (filename, &contents, NULL, NULL)) {
+	filename = g_build_filename (up_config_get_root (), dir, attribute, NULL);
+	if (sysfs_get_contents (filename, &contents)) {
 		result = g_ascii_strtod (contents, NULL);
 		g_free (contents);
 	}
@@ -95,8 +115,8 @@ sysfs_get_string (const char *dir, const char *attribute)
 	char *filename;
 
 	result = NULL;
-	filename = g_build_filename (dir, attribute, NULL);
-	if (!g_file_get_contents (filename, &result, NULL, NULL)) {
+	filename = g_build_filename (up_config_get_root (), dir, attribute, NULL);
+	if (!sysfs_get_contents (filename, &result)) {
 		result = g_strdup ("");
 	}
 	g_free (filename);
@@ -112,8 +132,8 @@ sysfs_get_int (const char *dir, const char *attribute)
 	char *filename;
 
 	result = 0;
-	filename = g_build_filename (dir, attribute, NULL);
-	if (g_file_get_contents (filename, &contents, NULL, NULL)) {
+	filename = g_build_filename (up_config_get_root (), dir, attribute, NULL);
+	if (sysfs_get_contents (filename, &contents)) {
 		result = atoi (contents);
 		g_free (contents);
 	}
@@ -130,8 +150,8 @@ sysfs_get_bool (const char *dir, const char *attribute)
 	char *filename;
 
 	result = FALSE;
-	filename = g_build_filename (dir, attribute, NULL);
-	if (g_file_get_contents (filename, &contents, NULL, NULL)) {
+	filename = g_build_filename (up_config_get_root (), dir, attribute, NULL);
+	if (sysfs_get_contents (filename, &contents)) {
 		g_strdelimit (contents, "\n", '\0');
 		result = (g_strcmp0 (contents, "1") == 0);
 		g_free (contents);
@@ -148,7 +168,7 @@ sysfs_file_exists (const char *dir, const char *attribute)
 	char *filename;
 
 	result = FALSE;
-	filename = g_build_filename (dir, attribute, NULL);
+	filename = g_build_filename (up_config_get_root (), dir, attribute, NULL);
 	if (g_file_test (filename, G_FILE_TEST_EXISTS)) {
 		result = TRUE;
 	}
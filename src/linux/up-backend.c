@@ -45,6 +45,8 @@
 #include "up-device-bluez.h"
 #include "up-input.h"
 #include "up-config.h"
+#include "up-probes.h"
+#include "up-stats.h"
 #ifdef HAVE_IDEVICE
 #include "up-device-idevice.h"
 #endif /* HAVE_IDEVICE */
@@ -265,6 +267,12 @@ up_backend_uevent_signal_handler_cb (GUdevClient *client, const gchar *action,
 				      GUdevDevice *device, gpointer user_data)
 {
 	UpBackend *backend = UP_BACKEND (user_data);
+	gint64 start;
+	static UpStatsCounter *stats = NULL;
+
+	if (stats == NULL)
+		stats = up_stats_get_counter ("backend", "uevent");
+	start = g_get_monotonic_time ();
 
 	if (g_strcmp0 (action, "add") == 0) {
 		g_debug ("SYSFS add %s", g_udev_device_get_sysfs_path (device));
@@ -278,6 +286,9 @@ up_backend_uevent_signal_handler_cb (GUdevClient *client, const gchar *action,
 	} else {
 		g_debug ("unhandled action '%s' on %s", action, g_udev_device_get_sysfs_path (device));
 	}
+	up_stats_counter_add (stats, start);
+	UP_PROBE3 (uevent, g_udev_device_get_sysfs_path (device), action,
+		   g_get_monotonic_time () - start);
 }
 
 static gpointer
@@ -48,6 +48,7 @@
 #include <unistd.h>
 
 #include "sysfs-utils.h"
+#include "up-config.h"
 #include "up-types.h"
 #include "up-device-hid.h"
 #include "up-constants.h"
@@ -309,6 +310,7 @@ up_device_hid_coldplug (UpDevice *device)
 	gboolean ret = FALSE;
 	gboolean fake_device;
 	const gchar *device_file;
+	gchar *device_path;
 	const gchar *type;
 	const gchar *vendor;
 
@@ -327,7 +329,9 @@ up_device_hid_coldplug (UpDevice *device)
 
 	/* connect to the device */
 	g_debug ("using device: %s", device_file);
-	hid->priv->fd = open (device_file, O_RDONLY | O_NONBLOCK);
+	device_path = up_config_build_path (device_file);
+	hid->priv->fd = open (device_path, O_RDONLY | O_NONBLOCK);
+	g_free (device_path);
 	if (hid->priv->fd < 0) {
 		g_debug ("cannot open device file %s", device_file);
 		goto out;
@@ -350,6 +354,7 @@ up_device_hid_coldplug (UpDevice *device)
 		vendor = g_udev_device_get_property (native, "ID_VENDOR");
 
 	/* hardcode some values */
+	up_device_freeze (device);
 	g_object_set (device,
 		      "type", UP_DEVICE_KIND_UPS,
 		      "is-rechargeable", TRUE,
@@ -374,12 +379,14 @@ up_device_hid_coldplug (UpDevice *device)
 		ret = up_device_hid_get_all_data (hid);
 		if (!ret) {
 			g_debug ("failed to coldplug UPS: %s", device_file);
+			up_device_thaw (device);
 			goto out;
 		}
 	}
 
 	/* fix up device states */
 	up_device_hid_fixup_state (device);
+	up_device_thaw (device);
 out:
 	return ret;
 }
@@ -399,6 +406,9 @@ up_device_hid_refresh (UpDevice *device)
 	int rd;
 	UpDeviceHid *hid = UP_DEVICE_HID (device);
 
+	/* publish all the changes of this refresh at once */
+	up_device_freeze (device);
+
 	/* read any data */
 	rd = read (hid->priv->fd, ev, sizeof (ev));
 
@@ -430,6 +440,7 @@ up_device_hid_refresh (UpDevice *device)
 	/* reset time */
 	g_object_set (device, "update-time", (guint64) g_get_real_time () / G_USEC_PER_SEC, NULL);
 out:
+	up_device_thaw (device);
 	return ret;
 }
 
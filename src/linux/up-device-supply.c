@@ -25,6 +25,8 @@
 
 #include <string.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -38,6 +40,7 @@
 #include "up-types.h"
 #include "up-constants.h"
 #include "up-device-supply.h"
+#include "up-rate-estimator.h"
 #include "up-backend-linux-private.h"
 
 #define UP_DEVICE_SUPPLY_CHARGED_THRESHOLD	90.0f	/* % */
@@ -45,15 +48,19 @@
 #define UP_DEVICE_SUPPLY_COLDPLUG_UNITS_CHARGE		TRUE
 #define UP_DEVICE_SUPPLY_COLDPLUG_UNITS_ENERGY		FALSE
 
-/* number of old energy values to keep cached */
-#define UP_DEVICE_SUPPLY_ENERGY_OLD_LENGTH		4
-
 typedef enum {
 	REFRESH_RESULT_FAILURE = 0,
 	REFRESH_RESULT_SUCCESS = 1,
 	REFRESH_RESULT_NO_DATA
 } RefreshResult;
 
+/* what the profiling thread reads, kept open for the session */
+typedef struct {
+	gint			 power_fd;
+	gint			 current_fd;
+	gint			 voltage_fd;
+} UpDeviceSupplyProfile;
+
 struct UpDeviceSupplyPrivate
 {
 	guint			 poll_timer_id;
@@ -62,9 +69,9 @@ struct UpDeviceSupplyPrivate
 	gdouble			 voltage_design;
 	gdouble			 voltage_min_design;
 	gdouble			 voltage_max_design;
-	gdouble			*energy_old;
-	GTimeVal		*energy_old_timespec;
-	guint			 energy_old_first;
+	UpRateEstimator		 rate_estimator;
+	UpDeviceState		 rate_state;
+	gdouble			 energy_old;
 	gdouble			 rate_old;
 	guint			 unknown_retries;
 	gint64			 last_unknown_retry;
@@ -107,7 +114,6 @@ static void
 up_device_supply_reset_values (UpDeviceSupply *supply)
 {
 	UpDevice *device = UP_DEVICE (supply);
-	guint i;
 
 	supply->priv->has_coldplug_values = FALSE;
 	supply->priv->coldplug_units = UP_DEVICE_SUPPLY_COLDPLUG_UNITS_ENERGY;
@@ -115,12 +121,9 @@ up_device_supply_reset_values (UpDeviceSupply *supply)
 	supply->priv->voltage_max_design = 0;
 	supply->priv->voltage_design = 0;
 	supply->priv->rate_old = 0;
-
-	for (i = 0; i < UP_DEVICE_SUPPLY_ENERGY_OLD_LENGTH; ++i) {
-		supply->priv->energy_old[i] = 0.0f;
-		supply->priv->energy_old_timespec[i].tv_sec = 0;
-	}
-	supply->priv->energy_old_first = 0;
+	supply->priv->energy_old = 0;
+	supply->priv->rate_state = UP_DEVICE_STATE_UNKNOWN;
+	up_rate_estimator_reset (&supply->priv->rate_estimator);
 
 	/* reset to default */
 	g_object_set (device,
@@ -214,87 +217,26 @@ up_device_supply_get_online (UpDevice *device, gboolean *online)
 	return TRUE;
 }
 
-/**
- * up_device_supply_push_new_energy:
- *
- * Store the new energy in the list of old energies of the supply, so
- * it can be used to determine the energy rate.
- */
-static gboolean
-up_device_supply_push_new_energy (UpDeviceSupply *supply, gdouble energy)
-{
-	guint first = supply->priv->energy_old_first;
-	guint new_position = (first + UP_DEVICE_SUPPLY_ENERGY_OLD_LENGTH - 1) %
-		UP_DEVICE_SUPPLY_ENERGY_OLD_LENGTH;
-
-	/* check if the energy value has changed and, if that's the case,
-	 * store the new values in the buffer. */
-	if (supply->priv->energy_old[first] != energy) {
-		supply->priv->energy_old[new_position] = energy;
-		g_get_current_time (&supply->priv->energy_old_timespec[new_position]);
-		supply->priv->energy_old_first = new_position;
-		return TRUE;
-	}
-
-	return FALSE;
-}
-
 /**
  * up_device_supply_calculate_rate:
+ *
+ * Used when the hardware does not report the rate, which is then
+ * estimated from how the energy changes over time.
  **/
 static gdouble
 up_device_supply_calculate_rate (UpDeviceSupply *supply, gdouble energy)
 {
-	gdouble rate = 0.0f;
-	gdouble sum_x = 0.0f; /* sum of the squared times difference */
-	GTimeVal now;
-	guint i;
-	guint valid_values = 0;
-
-	/* get the time difference from now and use linear regression to determine
-	 * the discharge rate of the battery. */
-	g_get_current_time (&now);
-
-	/* store the data on the new energy received */
-	up_device_supply_push_new_energy (supply, energy);
+	gdouble rate;
 
 	if (energy < 0.1f)
 		return 0.0f;
 
-	if (supply->priv->energy_old[supply->priv->energy_old_first] < 0.1f)
-		return 0.0f;
-
-	/* don't use the new point obtained since it may cause instability in
-	 * the estimate */
-	i = supply->priv->energy_old_first;
-	now = supply->priv->energy_old_timespec[i];
-	do {
-		/* only use this value if it seems valid */
-		if (supply->priv->energy_old_timespec[i].tv_sec && supply->priv->energy_old[i]) {
-			/* This is the square of t_i^2 */
-			sum_x += (now.tv_sec - supply->priv->energy_old_timespec[i].tv_sec) *
-				(now.tv_sec - supply->priv->energy_old_timespec[i].tv_sec);
-
-			/* Sum the module of the energy difference */
-			rate += fabs ((supply->priv->energy_old_timespec[i].tv_sec - now.tv_sec) *
-				      (energy - supply->priv->energy_old[i]));
-			valid_values++;
-		}
-
-		/* get the next element in the circular buffer */
-		i = (i + 1) % UP_DEVICE_SUPPLY_ENERGY_OLD_LENGTH;
-	} while (i != supply->priv->energy_old_first);
-
-	/* Check that at least 3 points were involved in computation */
-	if (sum_x == 0.0f || valid_values < 3)
+	up_rate_estimator_add (&supply->priv->rate_estimator, g_get_monotonic_time (), energy);
+	if (!up_rate_estimator_get_rate (&supply->priv->rate_estimator, &rate))
 		return supply->priv->rate_old;
 
-	/* Compute the discharge per hour, and not per second */
-	rate /= sum_x / SECONDS_PER_HOUR_F;
-
-	/* if the rate is zero, use the old rate. It will usually happens if no
-	 * data is in the buffer yet. If the rate is too high, i.e. more than,
-	 * 100W don't use it. */
+	/* if the rate is zero, use the old rate. If the rate is too high,
+	 * i.e. more than, 100W don't use it. */
 	if (rate == 0.0f || rate > 100.0f)
 		return supply->priv->rate_old;
 
@@ -549,7 +491,6 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply,
 {
 	gchar *technology_native = NULL;
 	UpDeviceTechnology technology;
-	UpDeviceState old_state;
 	UpDeviceState state;
 	UpDevice *device = UP_DEVICE (supply);
 	const gchar *native_path;
@@ -574,10 +515,6 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply,
 	UpDaemon *daemon;
 	gboolean ac_online = FALSE;
 	gboolean has_ac = FALSE;
-	gboolean online;
-	UpDeviceList *devices_list;
-	GPtrArray *devices;
-	guint i;
 
 	native = G_UDEV_DEVICE (up_device_get_native (device));
 	native_path = g_udev_device_get_sysfs_path (native);
@@ -822,19 +759,7 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply,
 
 		/* If we have any online AC, assume charging, otherwise
 		 * discharging */
-		devices_list = up_daemon_get_device_list (daemon);
-		devices = up_device_list_get_array (devices_list);
-		for (i=0; i < devices->len; i++) {
-			if (up_device_get_online ((UpDevice *) g_ptr_array_index (devices, i), &online)) {
-			       has_ac = TRUE;
-				if (online) {
-					ac_online = TRUE;
-				}
-				break;
-			}
-		}
-		g_ptr_array_unref (devices);
-		g_object_unref (devices_list);
+		has_ac = up_daemon_get_on_ac (daemon, &ac_online);
 
 		if (has_ac) {
 			if (ac_online) {
@@ -898,6 +823,12 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply,
 		}
 	}
 
+	/* steady it with what was learned about this battery */
+	if (state == UP_DEVICE_STATE_DISCHARGING)
+		time_to_empty = up_device_predict_time (device, state, percentage, time_to_empty);
+	else if (state == UP_DEVICE_STATE_CHARGING)
+		time_to_full = up_device_predict_time (device, state, percentage, time_to_full);
+
 	/* check the remaining time is under a set limit, to deal with broken
 	   primary batteries rate */
 	if (time_to_empty > (240 * 60 * 60)) /* ten days for discharging */
@@ -908,20 +839,19 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply,
 	/* get temperature */
 	temp = sysfs_get_double(native_path, "temp") / 10.0;
 
-	/* check if the energy value has changed and, if that's the case,
-	 * store the new values in the buffer. */
-	if (up_device_supply_push_new_energy (supply, energy))
+	/* remember the rate when the energy last changed */
+	if (supply->priv->energy_old != energy) {
+		supply->priv->energy_old = energy;
 		supply->priv->rate_old = energy_rate;
+	}
 
-	/* we changed state */
-	g_object_get (device, "state", &old_state, NULL);
-	if (old_state != state) {
-		for (i = 0; i < UP_DEVICE_SUPPLY_ENERGY_OLD_LENGTH; ++i) {
-			supply->priv->energy_old[i] = 0.0f;
-			supply->priv->energy_old_timespec[i].tv_sec = 0;
-
-		}
-		supply->priv->energy_old_first = 0;
+	/* the fit only holds while going in the same direction, but there is
+	 * no need to start again when e.g. the firmware briefly reports
+	 * an unknown state */
+	if ((state == UP_DEVICE_STATE_CHARGING || state == UP_DEVICE_STATE_DISCHARGING) &&
+	    state != supply->priv->rate_state) {
+		up_rate_estimator_reset (&supply->priv->rate_estimator);
+		supply->priv->rate_state = state;
 	}
 
 	*out_state = state;
@@ -1279,6 +1209,9 @@ up_device_supply_refresh (UpDevice *device)
 	UpDeviceKind type;
 	UpDeviceState state;
 
+	/* publish all the changes of this refresh at once */
+	up_device_freeze (device);
+
 	g_object_get (device, "type", &type, NULL);
 	switch (type) {
 	case UP_DEVICE_KIND_LINE_POWER:
@@ -1297,9 +1230,110 @@ up_device_supply_refresh (UpDevice *device)
 	if (ret == REFRESH_RESULT_SUCCESS)
 		g_object_set (device, "update-time", (guint64) g_get_real_time () / G_USEC_PER_SEC, NULL);
 
+	up_device_thaw (device);
+
 	return (ret != REFRESH_RESULT_FAILURE);
 }
 
+/**
+ * up_device_supply_profile_read:
+ *
+ * Sysfs attributes are regenerated on every read from the start, so the
+ * same descriptor can be used for each sample.
+ **/
+static gboolean
+up_device_supply_profile_read (gint fd, gdouble *value)
+{
+	gchar buf[32];
+	gssize len;
+
+	len = pread (fd, buf, sizeof (buf) - 1, 0);
+	if (len <= 0)
+		return FALSE;
+	buf[len] = '\0';
+	*value = fabs (g_ascii_strtod (buf, NULL) / 1000000.0);
+	return TRUE;
+}
+
+/**
+ * up_device_supply_profile_sample_cb:
+ *
+ * Runs on the profiling thread.
+ **/
+static gboolean
+up_device_supply_profile_sample_cb (UpProfileSample *sample, UpDeviceSupplyProfile *profile)
+{
+	if (profile->voltage_fd >= 0)
+		up_device_supply_profile_read (profile->voltage_fd, &sample->voltage);
+	if (profile->current_fd >= 0)
+		up_device_supply_profile_read (profile->current_fd, &sample->current);
+	if (profile->power_fd >= 0)
+		return up_device_supply_profile_read (profile->power_fd, &sample->power);
+
+	/* no power_now, so work it out */
+	sample->power = sample->voltage * sample->current;
+	return sample->voltage > 0.0f;
+}
+
+/**
+ * up_device_supply_profile_free:
+ **/
+static void
+up_device_supply_profile_free (UpDeviceSupplyProfile *profile)
+{
+	if (profile->power_fd >= 0)
+		close (profile->power_fd);
+	if (profile->current_fd >= 0)
+		close (profile->current_fd);
+	if (profile->voltage_fd >= 0)
+		close (profile->voltage_fd);
+	g_free (profile);
+}
+
+/**
+ * up_device_supply_profile_open:
+ **/
+static gint
+up_device_supply_profile_open (const gchar *native_path, const gchar *key)
+{
+	gchar *filename;
+	gint fd;
+
+	filename = g_build_filename (up_config_get_root (), native_path, key, NULL);
+	fd = open (filename, O_RDONLY | O_CLOEXEC);
+	g_free (filename);
+	return fd;
+}
+
+/**
+ * up_device_supply_setup_profile:
+ **/
+static gboolean
+up_device_supply_setup_profile (UpDevice *device, UpProfile *profile)
+{
+	UpDeviceSupplyProfile *data;
+	GUdevDevice *native;
+	const gchar *native_path;
+
+	native = G_UDEV_DEVICE (up_device_get_native (device));
+	native_path = g_udev_device_get_sysfs_path (native);
+
+	data = g_new0 (UpDeviceSupplyProfile, 1);
+	data->power_fd = up_device_supply_profile_open (native_path, "power_now");
+	data->current_fd = up_device_supply_profile_open (native_path, "current_now");
+	data->voltage_fd = up_device_supply_profile_open (native_path, "voltage_now");
+	if (data->power_fd < 0 && (data->current_fd < 0 || data->voltage_fd < 0)) {
+		g_debug ("no power or current and voltage for %s", native_path);
+		up_device_supply_profile_free (data);
+		return FALSE;
+	}
+
+	up_profile_set_sampler (profile,
+				(UpProfileSampleFunc) up_device_supply_profile_sample_cb,
+				data, (GDestroyNotify) up_device_supply_profile_free);
+	return TRUE;
+}
+
 /**
  * up_device_supply_init:
  **/
@@ -1310,10 +1344,6 @@ up_device_supply_init (UpDeviceSupply *supply)
 
 	supply->priv = UP_DEVICE_SUPPLY_GET_PRIVATE (supply);
 
-	/* allocate the stats for the battery charging & discharging */
-	supply->priv->energy_old = g_new (gdouble, UP_DEVICE_SUPPLY_ENERGY_OLD_LENGTH);
-	supply->priv->energy_old_timespec = g_new (GTimeVal, UP_DEVICE_SUPPLY_ENERGY_OLD_LENGTH);
-
 	supply->priv->shown_invalid_voltage_warning = FALSE;
 
 	config = up_config_new ();
@@ -1321,6 +1351,9 @@ up_device_supply_init (UpDeviceSupply *supply)
 	 * kernel on some BIOS types, but if polling
 	 * is disabled in the configuration, do nothing */
 	supply->priv->disable_battery_poll = up_config_get_boolean (config, "NoPollBatteries");
+	up_rate_estimator_init (&supply->priv->rate_estimator,
+				up_config_get_uint (config, "EnergyRateWindow"),
+				up_config_get_uint (config, "EnergyRateSmoothing"));
 	g_object_unref (config);
 }
 
@@ -1343,9 +1376,6 @@ up_device_supply_finalize (GObject *object)
 	if (supply->priv->poll_timer_id > 0)
 		g_source_remove (supply->priv->poll_timer_id);
 
-	g_free (supply->priv->energy_old);
-	g_free (supply->priv->energy_old_timespec);
-
 	G_OBJECT_CLASS (up_device_supply_parent_class)->finalize (object);
 }
 
@@ -1363,6 +1393,7 @@ up_device_supply_class_init (UpDeviceSupplyClass *klass)
 	device_class->get_online = up_device_supply_get_online;
 	device_class->coldplug = up_device_supply_coldplug;
 	device_class->refresh = up_device_supply_refresh;
+	device_class->setup_profile = up_device_supply_setup_profile;
 
 	g_type_class_add_private (klass, sizeof (UpDeviceSupplyPrivate));
 }
@@ -27,7 +27,9 @@
 
 #include "hidpp-device.h"
 
+#include "up-config.h"
 #include "up-device-unifying.h"
+#include "up-stats.h"
 #include "up-types.h"
 
 struct UpDeviceUnifyingPrivate
@@ -53,6 +55,8 @@ up_device_unifying_refresh (UpDevice *device)
 	UpDeviceUnifying *unifying = UP_DEVICE_UNIFYING (device);
 	UpDeviceUnifyingPrivate *priv = unifying->priv;
 	double lux;
+	gint64 start;
+	static UpStatsCounter *stats = NULL;
 
 	/* refresh the battery stats */
 	refresh_flags = HIDPP_REFRESH_FLAGS_BATTERY;
@@ -66,9 +70,13 @@ up_device_unifying_refresh (UpDevice *device)
 	if (hidpp_device_get_version (priv->hidpp_device) == 0)
 		refresh_flags |= HIDPP_REFRESH_FLAGS_VERSION;
 
+	if (stats == NULL)
+		stats = up_stats_get_counter ("hidpp", "refresh");
+	start = g_get_monotonic_time ();
 	ret = hidpp_device_refresh (priv->hidpp_device,
 				    refresh_flags,
 				    &error);
+	up_stats_counter_add (stats, start);
 	if (!ret) {
 		g_warning ("failed to coldplug unifying device: %s",
 			   error->message);
@@ -141,6 +149,7 @@ up_device_unifying_coldplug (UpDevice *device)
 {
 	const gchar *bus_address;
 	const gchar *device_file;
+	gchar *device_path;
 	const gchar *type;
 	const gchar *vendor;
 	gboolean ret = FALSE;
@@ -205,7 +214,8 @@ up_device_unifying_coldplug (UpDevice *device)
 				continue;
 
 			/* hidraw device which exposes hiddev interface is our receiver */
-			tmp = g_build_filename (g_udev_device_get_sysfs_path (parent),
+			tmp = g_build_filename (up_config_get_root (),
+						g_udev_device_get_sysfs_path (parent),
 					        "usbmisc", NULL);
 			dir = g_dir_open (tmp, 0, &error);
 			g_free(tmp);
@@ -247,8 +257,10 @@ up_device_unifying_coldplug (UpDevice *device)
 		goto out;
 	}
 	g_debug ("Using Unifying receiver hidraw device file: %s", device_file);
+	device_path = up_config_build_path (device_file);
 	hidpp_device_set_hidraw_device (unifying->priv->hidpp_device,
-					device_file);
+					device_path);
+	g_free (device_path);
 
 	/* give newly paired devices a chance to complete pairing */
 	g_usleep(30000);
@@ -42,10 +42,11 @@
 #include <errno.h>
 
 #include "sysfs-utils.h"
+#include "up-config.h"
 #include "up-types.h"
 #include "up-device-wup.h"
 
-#define UP_DEVICE_WUP_REFRESH_TIMEOUT			10 /* seconds */
+#define UP_DEVICE_WUP_LOG_INTERVAL			1 /* seconds */
 #define UP_DEVICE_WUP_RESPONSE_OFFSET_WATTS		0x0
 #define UP_DEVICE_WUP_RESPONSE_OFFSET_VOLTS		0x1
 #define UP_DEVICE_WUP_RESPONSE_OFFSET_AMPS		0x2
@@ -65,11 +66,15 @@
 
 /* commands can never be bigger then this */
 #define UP_DEVICE_WUP_COMMAND_LEN			256
+#define UP_DEVICE_WUP_BUFFER_LEN			(4 * UP_DEVICE_WUP_COMMAND_LEN)
+#define UP_DEVICE_WUP_MAX_TOKENS			32
 
 struct UpDeviceWupPrivate
 {
-	guint			 poll_timer_id;
+	guint			 watch_id;
 	int			 fd;
+	gchar			 buffer[UP_DEVICE_WUP_BUFFER_LEN];
+	gsize			 buffer_len;
 };
 
 G_DEFINE_TYPE (UpDeviceWup, up_device_wup, UP_TYPE_DEVICE)
@@ -77,21 +82,6 @@ G_DEFINE_TYPE (UpDeviceWup, up_device_wup, UP_TYPE_DEVICE)
 
 static gboolean		 up_device_wup_refresh	 	(UpDevice *device);
 
-/**
- * up_device_wup_poll_cb:
- **/
-static gboolean
-up_device_wup_poll_cb (UpDeviceWup *wup)
-{
-	UpDevice *device = UP_DEVICE (wup);
-
-	g_debug ("Polling: %s", up_device_get_object_path (device));
-	up_device_wup_refresh (device);
-
-	/* always continue polling */
-	return TRUE;
-}
-
 /**
  * up_device_wup_set_speed:
  **/
@@ -145,103 +135,60 @@ up_device_wup_write_command (UpDeviceWup *wup, const gchar *data)
 	return ret;
 }
 
-/**
- * up_device_wup_read_command:
- *
- * Return value: Some data to parse
- **/
-static gchar *
-up_device_wup_read_command (UpDeviceWup *wup)
-{
-	int retval;
-	gchar buffer[UP_DEVICE_WUP_COMMAND_LEN];
-	retval = read (wup->priv->fd, &buffer, UP_DEVICE_WUP_COMMAND_LEN);
-	if (retval < 0) {
-		g_debug ("failed to read from fd: %s", strerror (errno));
-		return NULL;
-	}
-	return g_strdup (buffer);
-}
-
 /**
  * up_device_wup_parse_command:
  *
- * Return value: Som data to parse
+ * packet: a single packet without the terminating ';', e.g. "#d,-,18,..."
+ *
+ * The packet is split in place.
+ *
+ * Return value: %TRUE if the packet was a sample
  **/
 static gboolean
-up_device_wup_parse_command (UpDeviceWup *wup, const gchar *data)
+up_device_wup_parse_command (UpDeviceWup *wup, gchar *packet)
 {
-	gboolean ret = FALSE;
 	gchar command;
 	gchar subcommand;
-	gchar **tokens = NULL;
-	gchar *packet = NULL;
-	guint i;
+	gchar *tokens[UP_DEVICE_WUP_MAX_TOKENS];
+	gchar *p;
+	gchar *end = NULL;
 	guint size;
 	guint length;
-	guint number_tokens;
+	guint number_tokens = 0;
 	UpDevice *device = UP_DEVICE (wup);
 	const guint offset = 3;
 
-	/* invalid */
-	if (data == NULL)
-		goto out;
-
-	/* Try to find a valid packet in the data stream
-	 * Data may be sdfsd#P,-,0;sdfs and we only want this bit:
-	 *                  \-----/
-	 * so try to find the start and the end */
-
-	/* ensure we have a long enough response */
-	length = strlen (data);
-	if (length < 3) {
-		g_debug ("not enough data '%s'", data);
-		goto out;
-	}
-
-	/* strip to the first '#' char */
-	for (i=0; i<length-1; i++)
-		if (data[i] == '#')
-			packet = g_strdup (data+i);
-
-	/* does packet exist? */
-	if (packet == NULL) {
-		g_debug ("no start char in %s", data);
-		goto out;
+	/* make it printable */
+	for (p = packet; *p != '\0'; p++) {
+		if (*p < 0x20 || *p > 0x7e)
+			*p = '?';
 	}
 
-	/* replace the first ';' char with a NULL if it exists */
-	length = strlen (packet);
-	for (i=0; i<length; i++) {
-		if (packet[i] < 0x20 || packet[i] > 0x7e)
-			packet[i] = '?';
-		if (packet[i] == ';') {
-			packet[i] = '\0';
+	/* split into tokens, removing leading or trailing whitespace */
+	for (p = packet; number_tokens < UP_DEVICE_WUP_MAX_TOKENS; p = end + 1) {
+		end = strchr (p, ',');
+		if (end != NULL)
+			*end = '\0';
+		tokens[number_tokens++] = g_strstrip (p);
+		if (end == NULL)
 			break;
-		}
+	}
+	if (end != NULL) {
+		g_debug ("too many tokens in '%s'", packet);
+		return FALSE;
 	}
 
-	/* check we have enough data inthe packet */
-	tokens = g_strsplit (packet, ",", -1);
-	number_tokens = g_strv_length (tokens);
+	/* check we have enough data in the packet */
 	if (number_tokens < 3) {
 		g_debug ("not enough tokens '%s'", packet);
-		goto out;
+		return FALSE;
 	}
 
-	/* remove leading or trailing whitespace in tokens */
-	for (i=0; i<number_tokens; i++)
-		g_strstrip (tokens[i]);
-
 	/* check the first token */
 	length = strlen (tokens[0]);
-	if (length != 2) {
-		g_debug ("expected command '#?' but got '%s'", tokens[0]);
-		goto out;
-	}
-	if (tokens[0][0] != '#') {
+	if (length != 2 || tokens[0][0] != '#') {
 		g_debug ("expected command '#?' but got '%s'", tokens[0]);
-		goto out;
+		return FALSE;
 	}
 	command = tokens[0][1];
 
@@ -249,7 +196,7 @@ up_device_wup_parse_command (UpDeviceWup *wup, const gchar *data)
 	length = strlen (tokens[1]);
 	if (length != 1) {
 		g_debug ("expected command '?' but got '%s'", tokens[1]);
-		goto out;
+		return FALSE;
 	}
 	subcommand = tokens[1][0]; /* expect to be '-' */
 
@@ -257,31 +204,123 @@ up_device_wup_parse_command (UpDeviceWup *wup, const gchar *data)
 	length = strlen (tokens[2]);
 	if (length == 0) {
 		g_debug ("length value not present");
-		goto out;
+		return FALSE;
 	}
 
 	/* check the length matches what data we've got*/
 	size = atoi (tokens[2]);
 	if (size != number_tokens - offset) {
 		g_debug ("size expected to be '%i' but got '%i'", number_tokens - offset, size);
-		goto out;
+		return FALSE;
 	}
 
 	/* update the command fields */
-	if (command == 'd' && subcommand == '-' && number_tokens - offset == 18) {
-		g_object_set (device,
-			      "energy-rate", strtod (tokens[offset+UP_DEVICE_WUP_RESPONSE_OFFSET_WATTS], NULL) / 10.0f,
-			      "voltage", strtod (tokens[offset+UP_DEVICE_WUP_RESPONSE_OFFSET_VOLTS], NULL) / 10.0f,
-			      NULL);
-		ret = TRUE;
-	} else {
+	if (command != 'd' || subcommand != '-' || number_tokens - offset != 18) {
 		g_debug ("ignoring command '%c'", command);
+		return FALSE;
 	}
 
-out:
-	g_free (packet);
-	g_strfreev (tokens);
-	return ret;
+	/* one transaction per sample, so each one reaches the history */
+	up_device_freeze (device);
+	g_object_set (device,
+		      "energy-rate", g_ascii_strtod (tokens[offset+UP_DEVICE_WUP_RESPONSE_OFFSET_WATTS], NULL) / 10.0f,
+		      "voltage", g_ascii_strtod (tokens[offset+UP_DEVICE_WUP_RESPONSE_OFFSET_VOLTS], NULL) / 10.0f,
+		      "update-time", (guint64) g_get_real_time () / G_USEC_PER_SEC,
+		      NULL);
+	up_device_thaw (device);
+	return TRUE;
+}
+
+/**
+ * up_device_wup_parse_buffer:
+ *
+ * Parses every complete packet in the buffer, and keeps any partial
+ * packet for the next read. Data may be sdfsd#P,-,0;sdfs and we only want
+ * this bit:
+ *              \-----/
+ *
+ * Return value: the number of samples
+ **/
+static guint
+up_device_wup_parse_buffer (UpDeviceWup *wup)
+{
+	UpDeviceWupPrivate *priv = wup->priv;
+	gchar *start;
+	gchar *end;
+	gchar *buffer_end = priv->buffer + priv->buffer_len;
+	guint samples = 0;
+
+	start = priv->buffer;
+	while (start < buffer_end) {
+		start = memchr (start, '#', buffer_end - start);
+		if (start == NULL) {
+			start = buffer_end;
+			break;
+		}
+		end = memchr (start, ';', buffer_end - start);
+		if (end == NULL)
+			break;
+		*end = '\0';
+		if (up_device_wup_parse_command (wup, start))
+			samples++;
+		start = end + 1;
+	}
+
+	/* keep the partial packet */
+	priv->buffer_len = buffer_end - start;
+	memmove (priv->buffer, start, priv->buffer_len);
+
+	/* no terminator in a full buffer, so this is garbage */
+	if (priv->buffer_len == sizeof (priv->buffer)) {
+		g_debug ("no packet end in %" G_GSIZE_FORMAT " bytes, dropping", priv->buffer_len);
+		priv->buffer_len = 0;
+	}
+	return samples;
+}
+
+/**
+ * up_device_wup_read:
+ *
+ * Reads everything that is waiting without blocking.
+ *
+ * Return value: %FALSE if the device has gone away
+ **/
+static gboolean
+up_device_wup_read (UpDeviceWup *wup)
+{
+	UpDeviceWupPrivate *priv = wup->priv;
+	gssize len;
+
+	while (TRUE) {
+		len = read (priv->fd, priv->buffer + priv->buffer_len,
+			    sizeof (priv->buffer) - priv->buffer_len);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return TRUE;
+			g_debug ("failed to read from fd: %s", strerror (errno));
+			return FALSE;
+		}
+		if (len == 0)
+			return FALSE;
+		priv->buffer_len += len;
+		up_device_wup_parse_buffer (wup);
+	}
+}
+
+/**
+ * up_device_wup_io_cb:
+ **/
+static gboolean
+up_device_wup_io_cb (GIOChannel *channel, GIOCondition condition, UpDeviceWup *wup)
+{
+	if ((condition & G_IO_IN) && up_device_wup_read (wup))
+		return TRUE;
+
+	g_debug ("lost connection to %s", up_device_get_object_path (UP_DEVICE (wup)));
+	wup->priv->watch_id = 0;
+	return FALSE;
 }
 
 /**
@@ -296,9 +335,11 @@ up_device_wup_coldplug (UpDevice *device)
 	GUdevDevice *native;
 	gboolean ret = FALSE;
 	const gchar *device_file;
+	gchar *device_path;
 	const gchar *type;
 	const gchar *native_path;
 	gchar *data;
+	GIOChannel *channel;
 	const gchar *vendor;
 	const gchar *product;
 
@@ -316,7 +357,9 @@ up_device_wup_coldplug (UpDevice *device)
 	}
 
 	/* connect to the device */
-	wup->priv->fd = open (device_file, O_RDWR | O_NONBLOCK);
+	device_path = up_config_build_path (device_file);
+	wup->priv->fd = open (device_path, O_RDWR | O_NONBLOCK);
+	g_free (device_path);
 	if (wup->priv->fd < 0) {
 		g_debug ("cannot open device file %s", device_file);
 		goto out;
@@ -335,20 +378,19 @@ up_device_wup_coldplug (UpDevice *device)
 	if (!ret)
 		g_debug ("failed to clear, nonfatal");
 
-	/* setup logging interval */
-	data = g_strdup_printf ("#L,W,3,E,1,%i;", UP_DEVICE_WUP_REFRESH_TIMEOUT);
+	/* log externally, so the meter sends a sample every interval */
+	data = g_strdup_printf ("#L,W,3,E,1,%i;", UP_DEVICE_WUP_LOG_INTERVAL);
 	ret = up_device_wup_write_command (wup, data);
 	if (!ret)
 		g_debug ("failed to setup logging interval, nonfatal");
 	g_free (data);
 
-	/* dummy read */
-	data = up_device_wup_read_command (wup);
-	g_debug ("data after clear %s", data);
-
-	/* shouldn't do anything */
-	up_device_wup_parse_command (wup, data);
-	g_free (data);
+	/* read the samples as they arrive */
+	channel = g_io_channel_unix_new (wup->priv->fd);
+	wup->priv->watch_id = g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+					      (GIOFunc) up_device_wup_io_cb, wup);
+	g_source_set_name_by_id (wup->priv->watch_id, "[upower] up_device_wup_io_cb (linux)");
+	g_io_channel_unref (channel);
 
 	/* prefer UPOWER names */
 	vendor = g_udev_device_get_property (native, "UPOWER_VENDOR");
@@ -382,34 +424,21 @@ out:
 /**
  * up_device_wup_refresh:
  *
+ * The samples are read as they arrive, so this only picks up anything
+ * that is waiting.
+ *
  * Return %TRUE on success, %FALSE if we failed to refresh or no data
  **/
 static gboolean
 up_device_wup_refresh (UpDevice *device)
 {
-	gboolean ret = FALSE;
-	gchar *data = NULL;
 	UpDeviceWup *wup = UP_DEVICE_WUP (device);
 
-	/* get data */
-	data = up_device_wup_read_command (wup);
-	if (data == NULL) {
+	if (wup->priv->fd < 0)
+		return FALSE;
+	if (!up_device_wup_read (wup))
 		g_debug ("no data");
-		goto out;
-	}
-
-	/* parse */
-	ret = up_device_wup_parse_command (wup, data);
-	if (!ret) {
-		g_debug ("failed to parse %s", data);
-		goto out;
-	}
 
-	/* reset time */
-	g_object_set (device, "update-time", (guint64) g_get_real_time () / G_USEC_PER_SEC, NULL);
-
-out:
-	g_free (data);
 	/* FIXME: always true? */
 	return TRUE;
 }
@@ -422,9 +451,6 @@ up_device_wup_init (UpDeviceWup *wup)
 {
 	wup->priv = UP_DEVICE_WUP_GET_PRIVATE (wup);
 	wup->priv->fd = -1;
-	wup->priv->poll_timer_id = g_timeout_add_seconds (UP_DEVICE_WUP_REFRESH_TIMEOUT,
-							  (GSourceFunc) up_device_wup_poll_cb, wup);
-	g_source_set_name_by_id (wup->priv->poll_timer_id, "[upower] up_device_wup_poll_cb (linux)");
 }
 
 /**
@@ -441,10 +467,10 @@ up_device_wup_finalize (GObject *object)
 	wup = UP_DEVICE_WUP (object);
 	g_return_if_fail (wup->priv != NULL);
 
+	if (wup->priv->watch_id > 0)
+		g_source_remove (wup->priv->watch_id);
 	if (wup->priv->fd > 0)
 		close (wup->priv->fd);
-	if (wup->priv->poll_timer_id > 0)
-		g_source_remove (wup->priv->poll_timer_id);
 
 	G_OBJECT_CLASS (up_device_wup_parent_class)->finalize (object);
 }
@@ -40,6 +40,7 @@
 #include <gudev/gudev.h>
 
 #include "sysfs-utils.h"
+#include "up-config.h"
 #include "up-types.h"
 #include "up-daemon.h"
 #include "up-input.h"
@@ -167,6 +168,7 @@ up_input_coldplug (UpInput *input, UpDaemon *daemon, GUdevDevice *d)
 	gchar *contents = NULL;
 	const gchar *native_path;
 	const gchar *device_file;
+	gchar *device_path;
 	GError *error = NULL;
 	glong bitmask[NBITS(SW_MAX)];
 	gint num_bits;
@@ -176,11 +178,11 @@ up_input_coldplug (UpInput *input, UpDaemon *daemon, GUdevDevice *d)
 	native_path = g_udev_device_get_sysfs_path (d);
 
 	/* is a switch */
-	path = g_build_filename (native_path, "../capabilities/sw", NULL);
+	path = g_build_filename (up_config_get_root (), native_path, "../capabilities/sw", NULL);
 	if (!g_file_test (path, G_FILE_TEST_EXISTS)) {
 		g_debug ("not a switch [%s]", path);
 		g_free (path);
-		path = g_build_filename (native_path, "capabilities/sw", NULL);
+		path = g_build_filename (up_config_get_root (), native_path, "capabilities/sw", NULL);
 		if (!g_file_test (path, G_FILE_TEST_EXISTS)) {
 			g_debug ("not a switch [%s]", path);
 			goto out;
@@ -219,7 +221,9 @@ up_input_coldplug (UpInput *input, UpDaemon *daemon, GUdevDevice *d)
 	}
 
 	/* open device file */
-	input->priv->eventfp = open (device_file, O_RDONLY | O_NONBLOCK);
+	device_path = up_config_build_path (device_file);
+	input->priv->eventfp = open (device_path, O_RDONLY | O_NONBLOCK);
+	g_free (device_path);
 	if (input->priv->eventfp <= 0) {
 		g_warning ("cannot open '%s': %s", device_file, strerror (errno));
 		ret = FALSE;
@@ -0,0 +1,606 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Microbenchmarks for the hot paths of the daemon. Each benchmark prints
+ * one tab separated line:
+ *
+ *   name  size  iterations  ns/op  allocs/op  peak RSS in kB
+ *
+ * where allocs/op counts malloc, calloc and realloc calls (-1 when they
+ * can't be counted) and the peak RSS is that of the whole run so far.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <glib-object.h>
+#include <glib/gstdio.h>
+#include <up-history-item.h>
+
+#include "up-config.h"
+#include "up-daemon.h"
+#include "up-device.h"
+#include "up-device-list.h"
+#include "up-history.h"
+#include "up-wakeups.h"
+#ifdef UP_BENCH_SYSFS
+#include "linux/sysfs-utils.h"
+#endif
+
+#define UP_BENCH_SAMPLES		1000000
+#define UP_BENCH_RESOLUTION		1000
+#define UP_BENCH_MIN_ITERATIONS		3
+#define UP_BENCH_MAX_ITERATIONS		1000000
+#define UP_BENCH_MIN_TIME		250000000 /* ns */
+#define UP_BENCH_CPUS			8
+
+typedef struct UpBench UpBench;
+typedef void (*UpBenchFunc) (UpBench *bench);
+
+struct UpBench {
+	gchar			*dir;
+	guint			 size;
+	guint			 resolution;
+	UpHistoryReducer	 reducer;
+	UpHistorySample		*samples;
+	UpHistorySample		*out;
+	UpHistory		*history;
+	UpDaemon		*daemon;
+	UpWakeups		*wakeups;
+	GPtrArray		*array;
+};
+
+#ifdef __GLIBC__
+/*
+ * GLib allocates with the system malloc, so wrapping the glibc entry
+ * points sees everything g_new() and friends do.
+ */
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static gint up_bench_allocs = 0;
+
+void *
+malloc (size_t size)
+{
+	g_atomic_int_inc (&up_bench_allocs);
+	return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+	g_atomic_int_inc (&up_bench_allocs);
+	return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+	g_atomic_int_inc (&up_bench_allocs);
+	return __libc_realloc (ptr, size);
+}
+
+#define up_bench_get_allocs()	((guint) g_atomic_int_get (&up_bench_allocs))
+#else
+#define up_bench_get_allocs()	0
+#endif
+
+/**
+ * up_bench_get_time:
+ *
+ * Return value: a monotonic time in nanoseconds
+ **/
+static gint64
+up_bench_get_time (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * up_bench_run:
+ * @finish: (allow-none): called after each operation, and not timed
+ *
+ * Runs @func until it has taken long enough to be measured.
+ **/
+static void
+up_bench_run (UpBench *bench, const gchar *name, UpBenchFunc func, UpBenchFunc finish)
+{
+	struct rusage usage;
+	gint64 elapsed = 0;
+	gint64 start;
+	guint64 allocs = 0;
+	guint allocs_start;
+	guint n;
+
+	for (n = 0; n < UP_BENCH_MAX_ITERATIONS; n++) {
+		if (n >= UP_BENCH_MIN_ITERATIONS && elapsed >= UP_BENCH_MIN_TIME)
+			break;
+		allocs_start = up_bench_get_allocs ();
+		start = up_bench_get_time ();
+		func (bench);
+		elapsed += up_bench_get_time () - start;
+		allocs += up_bench_get_allocs () - allocs_start;
+		if (finish != NULL)
+			finish (bench);
+	}
+
+	getrusage (RUSAGE_SELF, &usage);
+	g_print ("%s\t%u\t%u\t%.1f\t%.1f\t%li\n",
+		 name, bench->size, n,
+		 (gdouble) elapsed / n,
+#ifdef __GLIBC__
+		 (gdouble) allocs / n,
+#else
+		 -1.0f,
+#endif
+		 (glong) usage.ru_maxrss);
+}
+
+/**
+ * up_bench_make_samples:
+ *
+ * A slow discharge curve with some noise and the odd rate spike.
+ **/
+static UpHistorySample *
+up_bench_make_samples (guint n)
+{
+	UpHistorySample *samples;
+	GRand *rand;
+	guint i;
+
+	rand = g_rand_new_with_seed (0);
+	samples = g_new (UpHistorySample, n);
+	for (i = 0; i < n; i++) {
+		samples[i].time = 1000000000 + i * 2;
+		samples[i].state = UP_DEVICE_STATE_DISCHARGING;
+		samples[i].value = 10.0f + 2.0f * sin (i / 5000.0f) + g_rand_double (rand);
+		if (g_rand_int_range (rand, 0, 10000) == 0)
+			samples[i].value += 40.0f;
+	}
+	g_rand_free (rand);
+	return samples;
+}
+
+/**
+ * up_bench_reduce_cb:
+ **/
+static void
+up_bench_reduce_cb (UpBench *bench)
+{
+	up_history_reduce (bench->samples, bench->size, bench->reducer,
+			   bench->out, UP_BENCH_RESOLUTION);
+}
+
+/**
+ * up_bench_write_history:
+ *
+ * Writes @n charge and rate entries spread over the last six days, going
+ * down and up one percent at a time so every profile bin is filled.
+ **/
+static void
+up_bench_write_history (const gchar *dir, const gchar *id, guint n)
+{
+	const gchar *types[] = { "charge", "rate" };
+	UpDeviceState state;
+	GString *string;
+	gchar *basename;
+	gchar *filename;
+	guint64 now;
+	guint64 span;
+	guint step;
+	guint i, j;
+
+	now = g_get_real_time () / G_USEC_PER_SEC;
+	span = 6 * 24 * 60 * 60;
+	for (j = 0; j < G_N_ELEMENTS (types); j++) {
+		string = g_string_new ("");
+		for (i = 0; i < n; i++) {
+			step = i % 200;
+			state = step < 100 ? UP_DEVICE_STATE_DISCHARGING : UP_DEVICE_STATE_CHARGING;
+			g_string_append_printf (string, "%" G_GUINT64_FORMAT "\t%.3f\t%s\n",
+						now - span + span * i / n,
+						j == 0 ? (gdouble) (step < 100 ? 100 - step : step - 100) : 10.0f,
+						up_device_state_to_string (state));
+		}
+		basename = g_strdup_printf ("history-%s-%s.dat", types[j], id);
+		filename = g_build_filename (dir, basename, NULL);
+		if (!g_file_set_contents (filename, string->str, -1, NULL))
+			g_error ("failed to write %s", filename);
+		g_free (filename);
+		g_free (basename);
+		g_string_free (string, TRUE);
+	}
+}
+
+/**
+ * up_bench_history_load_cb:
+ **/
+static void
+up_bench_history_load_cb (UpBench *bench)
+{
+	gchar *id;
+
+	id = g_strdup_printf ("bench-%u", bench->size);
+	bench->history = up_history_new ();
+	up_history_set_directory (bench->history, bench->dir);
+	up_history_set_id (bench->history, id);
+	g_free (id);
+}
+
+/**
+ * up_bench_history_unload_cb:
+ *
+ * This also saves the data, which is why it isn't timed.
+ **/
+static void
+up_bench_history_unload_cb (UpBench *bench)
+{
+	g_object_unref (bench->history);
+	bench->history = NULL;
+}
+
+/**
+ * up_bench_history_save_cb:
+ **/
+static void
+up_bench_history_save_cb (UpBench *bench)
+{
+	up_history_save_data (bench->history);
+}
+
+/**
+ * up_bench_history_get_data_cb:
+ **/
+static void
+up_bench_history_get_data_cb (UpBench *bench)
+{
+	GPtrArray *array;
+
+	array = up_history_get_data (bench->history, UP_HISTORY_TYPE_CHARGE, 0, bench->resolution);
+	g_ptr_array_unref (array);
+}
+
+/**
+ * up_bench_history_get_profile_data_cb:
+ **/
+static void
+up_bench_history_get_profile_data_cb (UpBench *bench)
+{
+	GPtrArray *array;
+
+	array = up_history_get_profile_data (bench->history, FALSE);
+	g_ptr_array_unref (array);
+}
+
+/**
+ * up_bench_history_to_variant_cb:
+ *
+ * The GetHistory reply for what is in bench->array.
+ **/
+static void
+up_bench_history_to_variant_cb (UpBench *bench)
+{
+	GVariant *variant;
+
+	variant = g_variant_ref_sink (up_device_history_items_to_variant (bench->array));
+	g_variant_unref (variant);
+}
+
+/**
+ * up_bench_history:
+ **/
+static void
+up_bench_history (UpBench *bench, guint n)
+{
+	const guint resolutions[] = { 100, 1000, 10000 };
+	gchar *name;
+	guint i;
+
+	bench->size = n;
+	name = g_strdup_printf ("bench-%u", n);
+	up_bench_write_history (bench->dir, name, n);
+	g_free (name);
+
+	up_bench_run (bench, "history-load", up_bench_history_load_cb, up_bench_history_unload_cb);
+
+	up_bench_history_load_cb (bench);
+	up_bench_run (bench, "history-save", up_bench_history_save_cb, NULL);
+	for (i = 0; i < G_N_ELEMENTS (resolutions); i++) {
+		bench->resolution = resolutions[i];
+		name = g_strdup_printf ("history-get-data-%u", resolutions[i]);
+		up_bench_run (bench, name, up_bench_history_get_data_cb, NULL);
+		g_free (name);
+	}
+	up_bench_run (bench, "history-get-profile-data", up_bench_history_get_profile_data_cb, NULL);
+
+	/* GetHistory with everything, which is the worst case */
+	bench->array = up_history_get_data (bench->history, UP_HISTORY_TYPE_CHARGE, 0, n + 1);
+	up_bench_run (bench, "get-history-variant", up_bench_history_to_variant_cb, NULL);
+	g_ptr_array_unref (bench->array);
+	bench->array = NULL;
+
+	up_bench_history_unload_cb (bench);
+}
+
+/**
+ * up_bench_display_battery_cb:
+ **/
+static void
+up_bench_display_battery_cb (UpBench *bench)
+{
+	up_daemon_update_display_battery (bench->daemon);
+}
+
+/**
+ * up_bench_display_battery:
+ *
+ * Nothing changes between calls, so this is the cost of adding up the
+ * batteries, not of updating the display device.
+ **/
+static void
+up_bench_display_battery (UpBench *bench, guint n)
+{
+	UpDeviceList *list;
+	GObject *native;
+	UpDevice *device;
+	guint i;
+
+	bench->size = n;
+	bench->daemon = up_daemon_new ();
+	list = up_daemon_get_device_list (bench->daemon);
+	native = g_object_new (G_TYPE_OBJECT, NULL);
+	for (i = 0; i < n; i++) {
+		device = up_device_new ();
+		g_object_set (device,
+			      "type", UP_DEVICE_KIND_BATTERY,
+			      "power-supply", TRUE,
+			      "is-present", TRUE,
+			      "state", UP_DEVICE_STATE_DISCHARGING,
+			      "energy", 40.0f + i,
+			      "energy-full", 60.0f,
+			      "energy-rate", 10.0f,
+			      "percentage", 100.0f * (40.0f + i) / 60.0f,
+			      "time-to-empty", (gint64) (3600 * (40 + i) / 10),
+			      NULL);
+		up_device_list_insert (list, native, G_OBJECT (device));
+		g_object_unref (device);
+	}
+	g_object_unref (native);
+	g_object_unref (list);
+
+	up_bench_run (bench, "update-display-battery", up_bench_display_battery_cb, NULL);
+
+	g_object_unref (bench->daemon);
+	bench->daemon = NULL;
+}
+
+/**
+ * up_bench_write_file:
+ *
+ * Writes @contents to @path below the root, making the directories.
+ **/
+static void
+up_bench_write_file (const gchar *path, const gchar *contents)
+{
+	gchar *dirname;
+	gchar *filename;
+
+	filename = up_config_build_path (path);
+	dirname = g_path_get_dirname (filename);
+	g_mkdir_with_parents (dirname, 0755);
+	if (!g_file_set_contents (filename, contents, -1, NULL))
+		g_error ("failed to write %s", filename);
+	g_free (dirname);
+	g_free (filename);
+}
+
+/**
+ * up_bench_remove_file:
+ **/
+static void
+up_bench_remove_file (const gchar *path)
+{
+	gchar *filename;
+
+	filename = up_config_build_path (path);
+	g_unlink (filename);
+	g_free (filename);
+}
+
+#ifdef UP_BENCH_SYSFS
+/**
+ * up_bench_sysfs_get_double_cb:
+ **/
+static void
+up_bench_sysfs_get_double_cb (UpBench *bench)
+{
+	sysfs_get_double ("/sys/class/power_supply/BAT0", "energy_now");
+}
+
+/**
+ * up_bench_sysfs_get_string_cb:
+ **/
+static void
+up_bench_sysfs_get_string_cb (UpBench *bench)
+{
+	g_free (sysfs_get_string ("/sys/class/power_supply/BAT0", "status"));
+}
+
+/**
+ * up_bench_sysfs:
+ **/
+static void
+up_bench_sysfs (UpBench *bench)
+{
+	bench->size = 1;
+	up_bench_write_file ("/sys/class/power_supply/BAT0/energy_now", "48000000\n");
+	up_bench_write_file ("/sys/class/power_supply/BAT0/status", "Discharging\n");
+	up_bench_run (bench, "sysfs-get-double", up_bench_sysfs_get_double_cb, NULL);
+	up_bench_run (bench, "sysfs-get-string", up_bench_sysfs_get_string_cb, NULL);
+	up_bench_remove_file ("/sys/class/power_supply/BAT0/energy_now");
+	up_bench_remove_file ("/sys/class/power_supply/BAT0/status");
+}
+#endif
+
+/**
+ * up_bench_interrupts_cb:
+ **/
+static void
+up_bench_interrupts_cb (UpBench *bench)
+{
+	up_wakeups_poll_kernel (bench->wakeups);
+}
+
+/**
+ * up_bench_interrupts:
+ *
+ * Parses a /proc/interrupts with @n device interrupts on eight processors,
+ * and the usual architecture specific ones.
+ **/
+static void
+up_bench_interrupts (UpBench *bench, guint n)
+{
+	const gchar *special[] = { "NMI", "LOC", "RES", "CAL", "TLB" };
+	GString *string;
+	guint i, j;
+
+	string = g_string_new ("    ");
+	for (j = 0; j < UP_BENCH_CPUS; j++)
+		g_string_append_printf (string, "       CPU%u", j);
+	g_string_append (string, "\n");
+	for (i = 0; i < n; i++) {
+		g_string_append_printf (string, "%4u:", i);
+		for (j = 0; j < UP_BENCH_CPUS; j++)
+			g_string_append_printf (string, " %10u", (i + 1) * (j + 1) * 1000);
+		g_string_append_printf (string, "  IR-PCI-MSI %u-edge      device%u\n", i, i);
+	}
+	for (i = 0; i < G_N_ELEMENTS (special); i++) {
+		g_string_append_printf (string, "%4s:", special[i]);
+		for (j = 0; j < UP_BENCH_CPUS; j++)
+			g_string_append_printf (string, " %10u", (i + 1) * 100000);
+		g_string_append_printf (string, "   %s interrupts\n", special[i]);
+	}
+	up_bench_write_file ("/proc/interrupts", string->str);
+	g_string_free (string, TRUE);
+
+	bench->size = n;
+	bench->wakeups = up_wakeups_new ();
+	up_bench_run (bench, "parse-interrupts", up_bench_interrupts_cb, NULL);
+	g_object_unref (bench->wakeups);
+	bench->wakeups = NULL;
+	up_bench_remove_file ("/proc/interrupts");
+}
+
+/**
+ * up_bench_remove_dir:
+ **/
+static void
+up_bench_remove_dir (const gchar *path)
+{
+	const gchar *name;
+	gchar *filename;
+	GDir *dir;
+
+	dir = g_dir_open (path, 0, NULL);
+	if (dir == NULL)
+		return;
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		filename = g_build_filename (path, name, NULL);
+		if (g_file_test (filename, G_FILE_TEST_IS_DIR))
+			up_bench_remove_dir (filename);
+		else
+			g_unlink (filename);
+		g_free (filename);
+	}
+	g_dir_close (dir);
+	g_rmdir (path);
+}
+
+int
+main (int argc, char **argv)
+{
+	const guint history_sizes[] = { 1000, 10000, 100000 };
+	const guint battery_counts[] = { 1, 2, 8, 64 };
+	const guint irq_counts[] = { 32, 256 };
+	const struct {
+		const gchar		*name;
+		UpHistoryReducer	 reducer;
+	} reducers[] = {
+		{ "reduce-avg", UP_HISTORY_REDUCER_AVERAGE },
+		{ "reduce-min", UP_HISTORY_REDUCER_MIN },
+		{ "reduce-max", UP_HISTORY_REDUCER_MAX },
+		{ "reduce-last", UP_HISTORY_REDUCER_LAST },
+		{ "reduce-lttb", UP_HISTORY_REDUCER_LTTB },
+	};
+	UpBench bench;
+	guint n = UP_BENCH_SAMPLES;
+	guint i;
+
+#if !defined(GLIB_VERSION_2_36)
+	g_type_init ();
+#endif
+
+	if (argc > 1)
+		n = atoi (argv[1]);
+
+	/* everything the daemon reads from /sys and /proc comes from here */
+	memset (&bench, 0, sizeof (bench));
+	bench.dir = g_build_filename (g_get_tmp_dir (), "upower-bench.XXXXXX", NULL);
+	if (g_mkdtemp (bench.dir) == NULL)
+		g_error ("Cannot create temporary directory: %s", g_strerror (errno));
+	g_setenv ("UPOWER_ROOT_DIR", bench.dir, TRUE);
+
+	g_print ("# name\tsize\titerations\tns/op\tallocs/op\tpeak_rss_kb\n");
+
+	/* the reducers, on a flat array */
+	bench.size = n;
+	bench.samples = up_bench_make_samples (n);
+	bench.out = g_new (UpHistorySample, UP_BENCH_RESOLUTION);
+	for (i = 0; i < G_N_ELEMENTS (reducers); i++) {
+		bench.reducer = reducers[i].reducer;
+		up_bench_run (&bench, reducers[i].name, up_bench_reduce_cb, NULL);
+	}
+	g_free (bench.out);
+	g_free (bench.samples);
+
+	for (i = 0; i < G_N_ELEMENTS (history_sizes); i++)
+		up_bench_history (&bench, history_sizes[i]);
+	for (i = 0; i < G_N_ELEMENTS (battery_counts); i++)
+		up_bench_display_battery (&bench, battery_counts[i]);
+#ifdef UP_BENCH_SYSFS
+	up_bench_sysfs (&bench);
+#endif
+	for (i = 0; i < G_N_ELEMENTS (irq_counts); i++)
+		up_bench_interrupts (&bench, irq_counts[i]);
+
+	up_bench_remove_dir (bench.dir);
+	g_free (bench.dir);
+	return 0;
+}
@@ -137,6 +137,40 @@ up_config_finalize (GObject *object)
 	G_OBJECT_CLASS (up_config_parent_class)->finalize (object);
 }
 
+/**
+ * up_config_get_root:
+ *
+ * Gets the directory that /sys, /proc and /dev are looked up in, as set
+ * with the UPOWER_ROOT_DIR environment variable. This is only useful for
+ * testing and benchmarking against a fake tree.
+ *
+ * Return value: the directory, or "" for the real root
+ **/
+const gchar *
+up_config_get_root (void)
+{
+	static const gchar *root = NULL;
+	const gchar *tmp;
+
+	if (g_once_init_enter (&root)) {
+		tmp = g_getenv ("UPOWER_ROOT_DIR");
+		g_once_init_leave (&root, g_strdup (tmp != NULL ? tmp : ""));
+	}
+	return root;
+}
+
+/**
+ * up_config_build_path:
+ * @path: an absolute path, e.g. "/sys/class/leds"
+ *
+ * Return value: @path below the root from up_config_get_root()
+ **/
+gchar *
+up_config_build_path (const gchar *path)
+{
+	return g_strconcat (up_config_get_root (), path, NULL);
+}
+
 /**
  * up_config_new:
  **/
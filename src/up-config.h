@@ -54,6 +54,8 @@ guint		 up_config_get_uint		(UpConfig	*config,
 						 const gchar	*key);
 gchar		*up_config_get_string           (UpConfig	*config,
 						 const gchar	*key);
+const gchar	*up_config_get_root		(void);
+gchar		*up_config_build_path		(const gchar	*path);
 
 G_END_DECLS
 
@@ -36,17 +36,25 @@
 #include "up-device.h"
 #include "up-backend.h"
 #include "up-daemon.h"
+#include "up-probes.h"
+#include "up-stats.h"
 
 struct UpDaemonPrivate
 {
 	UpConfig		*config;
 	UpBackend		*backend;
 	UpDeviceList		*power_devices;
+	GDBusObjectManagerServer *object_manager;
 	guint			 action_timeout_id;
 	guint			 refresh_event_id;
 	GHashTable		*poll_timeouts;
 	gboolean                 poll_paused;
 	GHashTable		*idle_signals;
+	gboolean		 refreshing_batteries;
+
+	/* Line power state, updated when an AC adapter changes */
+	gboolean		 has_ac;
+	gboolean		 on_ac;
 
 	/* Properties */
 	UpDeviceLevel		 warning_level;
@@ -64,6 +72,7 @@ struct UpDaemonPrivate
 
 	/* WarningLevel configuration */
 	gboolean		 use_percentage_for_policy;
+	gboolean		 predict_time;
 	guint			 low_percentage;
 	guint			 critical_percentage;
 	guint			 action_percentage;
@@ -76,6 +85,7 @@ static void	up_daemon_finalize		(GObject	*object);
 static gboolean	up_daemon_get_on_battery_local	(UpDaemon	*daemon);
 static gboolean	up_daemon_get_warning_level_local(UpDaemon	*daemon);
 static gboolean	up_daemon_get_on_ac_local 	(UpDaemon	*daemon);
+static void	up_daemon_update_warning_level	(UpDaemon	*daemon);
 
 G_DEFINE_TYPE (UpDaemon, up_daemon, UP_TYPE_EXPORTED_DAEMON_SKELETON)
 
@@ -92,24 +102,27 @@ G_DEFINE_TYPE (UpDaemon, up_daemon, UP_TYPE_EXPORTED_DAEMON_SKELETON)
 static gboolean
 up_daemon_get_on_battery_local (UpDaemon *daemon)
 {
-	guint i;
+	guint i, j;
 	gboolean ret;
 	gboolean result = FALSE;
 	gboolean on_battery;
 	UpDevice *device;
 	GPtrArray *array;
-
-	/* ask each device */
-	array = up_device_list_get_array (daemon->priv->power_devices);
-	for (i=0; i<array->len; i++) {
-		device = (UpDevice *) g_ptr_array_index (array, i);
-		ret = up_device_get_on_battery (device, &on_battery);
-		if (ret && on_battery) {
-			result = TRUE;
-			break;
+	const UpDeviceKind kinds[] = { UP_DEVICE_KIND_BATTERY, UP_DEVICE_KIND_UPS };
+
+	/* ask each device that can supply the system */
+	for (j = 0; j < G_N_ELEMENTS (kinds) && !result; j++) {
+		array = up_device_list_get_kind_array (daemon->priv->power_devices, kinds[j]);
+		for (i=0; i<array->len; i++) {
+			device = (UpDevice *) g_ptr_array_index (array, i);
+			ret = up_device_get_on_battery (device, &on_battery);
+			if (ret && on_battery) {
+				result = TRUE;
+				break;
+			}
 		}
+		g_ptr_array_unref (array);
 	}
-	g_ptr_array_unref (array);
 	return result;
 }
 
@@ -119,24 +132,7 @@ up_daemon_get_on_battery_local (UpDaemon *daemon)
 guint
 up_daemon_get_number_devices_of_type (UpDaemon *daemon, UpDeviceKind type)
 {
-	guint i;
-	UpDevice *device;
-	GPtrArray *array;
-	UpDeviceKind type_tmp;
-	guint count = 0;
-
-	/* ask each device */
-	array = up_device_list_get_array (daemon->priv->power_devices);
-	for (i=0; i<array->len; i++) {
-		device = (UpDevice *) g_ptr_array_index (array, i);
-		g_object_get (device,
-			      "type", &type_tmp,
-			      NULL);
-		if (type == type_tmp)
-			count++;
-	}
-	g_ptr_array_unref (array);
-	return count;
+	return up_device_list_get_num_devices_of_kind (daemon->priv->power_devices, type);
 }
 
 /**
@@ -146,7 +142,7 @@ up_daemon_get_number_devices_of_type (UpDaemon *daemon, UpDeviceKind type)
  *
  * Returns: %TRUE if the state changed.
  **/
-static gboolean
+gboolean
 up_daemon_update_display_battery (UpDaemon *daemon)
 {
 	guint i;
@@ -158,18 +154,38 @@ up_daemon_update_display_battery (UpDaemon *daemon)
 	gdouble energy_total = 0.0;
 	gdouble energy_full_total = 0.0;
 	gdouble energy_rate_total = 0.0;
+	gdouble time_rate_total = 0.0;
 	gint64 time_to_empty_total = 0;
 	gint64 time_to_full_total = 0;
 	gboolean is_present_total = FALSE;
 	guint num_batteries = 0;
 
-	/* Gather state from each device */
-	array = up_device_list_get_array (daemon->priv->power_devices);
+	/* When we have a UPS, it's either a desktop, and
+	 * has no batteries, or a laptop, in which case we
+	 * ignore the batteries */
+	array = up_device_list_get_kind_array (daemon->priv->power_devices, UP_DEVICE_KIND_UPS);
+	if (array->len > 0) {
+		g_object_get (g_ptr_array_index (array, 0),
+			      "state", &state_total,
+			      "percentage", &percentage_total,
+			      "energy", &energy_total,
+			      "energy-full", &energy_full_total,
+			      "energy-rate", &energy_rate_total,
+			      "time-to-empty", &time_to_empty_total,
+			      "time-to-full", &time_to_full_total,
+			      NULL);
+		kind_total = UP_DEVICE_KIND_UPS;
+		is_present_total = TRUE;
+		goto out;
+	}
+	g_ptr_array_unref (array);
+
+	/* Gather state from each battery */
+	array = up_device_list_get_kind_array (daemon->priv->power_devices, UP_DEVICE_KIND_BATTERY);
 	for (i = 0; i < array->len; i++) {
 		UpDevice *device;
 
 		UpDeviceState state = UP_DEVICE_STATE_UNKNOWN;
-		UpDeviceKind kind = UP_DEVICE_KIND_UNKNOWN;
 		gdouble percentage = 0.0;
 		gdouble energy = 0.0;
 		gdouble energy_full = 0.0;
@@ -180,7 +196,6 @@ up_daemon_update_display_battery (UpDaemon *daemon)
 
 		device = g_ptr_array_index (array, i);
 		g_object_get (device,
-			      "type", &kind,
 			      "state", &state,
 			      "percentage", &percentage,
 			      "energy", &energy,
@@ -191,23 +206,7 @@ up_daemon_update_display_battery (UpDaemon *daemon)
 			      "power-supply", &power_supply,
 			      NULL);
 
-		/* When we have a UPS, it's either a desktop, and
-		 * has no batteries, or a laptop, in which case we
-		 * ignore the batteries */
-		if (kind == UP_DEVICE_KIND_UPS) {
-			kind_total = kind;
-			state_total = state;
-			energy_total = energy;
-			energy_full_total = energy_full;
-			energy_rate_total = energy_rate;
-			time_to_empty_total = time_to_empty;
-			time_to_full_total = time_to_full;
-			percentage_total = percentage;
-			is_present_total = TRUE;
-			break;
-		}
-		if (kind != UP_DEVICE_KIND_BATTERY ||
-		    power_supply == FALSE)
+		if (power_supply == FALSE)
 			continue;
 
 		/* If one battery is charging, the composite is charging
@@ -234,6 +233,16 @@ up_daemon_update_display_battery (UpDaemon *daemon)
 		energy_full_total += energy_full;
 		energy_rate_total += energy_rate;
 		time_to_empty_total += time_to_empty;
+
+		/* the times may have been steadied with the history, so use
+		 * the rate they imply for the composite */
+		if (daemon->priv->predict_time) {
+			if (state == UP_DEVICE_STATE_DISCHARGING && time_to_empty > 0)
+				energy_rate = SECONDS_PER_HOUR * energy / time_to_empty;
+			else if (state == UP_DEVICE_STATE_CHARGING && time_to_full > 0)
+				energy_rate = SECONDS_PER_HOUR * (energy_full - energy) / time_to_full;
+		}
+		time_rate_total += energy_rate;
 		time_to_full_total += time_to_full;
 		/* Will be recalculated for multiple batteries, no worries */
 		percentage_total += percentage;
@@ -251,11 +260,11 @@ up_daemon_update_display_battery (UpDaemon *daemon)
 		percentage_total = 100.0 * energy_total / energy_full_total;
 
 	/* calculate a quick and dirty time remaining value */
-	if (energy_rate_total > 0) {
+	if (time_rate_total > 0) {
 		if (state_total == UP_DEVICE_STATE_DISCHARGING)
-			time_to_empty_total = SECONDS_PER_HOUR * (energy_total / energy_rate_total);
+			time_to_empty_total = SECONDS_PER_HOUR * (energy_total / time_rate_total);
 		else if (state_total == UP_DEVICE_STATE_CHARGING)
-			time_to_full_total = SECONDS_PER_HOUR * ((energy_full_total - energy_total) / energy_rate_total);
+			time_to_full_total = SECONDS_PER_HOUR * ((energy_full_total - energy_total) / time_rate_total);
 	}
 
 out:
@@ -282,6 +291,7 @@ out:
 
 	daemon->priv->percentage = percentage_total;
 
+	up_device_freeze (daemon->priv->display_device);
 	g_object_set (daemon->priv->display_device,
 		      "type", kind_total,
 		      "state", state_total,
@@ -295,10 +305,81 @@ out:
 		      "power-supply", TRUE,
 		      "update-time", (guint64) g_get_real_time () / G_USEC_PER_SEC,
 		      NULL);
+	up_device_thaw (daemon->priv->display_device);
 
 	return TRUE;
 }
 
+/**
+ * up_daemon_get_display_history:
+ *
+ * Combines the history of the same devices as the display device,
+ * weighting the charge of each battery by its capacity.
+ **/
+GArray *
+up_daemon_get_display_history (UpDaemon *daemon,
+			       UpHistoryType type,
+			       guint timespan,
+			       guint resolution,
+			       UpHistoryReducer reducer)
+{
+	GPtrArray *array;
+	UpHistory **histories;
+	gdouble *weights;
+	GArray *merged = NULL;
+	GArray *data = NULL;
+	guint n_histories = 0;
+	guint n_devices;
+	guint i;
+
+	/* averaging or summing the other types makes no sense */
+	if (type != UP_HISTORY_TYPE_CHARGE && type != UP_HISTORY_TYPE_RATE)
+		return NULL;
+
+	/* a UPS takes precedence, as in up_daemon_update_display_battery() */
+	array = up_device_list_get_kind_array (daemon->priv->power_devices, UP_DEVICE_KIND_UPS);
+	n_devices = MIN (array->len, 1);
+	if (n_devices == 0) {
+		g_ptr_array_unref (array);
+		array = up_device_list_get_kind_array (daemon->priv->power_devices, UP_DEVICE_KIND_BATTERY);
+		n_devices = array->len;
+	}
+
+	histories = g_new (UpHistory *, n_devices);
+	weights = g_new (gdouble, n_devices);
+	for (i = 0; i < n_devices; i++) {
+		UpExportedDevice *device = g_ptr_array_index (array, i);
+
+		if (!up_exported_device_get_power_supply (device))
+			continue;
+		histories[n_histories] = up_device_get_history_store (UP_DEVICE (device));
+		weights[n_histories] = up_exported_device_get_energy_full (device);
+		if (weights[n_histories] <= 0)
+			weights[n_histories] = 1;
+		n_histories++;
+	}
+
+	if (n_histories == 0)
+		goto out;
+	merged = up_history_get_data_merged (histories, weights, n_histories, type, timespan);
+	if (merged == NULL)
+		goto out;
+
+	if (resolution == 0 || resolution > merged->len)
+		resolution = merged->len;
+	data = g_array_sized_new (FALSE, FALSE, sizeof (UpHistorySample), resolution);
+	g_array_set_size (data, resolution);
+	g_array_set_size (data, up_history_reduce ((UpHistorySample *) merged->data, merged->len, reducer,
+						   (UpHistorySample *) data->data, resolution));
+out:
+	if (merged != NULL)
+		g_array_unref (merged);
+	g_free (histories);
+	g_free (weights);
+	g_ptr_array_unref (array);
+	return data;
+}
+
 /**
  * up_daemon_get_warning_level_local:
  *
@@ -330,32 +411,74 @@ up_daemon_get_warning_level_local (UpDaemon *daemon)
 }
 
 /**
- * up_daemon_get_on_ac_local:
+ * up_daemon_update_on_ac:
  *
- * As soon as _any_ ac supply goes online, this is true
+ * Recompute the cached line power state from the AC adapters.
  **/
-static gboolean
-up_daemon_get_on_ac_local (UpDaemon *daemon)
+static void
+up_daemon_update_on_ac (UpDaemon *daemon)
 {
 	guint i;
-	gboolean ret;
-	gboolean result = FALSE;
 	gboolean online;
 	UpDevice *device;
 	GPtrArray *array;
 
-	/* ask each device */
-	array = up_device_list_get_array (daemon->priv->power_devices);
+	daemon->priv->has_ac = FALSE;
+	daemon->priv->on_ac = FALSE;
+
+	array = up_device_list_get_kind_array (daemon->priv->power_devices, UP_DEVICE_KIND_LINE_POWER);
 	for (i=0; i<array->len; i++) {
 		device = (UpDevice *) g_ptr_array_index (array, i);
-		ret = up_device_get_online (device, &online);
-		if (ret && online) {
-			result = TRUE;
+		if (!up_device_get_online (device, &online))
+			continue;
+		daemon->priv->has_ac = TRUE;
+		if (online) {
+			daemon->priv->on_ac = TRUE;
 			break;
 		}
 	}
 	g_ptr_array_unref (array);
-	return result;
+}
+
+/**
+ * up_daemon_line_power_changed_cb:
+ **/
+static void
+up_daemon_line_power_changed_cb (UpDevice *device, GParamSpec *pspec, UpDaemon *daemon)
+{
+	up_daemon_update_on_ac (daemon);
+}
+
+/**
+ * up_daemon_get_on_ac:
+ * @on_ac: (out): set to %TRUE if any AC adapter is online
+ *
+ * This is cheap, the state is only recomputed when an AC adapter
+ * changes.
+ *
+ * Returns: %FALSE if we don't know of any AC adapter
+ **/
+gboolean
+up_daemon_get_on_ac (UpDaemon *daemon, gboolean *on_ac)
+{
+	g_return_val_if_fail (UP_IS_DAEMON (daemon), FALSE);
+	g_return_val_if_fail (on_ac != NULL, FALSE);
+
+	if (!daemon->priv->has_ac)
+		return FALSE;
+	*on_ac = daemon->priv->on_ac;
+	return TRUE;
+}
+
+/**
+ * up_daemon_get_on_ac_local:
+ *
+ * As soon as _any_ ac supply goes online, this is true
+ **/
+static gboolean
+up_daemon_get_on_ac_local (UpDaemon *daemon)
+{
+	return daemon->priv->on_ac;
 }
 
 /**
@@ -368,23 +491,18 @@ up_daemon_refresh_battery_devices_cb (UpDaemon *daemon)
 	GPtrArray *array;
 	UpDevice *device;
 
-	/* refresh all devices in array */
-	array = up_device_list_get_array (daemon->priv->power_devices);
+	/* refresh all battery devices, and only then update the
+	 * warning level for all of them */
+	daemon->priv->refreshing_batteries = TRUE;
+	array = up_device_list_get_kind_array (daemon->priv->power_devices, UP_DEVICE_KIND_BATTERY);
 	for (i=0; i<array->len; i++) {
-		UpDeviceKind type;
-		gboolean power_supply;
-
 		device = (UpDevice *) g_ptr_array_index (array, i);
-		/* only refresh battery devices */
-		g_object_get (device,
-			      "type", &type,
-			      "power-supply", &power_supply,
-			      NULL);
-		if (type == UP_DEVICE_KIND_BATTERY &&
-		    power_supply)
+		if (up_exported_device_get_power_supply (UP_EXPORTED_DEVICE (device)))
 			up_device_refresh_internal (device);
 	}
 	g_ptr_array_unref (array);
+	daemon->priv->refreshing_batteries = FALSE;
+	up_daemon_update_warning_level (daemon);
 
 	daemon->priv->refresh_event_id = 0;
 	return G_SOURCE_REMOVE;
@@ -474,6 +592,7 @@ up_daemon_register_power_daemon (UpDaemon *daemon,
 	GError *error = NULL;
 
 	/* export our interface on the bus */
+	up_stats_watch_skeleton (G_DBUS_INTERFACE_SKELETON (daemon));
 	g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (daemon),
 					  connection,
 					  "/org/freedesktop/UPower",
@@ -485,12 +604,28 @@ up_daemon_register_power_daemon (UpDaemon *daemon,
 		return FALSE;
 	}
 
+	/* devices are exported through the object manager */
+	g_dbus_object_manager_server_set_connection (daemon->priv->object_manager, connection);
+
 	/* Register the display device */
 	up_device_register_display_device (daemon->priv->display_device, daemon);
 
 	return TRUE;
 }
 
+/**
+ * up_daemon_get_object_manager:
+ *
+ * Returns the object manager the devices are exported through; the
+ * daemon keeps ownership.
+ **/
+GDBusObjectManagerServer *
+up_daemon_get_object_manager (UpDaemon *daemon)
+{
+	g_return_val_if_fail (UP_IS_DAEMON (daemon), NULL);
+	return daemon->priv->object_manager;
+}
+
 /**
  * up_daemon_startup:
  **/
@@ -627,6 +762,9 @@ up_daemon_set_warning_level (UpDaemon *daemon, UpDeviceLevel warning_level)
 	if (priv->warning_level == warning_level)
 		return;
 
+	UP_PROBE2 (warning_level,
+		   up_device_level_to_string (priv->warning_level),
+		   up_device_level_to_string (warning_level));
 	g_debug ("warning_level = %s", up_device_level_to_string (warning_level));
 	priv->warning_level = warning_level;
 
@@ -727,7 +865,7 @@ up_daemon_update_warning_level (UpDaemon *daemon)
  * up_daemon_device_changed_cb:
  **/
 static void
-up_daemon_device_changed_cb (UpDevice *device, GParamSpec *pspec, UpDaemon *daemon)
+up_daemon_device_changed_cb (UpDevice *device, UpDaemon *daemon)
 {
 	UpDeviceKind type;
 
@@ -743,6 +881,10 @@ up_daemon_device_changed_cb (UpDevice *device, GParamSpec *pspec, UpDaemon *daem
 		up_daemon_refresh_battery_devices (daemon);
 	}
 
+	/* done once all batteries have been refreshed */
+	if (daemon->priv->refreshing_batteries)
+		return;
+
 	up_daemon_update_warning_level (daemon);
 }
 
@@ -791,7 +933,9 @@ fire_timeout_callback (gpointer user_data)
 	UpDevice *device = user_data;
 	TimeoutData *data;
 	UpDaemon *daemon;
+	gint64 start;
 
+	start = UP_PROBE_CLOCK ();
 	daemon = up_device_get_daemon (device);
 
 	data = g_hash_table_lookup (daemon->priv->poll_timeouts, device);
@@ -802,9 +946,15 @@ fire_timeout_callback (gpointer user_data)
 		 data->timeout);
 
 	/* Fire the actual callback */
+	up_device_freeze (device);
 	(data->callback) (device);
+	up_device_thaw (device);
 	g_object_unref (daemon);
 
+	UP_PROBE2 (poll_timeout,
+		   up_exported_device_get_native_path (UP_EXPORTED_DEVICE (device)),
+		   g_get_monotonic_time () - start);
+
 	return G_SOURCE_CONTINUE;
 }
 
@@ -1002,8 +1152,11 @@ up_daemon_device_added_cb (UpBackend *backend, GObject *native, UpDevice *device
 	up_device_list_insert (priv->power_devices, native, G_OBJECT (device));
 
 	/* connect, so we get changes */
-	g_signal_connect (device, "notify",
+	g_signal_connect (device, "changed",
 			  G_CALLBACK (up_daemon_device_changed_cb), daemon);
+	g_signal_connect (device, "notify::online",
+			  G_CALLBACK (up_daemon_line_power_changed_cb), daemon);
+	up_daemon_update_on_ac (daemon);
 
 	/* emit */
 	object_path = up_device_get_object_path (device);
@@ -1032,6 +1185,8 @@ up_daemon_device_removed_cb (UpBackend *backend, GObject *native, UpDevice *devi
 
 	/* remove from list */
 	up_device_list_remove (priv->power_devices, G_OBJECT(device));
+	g_signal_handlers_disconnect_by_func (device, up_daemon_line_power_changed_cb, daemon);
+	up_daemon_update_on_ac (daemon);
 
 	/* emit */
 	object_path = up_device_get_object_path (device);
@@ -1043,6 +1198,7 @@ up_daemon_device_removed_cb (UpBackend *backend, GObject *native, UpDevice *devi
 		return;
 	}
 	up_exported_daemon_emit_device_removed (UP_EXPORTED_DAEMON (daemon), object_path);
+	g_dbus_object_manager_server_unexport (priv->object_manager, object_path);
 
 	/* finalise the object */
 	g_object_unref (device);
@@ -1103,9 +1259,11 @@ up_daemon_init (UpDaemon *daemon)
 	daemon->priv = UP_DAEMON_GET_PRIVATE (daemon);
 	daemon->priv->config = up_config_new ();
 	daemon->priv->power_devices = up_device_list_new ();
+	daemon->priv->object_manager = g_dbus_object_manager_server_new ("/org/freedesktop/UPower");
 	daemon->priv->display_device = up_device_new ();
 
 	daemon->priv->use_percentage_for_policy = up_config_get_boolean (daemon->priv->config, "UsePercentageForPolicy");
+	daemon->priv->predict_time = up_config_get_boolean (daemon->priv->config, "PredictTimeFromHistory");
 	load_percentage_policy (daemon, FALSE);
 	load_time_policy (daemon, FALSE);
 	policy_config_validate (daemon);
@@ -1182,6 +1340,7 @@ up_daemon_finalize (GObject *object)
 	g_clear_pointer (&priv->idle_signals, g_hash_table_destroy);
 
 	g_object_unref (priv->power_devices);
+	g_object_unref (priv->object_manager);
 	g_object_unref (priv->display_device);
 	g_object_unref (priv->config);
 	g_object_unref (priv->backend);
@@ -24,6 +24,7 @@
 #include <dbus/up-daemon-generated.h>
 #include "up-types.h"
 #include "up-device-list.h"
+#include "up-history.h"
 
 G_BEGIN_DECLS
 
@@ -65,6 +66,15 @@ UpDaemon	*up_daemon_new			(void);
 guint		 up_daemon_get_number_devices_of_type (UpDaemon	*daemon,
 						 UpDeviceKind		 type);
 UpDeviceList	*up_daemon_get_device_list	(UpDaemon		*daemon);
+GDBusObjectManagerServer *up_daemon_get_object_manager (UpDaemon		*daemon);
+gboolean	 up_daemon_update_display_battery (UpDaemon		*daemon);
+GArray		*up_daemon_get_display_history	(UpDaemon		*daemon,
+						 UpHistoryType		 type,
+						 guint			 timespan,
+						 guint			 resolution,
+						 UpHistoryReducer	 reducer);
+gboolean	 up_daemon_get_on_ac		(UpDaemon		*daemon,
+						 gboolean		*on_ac);
 gboolean	 up_daemon_startup		(UpDaemon		*daemon,
 						 GDBusConnection 	*connection);
 void		 up_daemon_shutdown		(UpDaemon		*daemon);
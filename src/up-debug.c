@@ -0,0 +1,88 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "up-debug.h"
+#include "up-stats.h"
+
+G_DEFINE_TYPE (UpDebug, up_debug, UP_TYPE_EXPORTED_DEBUG_SKELETON)
+
+/**
+ * up_debug_get_stats:
+ **/
+static gboolean
+up_debug_get_stats (UpExportedDebug *skeleton,
+		    GDBusMethodInvocation *invocation,
+		    UpDebug *debug)
+{
+	up_exported_debug_complete_get_stats (skeleton, invocation,
+					      up_stats_get_variant ());
+	return TRUE;
+}
+
+/**
+ * up_debug_class_init:
+ **/
+static void
+up_debug_class_init (UpDebugClass *klass)
+{
+}
+
+/**
+ * up_debug_init:
+ **/
+static void
+up_debug_init (UpDebug *debug)
+{
+	g_signal_connect (debug, "handle-get-stats",
+			  G_CALLBACK (up_debug_get_stats), debug);
+}
+
+/**
+ * up_debug_new:
+ **/
+UpDebug *
+up_debug_new (void)
+{
+	return g_object_new (UP_TYPE_DEBUG, NULL);
+}
+
+/**
+ * up_debug_register:
+ **/
+void
+up_debug_register (UpDebug *debug,
+		   GDBusConnection *connection)
+{
+	GError *error = NULL;
+
+	up_stats_watch_skeleton (G_DBUS_INTERFACE_SKELETON (debug));
+	g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (debug),
+					  connection,
+					  "/org/freedesktop/UPower/Debug",
+					  &error);
+
+	if (error != NULL) {
+		g_critical ("Cannot register debug on system bus: %s", error->message);
+		g_error_free (error);
+	}
+}
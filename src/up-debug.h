@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __UP_DEBUG_H
+#define __UP_DEBUG_H
+
+#include <dbus/up-debug-generated.h>
+
+G_BEGIN_DECLS
+
+#define UP_TYPE_DEBUG		(up_debug_get_type ())
+#define UP_DEBUG(o)		(G_TYPE_CHECK_INSTANCE_CAST ((o), UP_TYPE_DEBUG, UpDebug))
+#define UP_DEBUG_CLASS(k)	(G_TYPE_CHECK_CLASS_CAST((k), UP_TYPE_DEBUG, UpDebugClass))
+#define UP_IS_DEBUG(o)		(G_TYPE_CHECK_INSTANCE_TYPE ((o), UP_TYPE_DEBUG))
+#define UP_IS_DEBUG_CLASS(k)	(G_TYPE_CHECK_CLASS_TYPE ((k), UP_TYPE_DEBUG))
+#define UP_DEBUG_GET_CLASS(o)	(G_TYPE_INSTANCE_GET_CLASS ((o), UP_TYPE_DEBUG, UpDebugClass))
+
+typedef struct
+{
+	UpExportedDebugSkeleton parent;
+} UpDebug;
+
+typedef struct
+{
+	UpExportedDebugSkeletonClass parent_class;
+} UpDebugClass;
+
+UpDebug		*up_debug_new			(void);
+GType		 up_debug_get_type		(void);
+void		 up_debug_register		(UpDebug *debug,
+						 GDBusConnection *connection);
+
+G_END_DECLS
+
+#endif	/* __UP_DEBUG_H */
@@ -26,6 +26,7 @@
 #include <glib.h>
 
 #include "up-native.h"
+#include "up-device.h"
 #include "up-device-list.h"
 
 static void	up_device_list_finalize	(GObject		*object);
@@ -36,10 +37,105 @@ struct UpDeviceListPrivate
 {
 	GPtrArray		*array;
 	GHashTable		*map_native_path_to_device;
+	GHashTable		*map_object_path_to_device;
+	GHashTable		*map_device_to_entry;
+	GPtrArray		*kind_array[UP_DEVICE_KIND_LAST];
 };
 
+/* the secondary indices of an #UpDevice in the list */
+typedef struct {
+	UpDeviceKind		 kind;
+	gchar			*object_path;
+	gulong			 notify_type_id;
+} UpDeviceListEntry;
+
 G_DEFINE_TYPE (UpDeviceList, up_device_list, G_TYPE_OBJECT)
 
+/**
+ * up_device_list_entry_free:
+ **/
+static void
+up_device_list_entry_free (UpDeviceListEntry *entry)
+{
+	g_free (entry->object_path);
+	g_free (entry);
+}
+
+/**
+ * up_device_list_kind_changed_cb:
+ *
+ * Keep the per-kind index in sync if a device changes type.
+ **/
+static void
+up_device_list_kind_changed_cb (UpDevice *device, GParamSpec *pspec, UpDeviceList *list)
+{
+	UpDeviceListEntry *entry;
+	UpDeviceKind kind;
+
+	entry = g_hash_table_lookup (list->priv->map_device_to_entry, device);
+	if (entry == NULL)
+		return;
+
+	kind = up_exported_device_get_type_ (UP_EXPORTED_DEVICE (device));
+	if (kind >= UP_DEVICE_KIND_LAST || kind == entry->kind)
+		return;
+
+	g_ptr_array_remove (list->priv->kind_array[entry->kind], device);
+	g_ptr_array_add (list->priv->kind_array[kind], device);
+	entry->kind = kind;
+}
+
+/**
+ * up_device_list_index_device:
+ **/
+static void
+up_device_list_index_device (UpDeviceList *list, GObject *device)
+{
+	UpDeviceListEntry *entry;
+	UpDeviceKind kind;
+
+	/* we also get used for objects that are not on the bus */
+	if (!UP_IS_DEVICE (device))
+		return;
+	if (g_hash_table_contains (list->priv->map_device_to_entry, device))
+		return;
+
+	kind = up_exported_device_get_type_ (UP_EXPORTED_DEVICE (device));
+	if (kind >= UP_DEVICE_KIND_LAST)
+		kind = UP_DEVICE_KIND_UNKNOWN;
+
+	entry = g_new0 (UpDeviceListEntry, 1);
+	entry->kind = kind;
+	entry->object_path = g_strdup (up_device_get_object_path (UP_DEVICE (device)));
+	entry->notify_type_id = g_signal_connect (device, "notify::type",
+						  G_CALLBACK (up_device_list_kind_changed_cb), list);
+	g_hash_table_insert (list->priv->map_device_to_entry, device, entry);
+
+	g_ptr_array_add (list->priv->kind_array[kind], device);
+	if (entry->object_path != NULL)
+		g_hash_table_insert (list->priv->map_object_path_to_device,
+				     entry->object_path, device);
+}
+
+/**
+ * up_device_list_unindex_device:
+ **/
+static void
+up_device_list_unindex_device (UpDeviceList *list, GObject *device)
+{
+	UpDeviceListEntry *entry;
+
+	entry = g_hash_table_lookup (list->priv->map_device_to_entry, device);
+	if (entry == NULL)
+		return;
+
+	g_signal_handler_disconnect (device, entry->notify_type_id);
+	g_ptr_array_remove (list->priv->kind_array[entry->kind], device);
+	if (entry->object_path != NULL)
+		g_hash_table_remove (list->priv->map_object_path_to_device, entry->object_path);
+	g_hash_table_remove (list->priv->map_device_to_entry, device);
+}
+
 /**
  * up_device_list_lookup:
  *
@@ -66,6 +162,27 @@ up_device_list_lookup (UpDeviceList *list, GObject *native)
 	return g_object_ref (device);
 }
 
+/**
+ * up_device_list_lookup_by_object_path:
+ *
+ * Find the %UpDevice exported at @object_path.
+ *
+ * Return value: the object, or %NULL if not found. Free with g_object_unref()
+ **/
+GObject *
+up_device_list_lookup_by_object_path (UpDeviceList *list, const gchar *object_path)
+{
+	GObject *device;
+
+	g_return_val_if_fail (UP_IS_DEVICE_LIST (list), NULL);
+	g_return_val_if_fail (object_path != NULL, NULL);
+
+	device = g_hash_table_lookup (list->priv->map_object_path_to_device, object_path);
+	if (device == NULL)
+		return NULL;
+	return g_object_ref (device);
+}
+
 /**
  * up_device_list_insert:
  *
@@ -89,6 +206,7 @@ up_device_list_insert (UpDeviceList *list, GObject *native, GObject *device)
 	g_hash_table_insert (list->priv->map_native_path_to_device,
 			     g_strdup (native_path), g_object_ref (device));
 	g_ptr_array_add (list->priv->array, g_object_ref (device));
+	up_device_list_index_device (list, device);
 	g_debug ("added %s", native_path);
 	return TRUE;
 }
@@ -116,6 +234,7 @@ up_device_list_remove (UpDeviceList *list, GObject *device)
 	g_return_val_if_fail (device != NULL, FALSE);
 
 	/* remove the device from the db */
+	up_device_list_unindex_device (list, device);
 	g_hash_table_foreach_remove (list->priv->map_native_path_to_device,
 				     up_device_list_remove_cb, device);
 	g_ptr_array_remove (list->priv->array, device);
@@ -148,8 +267,14 @@ up_device_list_remove_all_cb (gpointer key, gpointer value, gpointer user_data)
 void
 up_device_list_clear (UpDeviceList *list, gboolean unref_it)
 {
+	guint i;
+
 	g_return_if_fail (UP_IS_DEVICE_LIST (list));
 
+	/* drop the secondary indices */
+	for (i = 0; i < list->priv->array->len; i++)
+		up_device_list_unindex_device (list, g_ptr_array_index (list->priv->array, i));
+
 	/* caller owns these objects, but wants to destroy them */
 	if (unref_it)
 		g_ptr_array_foreach (list->priv->array, (GFunc) g_object_unref, NULL);
@@ -174,6 +299,34 @@ up_device_list_get_array (UpDeviceList *list)
 	return g_ptr_array_ref (list->priv->array);
 }
 
+/**
+ * up_device_list_get_kind_array:
+ *
+ * Gets the %UpDevice objects of one kind, without copying. The array
+ * is kept up to date as devices are added, removed, or change type, so
+ * don't modify the list while iterating over it.
+ *
+ * Return value: the array, free with g_ptr_array_unref()
+ **/
+GPtrArray *
+up_device_list_get_kind_array (UpDeviceList *list, UpDeviceKind kind)
+{
+	g_return_val_if_fail (UP_IS_DEVICE_LIST (list), NULL);
+	g_return_val_if_fail (kind < UP_DEVICE_KIND_LAST, NULL);
+	return g_ptr_array_ref (list->priv->kind_array[kind]);
+}
+
+/**
+ * up_device_list_get_num_devices_of_kind:
+ **/
+guint
+up_device_list_get_num_devices_of_kind (UpDeviceList *list, UpDeviceKind kind)
+{
+	g_return_val_if_fail (UP_IS_DEVICE_LIST (list), 0);
+	g_return_val_if_fail (kind < UP_DEVICE_KIND_LAST, 0);
+	return list->priv->kind_array[kind]->len;
+}
+
 /**
  * up_device_list_class_init:
  * @klass: The UpDeviceListClass
@@ -193,9 +346,18 @@ up_device_list_class_init (UpDeviceListClass *klass)
 static void
 up_device_list_init (UpDeviceList *list)
 {
+	guint i;
+
 	list->priv = UP_DEVICE_LIST_GET_PRIVATE (list);
 	list->priv->array = g_ptr_array_new_with_free_func (g_object_unref);
 	list->priv->map_native_path_to_device = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+
+	/* the secondary indices don't hold references */
+	list->priv->map_object_path_to_device = g_hash_table_new (g_str_hash, g_str_equal);
+	list->priv->map_device_to_entry = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+								 NULL, (GDestroyNotify) up_device_list_entry_free);
+	for (i = 0; i < UP_DEVICE_KIND_LAST; i++)
+		list->priv->kind_array[i] = g_ptr_array_new ();
 }
 
 /**
@@ -206,11 +368,19 @@ static void
 up_device_list_finalize (GObject *object)
 {
 	UpDeviceList *list;
+	guint i;
 
 	g_return_if_fail (UP_IS_DEVICE_LIST (object));
 
 	list = UP_DEVICE_LIST (object);
 
+	for (i = 0; i < list->priv->array->len; i++)
+		up_device_list_unindex_device (list, g_ptr_array_index (list->priv->array, i));
+	for (i = 0; i < UP_DEVICE_KIND_LAST; i++)
+		g_ptr_array_unref (list->priv->kind_array[i]);
+	g_hash_table_unref (list->priv->map_device_to_entry);
+	g_hash_table_unref (list->priv->map_object_path_to_device);
+
 	g_ptr_array_unref (list->priv->array);
 	g_hash_table_unref (list->priv->map_native_path_to_device);
 
@@ -227,4 +397,3 @@ up_device_list_new (void)
 {
 	return g_object_new (UP_TYPE_DEVICE_LIST, NULL);
 }
-
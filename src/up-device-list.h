@@ -55,6 +55,8 @@ UpDeviceList	*up_device_list_new			(void);
 
 GObject		*up_device_list_lookup			(UpDeviceList		*list,
 							 GObject		*native);
+GObject		*up_device_list_lookup_by_object_path	(UpDeviceList		*list,
+							 const gchar		*object_path);
 gboolean	 up_device_list_insert			(UpDeviceList		*list,
 							 GObject		*native,
 							 GObject		*device);
@@ -63,6 +65,10 @@ gboolean	 up_device_list_remove			(UpDeviceList		*list,
 void		 up_device_list_clear			(UpDeviceList		*list,
 							 gboolean unref_it);
 GPtrArray	*up_device_list_get_array		(UpDeviceList		*list);
+GPtrArray	*up_device_list_get_kind_array		(UpDeviceList		*list,
+							 UpDeviceKind		 kind);
+guint		 up_device_list_get_num_devices_of_kind	(UpDeviceList		*list,
+							 UpDeviceKind		 kind);
 
 G_END_DECLS
 
@@ -24,16 +24,21 @@
 #endif
 
 #include <string.h>
+#include <unistd.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <glib/gi18n-lib.h>
 #include <glib-object.h>
+#include <gio/gunixfdlist.h>
 
+#include "up-config.h"
 #include "up-native.h"
 #include "up-device.h"
 #include "up-history.h"
 #include "up-history-item.h"
+#include "up-probes.h"
+#include "up-stats.h"
 #include "up-stats-item.h"
 
 struct UpDevicePrivate
@@ -42,13 +47,46 @@ struct UpDevicePrivate
 	UpHistory		*history;
 	GObject			*native;
 	gboolean		 has_ever_refresh;
+	gboolean		 is_display_device;
+	gboolean		 predict_time;
+	UpProfile		*profile;
+	gchar			*profile_sender;
+	guint			 profile_watch_id;
+	UpStatsCounter		*refresh_stats;
+
+	/* Property change transactions */
+	guint			 freeze_count;
+	gboolean		 committing;
+	guint			 pending_updates;
+	gboolean		 pending_changed;
+
+	/* PropertiesChanged rate limiting */
+	guint			 changed_interval;
+	guint			 changed_timeout_id;
+	GParamSpec		*changed_pspec;
 };
 
+typedef enum {
+	UP_DEVICE_UPDATE_WARNING_LEVEL	= 1 << 0,
+	UP_DEVICE_UPDATE_ICON_NAME	= 1 << 1,
+	UP_DEVICE_UPDATE_HISTORY	= 1 << 2
+} UpDeviceUpdateFlags;
+
+enum {
+	SIGNAL_CHANGED,
+	SIGNAL_LAST
+};
+
+static guint signals [SIGNAL_LAST] = { 0 };
+
 G_DEFINE_TYPE (UpDevice, up_device, UP_TYPE_EXPORTED_DEVICE_SKELETON)
 #define UP_DEVICE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), UP_TYPE_DEVICE, UpDevicePrivate))
 
 #define UP_DEVICES_DBUS_PATH "/org/freedesktop/UPower/devices"
 
+/* how much a profile covering all the remaining charge levels counts */
+#define UP_DEVICE_PROFILE_WEIGHT	0.5f
+
 /* This needs to be called when one of those properties changes:
  * state
  * power_supply
@@ -185,6 +223,99 @@ update_history (UpDevice *device)
 	up_history_set_time_empty_data (device->priv->history, up_exported_device_get_time_to_empty (skeleton));
 }
 
+/**
+ * up_device_apply_updates:
+ *
+ * Recompute the properties derived from the ones that changed.
+ **/
+static void
+up_device_apply_updates (UpDevice *device, guint updates)
+{
+	if (updates & UP_DEVICE_UPDATE_WARNING_LEVEL)
+		update_warning_level (device);
+	if (updates & UP_DEVICE_UPDATE_ICON_NAME)
+		update_icon_name (device);
+	if (updates & UP_DEVICE_UPDATE_HISTORY)
+		update_history (device);
+}
+
+/* These change on almost every refresh, and clients can live with
+ * seeing them a little late. Everything else, and notably state and
+ * warning-level, is published straight away. */
+static const gchar *up_device_deferred_properties[] = {
+	"update-time",
+	"energy",
+	"energy-rate",
+	"charge",
+	"voltage",
+	"temperature",
+	"luminosity",
+	"time-to-empty",
+	"time-to-full",
+	NULL
+};
+
+/**
+ * up_device_is_deferred_property:
+ **/
+static gboolean
+up_device_is_deferred_property (const gchar *name)
+{
+	guint i;
+
+	for (i = 0; up_device_deferred_properties[i] != NULL; i++) {
+		if (g_strcmp0 (up_device_deferred_properties[i], name) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * up_device_changed_timeout_cb:
+ **/
+static gboolean
+up_device_changed_timeout_cb (UpDevice *device)
+{
+	device->priv->changed_timeout_id = 0;
+
+	/* the skeleton schedules PropertiesChanged for everything pending */
+	G_OBJECT_CLASS (up_device_parent_class)->notify (G_OBJECT (device),
+							  device->priv->changed_pspec);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * up_device_notify_skeleton:
+ *
+ * The exported skeleton queues each changed property as it is set,
+ * but only schedules the PropertiesChanged emission from its notify
+ * handler. Deferred properties are held back for ChangedSignalsInterval
+ * milliseconds; any other change sends out everything queued so far.
+ **/
+static void
+up_device_notify_skeleton (UpDevice *device, GParamSpec *pspec)
+{
+	UpDevicePrivate *priv = device->priv;
+
+	if (priv->changed_interval > 0 &&
+	    up_device_is_deferred_property (pspec->name)) {
+		if (priv->changed_timeout_id == 0) {
+			priv->changed_pspec = pspec;
+			priv->changed_timeout_id = g_timeout_add (priv->changed_interval,
+								  (GSourceFunc) up_device_changed_timeout_cb,
+								  device);
+			g_source_set_name_by_id (priv->changed_timeout_id, "[upower] up_device_changed_timeout_cb");
+		}
+		return;
+	}
+
+	if (priv->changed_timeout_id != 0) {
+		g_source_remove (priv->changed_timeout_id);
+		priv->changed_timeout_id = 0;
+	}
+	G_OBJECT_CLASS (up_device_parent_class)->notify (G_OBJECT (device), pspec);
+}
+
 /**
  * up_device_notify:
  **/
@@ -192,23 +323,92 @@ static void
 up_device_notify (GObject *object, GParamSpec *pspec)
 {
 	UpDevice *device = UP_DEVICE (object);
+	guint updates = 0;
 
-	G_OBJECT_CLASS (up_device_parent_class)->notify (object, pspec);
+	up_device_notify_skeleton (device, pspec);
 
 	if (g_strcmp0 (pspec->name, "type") == 0 ||
 	    g_strcmp0 (pspec->name, "is-present") == 0) {
-		update_icon_name (device);
+		updates = UP_DEVICE_UPDATE_ICON_NAME;
 	} else if (g_strcmp0 (pspec->name, "power-supply") == 0 ||
 		   g_strcmp0 (pspec->name, "time-to-empty") == 0) {
-		update_warning_level (device);
+		updates = UP_DEVICE_UPDATE_WARNING_LEVEL;
 	} else if (g_strcmp0 (pspec->name, "state") == 0 ||
 		   g_strcmp0 (pspec->name, "percentage") == 0 ||
 		   g_strcmp0 (pspec->name, "battery-level") == 0) {
-		update_warning_level (device);
-		update_icon_name (device);
+		updates = UP_DEVICE_UPDATE_WARNING_LEVEL | UP_DEVICE_UPDATE_ICON_NAME;
 	} else if (g_strcmp0 (pspec->name, "update-time") == 0) {
-		update_history (device);
+		updates = UP_DEVICE_UPDATE_HISTORY;
+	}
+
+	/* inside a transaction, defer everything to up_device_thaw() */
+	if (device->priv->freeze_count > 0 || device->priv->committing) {
+		device->priv->pending_updates |= updates;
+		device->priv->pending_changed = TRUE;
+		return;
+	}
+
+	/* a single change commits on its own, including what it derives */
+	device->priv->committing = TRUE;
+	up_device_apply_updates (device, updates);
+	device->priv->committing = FALSE;
+	device->priv->pending_changed = FALSE;
+	g_signal_emit (device, signals[SIGNAL_CHANGED], 0);
+}
+
+/**
+ * up_device_freeze:
+ *
+ * Start a property change transaction. Until the matching up_device_thaw()
+ * property notifications are queued, derived properties are not recomputed
+ * and #UpDevice::changed is not emitted. Calls may be nested.
+ **/
+void
+up_device_freeze (UpDevice *device)
+{
+	g_return_if_fail (UP_IS_DEVICE (device));
+
+	if (device->priv->freeze_count++ == 0)
+		g_object_freeze_notify (G_OBJECT (device));
+}
+
+/**
+ * up_device_thaw:
+ *
+ * Commit a property change transaction started with up_device_freeze().
+ * When the outermost transaction ends, the queued notifications are
+ * dispatched, the derived properties (warning level, icon name, history)
+ * are computed once, and #UpDevice::changed is emitted once.
+ **/
+void
+up_device_thaw (UpDevice *device)
+{
+	guint updates;
+
+	g_return_if_fail (UP_IS_DEVICE (device));
+	g_return_if_fail (device->priv->freeze_count > 0);
+
+	if (--device->priv->freeze_count > 0)
+		return;
+
+	g_object_ref (device);
+	device->priv->committing = TRUE;
+
+	/* dispatch the queued notifications, which only record what changed */
+	g_object_thaw_notify (G_OBJECT (device));
+
+	/* the derived properties may change in turn, keep collecting */
+	updates = device->priv->pending_updates;
+	device->priv->pending_updates = 0;
+	up_device_apply_updates (device, updates);
+
+	device->priv->committing = FALSE;
+
+	if (device->priv->pending_changed) {
+		device->priv->pending_changed = FALSE;
+		g_signal_emit (device, signals[SIGNAL_CHANGED], 0);
 	}
+	g_object_unref (device);
 }
 
 /**
@@ -356,17 +556,20 @@ static void
 up_device_export_skeleton (UpDevice *device,
 			   const gchar *object_path)
 {
-	GError *error = NULL;
-
-	g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (device),
-					  g_dbus_interface_skeleton_get_connection (G_DBUS_INTERFACE_SKELETON (device->priv->daemon)),
-					  object_path,
-					  &error);
-
-	if (error != NULL) {
-		g_critical ("error registering device on system bus: %s", error->message);
-		g_error_free (error);
-	}
+	GDBusObjectSkeleton *object;
+
+	/* exporting through the object manager puts the device on the bus
+	 * and announces it with InterfacesAdded */
+	object = g_dbus_object_skeleton_new (object_path);
+	up_stats_watch_skeleton (G_DBUS_INTERFACE_SKELETON (device));
+	g_dbus_object_skeleton_add_interface (object, G_DBUS_INTERFACE_SKELETON (device));
+	g_dbus_object_manager_server_export (up_daemon_get_object_manager (device->priv->daemon),
+					     object);
+	g_object_unref (object);
+
+	if (!g_dbus_interface_skeleton_has_connection (G_DBUS_INTERFACE_SKELETON (device),
+						       g_dbus_interface_skeleton_get_connection (G_DBUS_INTERFACE_SKELETON (device->priv->daemon))))
+		g_critical ("error registering device %s on system bus", object_path);
 }
 
 /**
@@ -552,6 +755,82 @@ out:
 	return TRUE;
 }
 
+/**
+ * up_device_history_type_from_string:
+ **/
+static UpHistoryType
+up_device_history_type_from_string (const gchar *type_string)
+{
+	if (g_strcmp0 (type_string, "rate") == 0)
+		return UP_HISTORY_TYPE_RATE;
+	if (g_strcmp0 (type_string, "charge") == 0)
+		return UP_HISTORY_TYPE_CHARGE;
+	if (g_strcmp0 (type_string, "time-full") == 0)
+		return UP_HISTORY_TYPE_TIME_FULL;
+	if (g_strcmp0 (type_string, "time-empty") == 0)
+		return UP_HISTORY_TYPE_TIME_EMPTY;
+	return UP_HISTORY_TYPE_UNKNOWN;
+}
+
+/**
+ * up_device_get_history_reduced:
+ *
+ * The display device has no history of its own, so combine the
+ * history of the devices it is made of.
+ **/
+static GArray *
+up_device_get_history_reduced (UpDevice *device, UpHistoryType type, guint timespan, guint resolution, UpHistoryReducer reducer)
+{
+	if (device->priv->is_display_device)
+		return up_daemon_get_display_history (device->priv->daemon, type, timespan, resolution, reducer);
+	return up_history_get_data_reduced (device->priv->history, type, timespan, resolution, reducer);
+}
+
+/**
+ * up_device_history_samples_to_variant:
+ **/
+static GVariant *
+up_device_history_samples_to_variant (GArray *array)
+{
+	UpHistorySample *sample;
+	GVariantBuilder builder;
+	guint i;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(udu)"));
+	for (i = 0; i < array->len; i++) {
+		sample = &g_array_index (array, UpHistorySample, i);
+		g_variant_builder_add (&builder, "(udu)",
+				       sample->time,
+				       sample->value,
+				       sample->state);
+	}
+	return g_variant_builder_end (&builder);
+}
+
+/**
+ * up_device_history_items_to_variant:
+ * @array: a #GPtrArray of #UpHistoryItem
+ *
+ * Return value: (transfer floating): the items in the GetHistory format
+ **/
+GVariant *
+up_device_history_items_to_variant (GPtrArray *array)
+{
+	UpHistoryItem *item;
+	GVariantBuilder builder;
+	guint i;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(udu)"));
+	for (i = 0; i < array->len; i++) {
+		item = (UpHistoryItem *) g_ptr_array_index (array, i);
+		g_variant_builder_add (&builder, "(udu)",
+				       up_history_item_get_time (item),
+				       up_history_item_get_value (item),
+				       up_history_item_get_state (item));
+	}
+	return g_variant_builder_end (&builder);
+}
+
 /**
  * up_device_get_history:
  **/
@@ -564,10 +843,8 @@ up_device_get_history (UpExportedDevice *skeleton,
 		       UpDevice *device)
 {
 	GPtrArray *array = NULL;
-	UpHistoryItem *item;
-	guint i;
 	UpHistoryType type = UP_HISTORY_TYPE_UNKNOWN;
-	GVariantBuilder builder;
+	GArray *samples;
 
 	/* doesn't even try to support this */
 	if (!up_exported_device_get_has_history (skeleton)) {
@@ -578,14 +855,23 @@ up_device_get_history (UpExportedDevice *skeleton,
 	}
 
 	/* get the correct data */
-	if (g_strcmp0 (type_string, "rate") == 0)
-		type = UP_HISTORY_TYPE_RATE;
-	else if (g_strcmp0 (type_string, "charge") == 0)
-		type = UP_HISTORY_TYPE_CHARGE;
-	else if (g_strcmp0 (type_string, "time-full") == 0)
-		type = UP_HISTORY_TYPE_TIME_FULL;
-	else if (g_strcmp0 (type_string, "time-empty") == 0)
-		type = UP_HISTORY_TYPE_TIME_EMPTY;
+	type = up_device_history_type_from_string (type_string);
+
+	/* the display device combines the other devices */
+	if (device->priv->is_display_device) {
+		samples = up_device_get_history_reduced (device, type, timespan, resolution,
+							 UP_HISTORY_REDUCER_AVERAGE);
+		if (samples == NULL) {
+			g_dbus_method_invocation_return_error_literal (invocation,
+								       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+								       "device has no history");
+			goto out;
+		}
+		up_exported_device_complete_get_history (skeleton, invocation,
+							 up_device_history_samples_to_variant (samples));
+		g_array_unref (samples);
+		goto out;
+	}
 
 	/* something recognised */
 	if (type != UP_HISTORY_TYPE_UNKNOWN)
@@ -599,22 +885,367 @@ up_device_get_history (UpExportedDevice *skeleton,
 		goto out;
 	}
 
+	up_exported_device_complete_get_history (skeleton, invocation,
+						 up_device_history_items_to_variant (array));
+
+out:
+	if (array != NULL)
+		g_ptr_array_unref (array);
+	return TRUE;
+}
+
+/**
+ * up_device_get_history_with_options:
+ **/
+static gboolean
+up_device_get_history_with_options (UpExportedDevice *skeleton,
+				    GDBusMethodInvocation *invocation,
+				    const gchar *type_string,
+				    guint timespan,
+				    guint resolution,
+				    GVariant *options,
+				    UpDevice *device)
+{
+	UpHistoryReducer reducer = UP_HISTORY_REDUCER_AVERAGE;
+	const gchar *reducer_string;
+	GArray *array = NULL;
+
+	/* doesn't even try to support this */
+	if (!up_exported_device_get_has_history (skeleton)) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "device does not support getting history");
+		goto out;
+	}
+
+	if (g_variant_lookup (options, "reducer", "&s", &reducer_string)) {
+		reducer = up_history_reducer_from_string (reducer_string);
+		if (reducer == UP_HISTORY_REDUCER_UNKNOWN) {
+			g_dbus_method_invocation_return_error (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "reducer %s not recognised",
+							       reducer_string);
+			goto out;
+		}
+	}
+
+	array = up_device_get_history_reduced (device,
+					       up_device_history_type_from_string (type_string),
+					       timespan, resolution, reducer);
+
+	/* maybe the device doesn't have any history */
+	if (array == NULL) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "device has no history");
+		goto out;
+	}
+
+	up_exported_device_complete_get_history_with_options (skeleton, invocation,
+							      up_device_history_samples_to_variant (array));
+out:
+	if (array != NULL)
+		g_array_unref (array);
+	return TRUE;
+}
+
+/**
+ * up_device_get_history_series:
+ **/
+static gboolean
+up_device_get_history_series (UpExportedDevice *skeleton,
+			      GDBusMethodInvocation *invocation,
+			      const gchar * const *type_strings,
+			      guint timespan,
+			      guint resolution,
+			      UpDevice *device)
+{
+	UpHistoryType types[UP_HISTORY_TYPE_UNKNOWN];
+	UpHistorySeriesPoint *point;
+	UpHistory *history;
+	GArray *array = NULL;
+	GVariantBuilder builder;
+	guint n_types;
+	guint i, j;
+
+	/* doesn't even try to support this */
+	if (!up_exported_device_get_has_history (skeleton)) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "device does not support getting history");
+		goto out;
+	}
+	history = up_device_get_history_store (device);
+	if (history == NULL) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "the display device only supports GetHistory and GetHistoryWithOptions");
+		goto out;
+	}
+
+	/* get the correct data */
+	n_types = g_strv_length ((gchar **) type_strings);
+	if (n_types == 0 || n_types > G_N_ELEMENTS (types)) {
+		g_dbus_method_invocation_return_error (invocation,
+						       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+						       "between 1 and %u types are required",
+						       (guint) G_N_ELEMENTS (types));
+		goto out;
+	}
+	for (i = 0; i < n_types; i++) {
+		types[i] = up_device_history_type_from_string (type_strings[i]);
+		if (types[i] == UP_HISTORY_TYPE_UNKNOWN) {
+			g_dbus_method_invocation_return_error (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "history type %s not recognised",
+							       type_strings[i]);
+			goto out;
+		}
+	}
+
+	array = up_history_get_data_series (history, types, n_types, timespan, resolution);
+
+	/* maybe the device doesn't have any history */
+	if (array == NULL) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "device has no history");
+		goto out;
+	}
+
 	/* copy data to dbus struct */
-	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(udu)"));
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(uuad)"));
 	for (i = 0; i < array->len; i++) {
-		item = (UpHistoryItem *) g_ptr_array_index (array, i);
-		g_variant_builder_add (&builder, "(udu)",
-				       up_history_item_get_time (item),
-				       up_history_item_get_value (item),
-				       up_history_item_get_state (item));
+		point = &g_array_index (array, UpHistorySeriesPoint, i);
+		g_variant_builder_open (&builder, G_VARIANT_TYPE ("(uuad)"));
+		g_variant_builder_add (&builder, "u", point->time);
+		g_variant_builder_add (&builder, "u", point->state);
+		g_variant_builder_open (&builder, G_VARIANT_TYPE ("ad"));
+		for (j = 0; j < n_types; j++)
+			g_variant_builder_add (&builder, "d", point->values[j]);
+		g_variant_builder_close (&builder);
+		g_variant_builder_close (&builder);
 	}
 
-	up_exported_device_complete_get_history (skeleton, invocation,
-						 g_variant_builder_end (&builder));
-
+	up_exported_device_complete_get_history_series (skeleton, invocation,
+							g_variant_builder_end (&builder));
 out:
 	if (array != NULL)
-		g_ptr_array_unref (array);
+		g_array_unref (array);
+	return TRUE;
+}
+
+/**
+ * up_device_get_history_fd:
+ **/
+static gboolean
+up_device_get_history_fd (UpExportedDevice *skeleton,
+			  GDBusMethodInvocation *invocation,
+			  GUnixFDList *fd_list,
+			  const gchar *type_string,
+			  guint timespan,
+			  UpDevice *device)
+{
+	GUnixFDList *out_fd_list = NULL;
+	UpHistory *history;
+	UpHistoryType type;
+	GError *error = NULL;
+	gint fd;
+	gint idx;
+
+	/* doesn't even try to support this */
+	if (!up_exported_device_get_has_history (skeleton)) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "device does not support getting history");
+		goto out;
+	}
+	history = up_device_get_history_store (device);
+	if (history == NULL) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "the display device only supports GetHistory and GetHistoryWithOptions");
+		goto out;
+	}
+
+	type = up_device_history_type_from_string (type_string);
+	fd = up_history_get_data_fd (history, type, timespan, &error);
+	if (fd < 0) {
+		g_dbus_method_invocation_return_error (invocation,
+						       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+						       "device has no history: %s", error->message);
+		g_error_free (error);
+		goto out;
+	}
+
+	/* the list keeps its own copy of the descriptor */
+	out_fd_list = g_unix_fd_list_new ();
+	idx = g_unix_fd_list_append (out_fd_list, fd, &error);
+	close (fd);
+	if (idx < 0) {
+		g_dbus_method_invocation_return_error (invocation,
+						       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+						       "failed to pass history: %s", error->message);
+		g_error_free (error);
+		goto out;
+	}
+
+	up_exported_device_complete_get_history_fd (skeleton, invocation,
+						    out_fd_list, g_variant_new_handle (idx));
+out:
+	g_clear_object (&out_fd_list);
+	return TRUE;
+}
+
+/**
+ * up_device_profile_clear:
+ **/
+static void
+up_device_profile_clear (UpDevice *device)
+{
+	if (device->priv->profile_watch_id != 0) {
+		g_bus_unwatch_name (device->priv->profile_watch_id);
+		device->priv->profile_watch_id = 0;
+	}
+	g_clear_pointer (&device->priv->profile_sender, g_free);
+	g_clear_object (&device->priv->profile);
+}
+
+/**
+ * up_device_profile_vanished_cb:
+ *
+ * Nobody is left to collect the samples.
+ **/
+static void
+up_device_profile_vanished_cb (GDBusConnection *connection,
+			       const gchar *name,
+			       UpDevice *device)
+{
+	g_debug ("%s left, dropping its profiling session", name);
+	up_device_profile_clear (device);
+}
+
+/**
+ * up_device_start_profiling:
+ **/
+static gboolean
+up_device_start_profiling (UpExportedDevice *skeleton,
+			   GDBusMethodInvocation *invocation,
+			   guint frequency,
+			   guint duration,
+			   UpDevice *device)
+{
+	UpDeviceClass *klass = UP_DEVICE_GET_CLASS (device);
+	GError *error = NULL;
+	const gchar *sender;
+
+	if (klass->setup_profile == NULL) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "device does not support profiling");
+		return TRUE;
+	}
+	if (frequency < UP_PROFILE_FREQUENCY_MIN || frequency > UP_PROFILE_FREQUENCY_MAX) {
+		g_dbus_method_invocation_return_error (invocation,
+						       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+						       "frequency must be between %i and %i Hz",
+						       UP_PROFILE_FREQUENCY_MIN, UP_PROFILE_FREQUENCY_MAX);
+		return TRUE;
+	}
+	if (duration == 0 || duration > UP_PROFILE_DURATION_MAX) {
+		g_dbus_method_invocation_return_error (invocation,
+						       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+						       "duration must be between 1 and %i seconds",
+						       UP_PROFILE_DURATION_MAX);
+		return TRUE;
+	}
+	if (device->priv->profile != NULL) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "a profiling session is already in progress");
+		return TRUE;
+	}
+
+	device->priv->profile = up_profile_new ();
+	if (!klass->setup_profile (device, device->priv->profile)) {
+		g_clear_object (&device->priv->profile);
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "device cannot be sampled");
+		return TRUE;
+	}
+	if (!up_profile_start (device->priv->profile, frequency, duration, &error)) {
+		g_clear_object (&device->priv->profile);
+		g_dbus_method_invocation_return_error (invocation,
+						       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+						       "failed to start profiling: %s", error->message);
+		g_error_free (error);
+		return TRUE;
+	}
+
+	/* the session belongs to the caller, and ends when it leaves the bus */
+	sender = g_dbus_method_invocation_get_sender (invocation);
+	if (sender != NULL) {
+		device->priv->profile_sender = g_strdup (sender);
+		device->priv->profile_watch_id =
+			g_bus_watch_name_on_connection (g_dbus_method_invocation_get_connection (invocation),
+							sender,
+							G_BUS_NAME_WATCHER_FLAGS_NONE,
+							NULL,
+							(GBusNameVanishedCallback) up_device_profile_vanished_cb,
+							device,
+							NULL);
+	}
+
+	up_exported_device_complete_start_profiling (skeleton, invocation);
+	return TRUE;
+}
+
+/**
+ * up_device_stop_profiling:
+ **/
+static gboolean
+up_device_stop_profiling (UpExportedDevice *skeleton,
+			  GDBusMethodInvocation *invocation,
+			  UpDevice *device)
+{
+	UpProfileStats stats;
+	GVariantBuilder builder;
+	GVariant *data;
+	GArray *samples;
+
+	if (device->priv->profile == NULL) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "no profiling session in progress");
+		return TRUE;
+	}
+	if (g_strcmp0 (device->priv->profile_sender,
+		       g_dbus_method_invocation_get_sender (invocation)) != 0) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "the profiling session was started by another caller");
+		return TRUE;
+	}
+
+	up_profile_stop (device->priv->profile);
+	up_profile_get_stats (device->priv->profile, &stats);
+	samples = up_profile_get_samples (device->priv->profile);
+	data = g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, samples->data,
+					  samples->len * sizeof (UpProfileSample), 1);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (&builder, "{sv}", "samples", g_variant_new_uint32 (stats.n_samples));
+	g_variant_builder_add (&builder, "{sv}", "dropped", g_variant_new_uint32 (stats.n_dropped));
+	g_variant_builder_add (&builder, "{sv}", "duration", g_variant_new_double (stats.duration));
+	g_variant_builder_add (&builder, "{sv}", "power-mean", g_variant_new_double (stats.power_mean));
+	g_variant_builder_add (&builder, "{sv}", "power-p50", g_variant_new_double (stats.power_p50));
+	g_variant_builder_add (&builder, "{sv}", "power-p99", g_variant_new_double (stats.power_p99));
+	g_variant_builder_add (&builder, "{sv}", "energy", g_variant_new_double (stats.energy));
+
+	up_exported_device_complete_stop_profiling (skeleton, invocation, data,
+						    g_variant_builder_end (&builder));
+	up_device_profile_clear (device);
 	return TRUE;
 }
 
@@ -645,6 +1276,8 @@ up_device_register_display_device (UpDevice *device,
 	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
 
 	device->priv->daemon = g_object_ref (daemon);
+	device->priv->is_display_device = TRUE;
+	up_exported_device_set_has_history (UP_EXPORTED_DEVICE (device), TRUE);
 	object_path = g_build_filename (UP_DEVICES_DBUS_PATH, "DisplayDevice", NULL);
 	up_device_export_skeleton (device, object_path);
 	g_free (object_path);
@@ -663,14 +1296,28 @@ gboolean
 up_device_refresh_internal (UpDevice *device)
 {
 	gboolean ret = FALSE;
+	gint64 start;
 	UpDeviceClass *klass = UP_DEVICE_GET_CLASS (device);
 
 	/* not implemented */
 	if (klass->refresh == NULL)
 		goto out;
 
+	/* counted per backend type */
+	if (device->priv->refresh_stats == NULL)
+		device->priv->refresh_stats = up_stats_get_counter ("refresh", G_OBJECT_TYPE_NAME (device));
+
 	/* do the refresh */
+	start = g_get_monotonic_time ();
+	UP_PROBE1 (device_refresh_start,
+		   up_exported_device_get_native_path (UP_EXPORTED_DEVICE (device)));
+	up_device_freeze (device);
 	ret = klass->refresh (device);
+	up_device_thaw (device);
+	up_stats_counter_add (device->priv->refresh_stats, start);
+	UP_PROBE3 (device_refresh_done,
+		   up_exported_device_get_native_path (UP_EXPORTED_DEVICE (device)),
+		   g_get_monotonic_time () - start, ret);
 	if (!ret) {
 		g_debug ("no changes");
 		goto out;
@@ -696,6 +1343,61 @@ up_device_get_object_path (UpDevice *device)
 	return g_dbus_interface_skeleton_get_object_path (G_DBUS_INTERFACE_SKELETON (device));
 }
 
+/**
+ * up_device_predict_time:
+ * @time_s: the time remaining worked out from the current rate, or 0
+ *
+ * Blends in what the history has learned about charging or discharging
+ * this battery, which is a lot steadier than the current rate. The more
+ * of the charge levels still to go the profile has seen, the more it
+ * counts.
+ *
+ * Return value: the time until empty when discharging, or until full when charging
+ **/
+gint64
+up_device_predict_time (UpDevice *device, UpDeviceState state, gdouble percentage, gint64 time_s)
+{
+	gdouble profile_time;
+	gdouble coverage;
+	gdouble weight;
+
+	g_return_val_if_fail (UP_IS_DEVICE (device), time_s);
+
+	if (!device->priv->predict_time)
+		return time_s;
+	if (state != UP_DEVICE_STATE_CHARGING &&
+	    state != UP_DEVICE_STATE_DISCHARGING)
+		return time_s;
+	if (!up_history_get_profile_time (device->priv->history,
+					  state == UP_DEVICE_STATE_CHARGING,
+					  percentage, &profile_time, &coverage))
+		return time_s;
+
+	/* no rate yet, only trust a profile that knows most of the way */
+	if (time_s <= 0)
+		return coverage >= 0.5f ? (gint64) profile_time : 0;
+
+	weight = UP_DEVICE_PROFILE_WEIGHT * coverage;
+	return (gint64) (weight * profile_time + (1.0f - weight) * time_s);
+}
+
+/**
+ * up_device_get_history_store:
+ *
+ * Return value: (transfer none): the history of the device, or %NULL for
+ * the display device, which has none of its own
+ **/
+UpHistory *
+up_device_get_history_store (UpDevice *device)
+{
+	g_return_val_if_fail (UP_IS_DEVICE (device), NULL);
+
+	/* only the merged history of the other devices makes sense */
+	if (device->priv->is_display_device)
+		return NULL;
+	return device->priv->history;
+}
+
 GObject *
 up_device_get_native (UpDevice *device)
 {
@@ -710,15 +1412,31 @@ static void
 up_device_init (UpDevice *device)
 {
 	UpExportedDevice *skeleton;
+	UpConfig *config;
 
 	device->priv = UP_DEVICE_GET_PRIVATE (device);
 	device->priv->history = up_history_new ();
 
+	config = up_config_new ();
+	device->priv->changed_interval = up_config_get_uint (config, "ChangedSignalsInterval");
+	device->priv->predict_time = up_config_get_boolean (config, "PredictTimeFromHistory");
+	g_object_unref (config);
+
 	skeleton = UP_EXPORTED_DEVICE (device);
 	up_exported_device_set_battery_level (skeleton, UP_DEVICE_LEVEL_NONE);
 
 	g_signal_connect (device, "handle-get-history",
 			  G_CALLBACK (up_device_get_history), device);
+	g_signal_connect (device, "handle-get-history-with-options",
+			  G_CALLBACK (up_device_get_history_with_options), device);
+	g_signal_connect (device, "handle-get-history-series",
+			  G_CALLBACK (up_device_get_history_series), device);
+	g_signal_connect (device, "handle-get-history-fd",
+			  G_CALLBACK (up_device_get_history_fd), device);
+	g_signal_connect (device, "handle-start-profiling",
+			  G_CALLBACK (up_device_start_profiling), device);
+	g_signal_connect (device, "handle-stop-profiling",
+			  G_CALLBACK (up_device_stop_profiling), device);
 	g_signal_connect (device, "handle-get-statistics",
 			  G_CALLBACK (up_device_get_statistics), device);
 	g_signal_connect (device, "handle-refresh",
@@ -738,8 +1456,11 @@ up_device_finalize (GObject *object)
 
 	device = UP_DEVICE (object);
 	g_return_if_fail (device->priv != NULL);
+	if (device->priv->changed_timeout_id != 0)
+		g_source_remove (device->priv->changed_timeout_id);
 	g_clear_object (&device->priv->native);
 	g_clear_object (&device->priv->daemon);
+	up_device_profile_clear (device);
 	g_object_unref (device->priv->history);
 
 	G_OBJECT_CLASS (up_device_parent_class)->finalize (object);
@@ -755,6 +1476,13 @@ up_device_class_init (UpDeviceClass *klass)
 	object_class->notify = up_device_notify;
 	object_class->finalize = up_device_finalize;
 
+	/* emitted once per property change, or once per transaction */
+	signals [SIGNAL_CHANGED] =
+		g_signal_new ("changed",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, NULL,
+			      G_TYPE_NONE, 0);
+
 	g_type_class_add_private (klass, sizeof (UpDevicePrivate));
 }
 
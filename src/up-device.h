@@ -24,6 +24,8 @@
 
 #include <dbus/up-device-generated.h>
 #include "up-daemon.h"
+#include "up-history.h"
+#include "up-profile.h"
 
 G_BEGIN_DECLS
 
@@ -54,6 +56,8 @@ typedef struct
 						 gboolean	*on_battery);
 	gboolean	 (*get_online)		(UpDevice	*device,
 						 gboolean	*online);
+	gboolean	 (*setup_profile)	(UpDevice	*device,
+						 UpProfile	*profile);
 } UpDeviceClass;
 
 GType		 up_device_get_type		(void);
@@ -67,12 +71,20 @@ gboolean	 up_device_register_display_device (UpDevice	*device,
 						    UpDaemon	*daemon);
 UpDaemon	*up_device_get_daemon		(UpDevice	*device);
 GObject		*up_device_get_native		(UpDevice	*device);
+UpHistory	*up_device_get_history_store	(UpDevice	*device);
+gint64		 up_device_predict_time		(UpDevice	*device,
+						 UpDeviceState	 state,
+						 gdouble	 percentage,
+						 gint64		 time_s);
 const gchar	*up_device_get_object_path	(UpDevice	*device);
 gboolean	 up_device_get_on_battery	(UpDevice	*device,
 						 gboolean	*on_battery);
 gboolean	 up_device_get_online		(UpDevice	*device,
 						 gboolean	*online);
 gboolean	 up_device_refresh_internal	(UpDevice	*device);
+void		 up_device_freeze		(UpDevice	*device);
+void		 up_device_thaw			(UpDevice	*device);
+GVariant	*up_device_history_items_to_variant (GPtrArray	*array);
 
 G_END_DECLS
 
@@ -23,21 +23,50 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 #include <glib/gi18n.h>
+#include <glib-unix.h>
 #include <gio/gio.h>
 
 #include "up-history.h"
+#include "up-probes.h"
+#include "up-stats.h"
 #include "up-stats-item.h"
 #include "up-history-item.h"
 
 static void	up_history_finalize	(GObject		*object);
+static GPtrArray *up_history_get_array (UpHistory *history, UpHistoryType type);
 
 #define UP_HISTORY_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), UP_TYPE_HISTORY, UpHistoryPrivate))
 
 #define UP_HISTORY_FILE_HEADER		"PackageKit Profile"
 #define UP_HISTORY_SAVE_INTERVAL	(10*60)		/* seconds */
 #define UP_HISTORY_DEFAULT_MAX_DATA_AGE	(7*24*60*60)	/* seconds */
+#define UP_HISTORY_STREAM_CHUNK		256		/* records */
+#define UP_HISTORY_PROFILE_BINS		101		/* one per percent */
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL			0
+#endif
+
+/*
+ * The time spent in each percentage bin while charging or discharging,
+ * kept up to date as charge data comes in. The cumulative table is only
+ * rebuilt when something changed, so lookups are constant time.
+ */
+typedef struct {
+	gdouble			 time[UP_HISTORY_PROFILE_BINS];		/* s, summed */
+	guint			 count[UP_HISTORY_PROFILE_BINS];
+	gdouble			 cumulative[UP_HISTORY_PROFILE_BINS + 1];	/* s */
+	guint			 known[UP_HISTORY_PROFILE_BINS + 1];
+	gboolean		 dirty;
+} UpHistoryProfile;
 
 struct UpHistoryPrivate
 {
@@ -54,6 +83,13 @@ struct UpHistoryPrivate
 	guint			 save_id;
 	guint			 max_data_age;
 	gchar			*dir;
+	UpHistoryProfile	 profiles[2];	/* discharging, charging */
+	UpDeviceState		 profile_state;
+	gboolean		 profile_has_state;
+	guint			 profile_bin;
+	guint			 profile_old_time;
+	gdouble			 profile_old_value;
+	gboolean		 profile_has_old;
 };
 
 enum {
@@ -61,6 +97,18 @@ enum {
 	UP_HISTORY_LAST_SIGNAL
 };
 
+typedef struct {
+	UpHistory		*history;
+	GPtrArray		*array;
+	guint			 idx;
+	guint			 end;
+	guint			 cutoff;
+	gint			 fd;
+	UpHistorySample		 buffer[UP_HISTORY_STREAM_CHUNK];
+	gsize			 buffer_len;	/* bytes */
+	gsize			 buffer_off;	/* bytes */
+} UpHistoryStream;
+
 G_DEFINE_TYPE (UpHistory, up_history, G_TYPE_OBJECT)
 
 /**
@@ -250,14 +298,7 @@ up_history_get_data (UpHistory *history, UpHistoryType type, guint timespan, gui
 	if (history->priv->id == NULL)
 		return NULL;
 
-	if (type == UP_HISTORY_TYPE_CHARGE)
-		array_data = history->priv->data_charge;
-	else if (type == UP_HISTORY_TYPE_RATE)
-		array_data = history->priv->data_rate;
-	else if (type == UP_HISTORY_TYPE_TIME_FULL)
-		array_data = history->priv->data_time_full;
-	else if (type == UP_HISTORY_TYPE_TIME_EMPTY)
-		array_data = history->priv->data_time_empty;
+	array_data = up_history_get_array (history, type);
 
 	/* not recognised */
 	if (array_data == NULL)
@@ -276,116 +317,915 @@ up_history_get_data (UpHistory *history, UpHistoryType type, guint timespan, gui
 }
 
 /**
- * up_history_get_profile_data:
+ * up_history_get_array:
  **/
-GPtrArray *
-up_history_get_profile_data (UpHistory *history, gboolean charging)
+static GPtrArray *
+up_history_get_array (UpHistory *history, UpHistoryType type)
+{
+	if (type == UP_HISTORY_TYPE_CHARGE)
+		return history->priv->data_charge;
+	if (type == UP_HISTORY_TYPE_RATE)
+		return history->priv->data_rate;
+	if (type == UP_HISTORY_TYPE_TIME_FULL)
+		return history->priv->data_time_full;
+	if (type == UP_HISTORY_TYPE_TIME_EMPTY)
+		return history->priv->data_time_empty;
+	return NULL;
+}
+
+/**
+ * up_history_stream_free:
+ **/
+static void
+up_history_stream_free (UpHistoryStream *stream)
+{
+	close (stream->fd);
+	g_ptr_array_unref (stream->array);
+	g_object_unref (stream->history);
+	g_free (stream);
+}
+
+/**
+ * up_history_stream_fill:
+ *
+ * Packs the next chunk of records into the stream buffer.
+ **/
+static void
+up_history_stream_fill (UpHistoryStream *stream)
 {
-	guint i;
-	guint non_zero_accuracy = 0;
-	gfloat average = 0.0f;
-	guint bin;
-	guint oldbin = 999;
-	UpHistoryItem *item_last = NULL;
 	UpHistoryItem *item;
-	UpHistoryItem *item_old = NULL;
-	UpStatsItem *stats;
+	UpHistorySample *record;
+	guint n = 0;
+
+	while (stream->idx < stream->end && n < UP_HISTORY_STREAM_CHUNK) {
+		item = (UpHistoryItem *) g_ptr_array_index (stream->array, stream->idx++);
+		if (up_history_item_get_time (item) < stream->cutoff)
+			continue;
+		record = &stream->buffer[n++];
+		record->time = up_history_item_get_time (item);
+		record->state = up_history_item_get_state (item);
+		record->value = up_history_item_get_value (item);
+	}
+	stream->buffer_len = n * sizeof (UpHistorySample);
+	stream->buffer_off = 0;
+}
+
+/**
+ * up_history_stream_write_cb:
+ **/
+static gboolean
+up_history_stream_write_cb (gint fd, GIOCondition condition, UpHistoryStream *stream)
+{
+	gssize len;
+
+	/* the reader went away */
+	if (condition & (G_IO_ERR | G_IO_HUP))
+		goto out;
+
+	while (TRUE) {
+		if (stream->buffer_off == stream->buffer_len) {
+			up_history_stream_fill (stream);
+			if (stream->buffer_len == 0)
+				goto out;
+		}
+		len = send (fd,
+			    (const gchar *) stream->buffer + stream->buffer_off,
+			    stream->buffer_len - stream->buffer_off,
+			    MSG_NOSIGNAL);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return G_SOURCE_CONTINUE;
+			g_debug ("failed to stream history: %s", g_strerror (errno));
+			goto out;
+		}
+		stream->buffer_off += len;
+	}
+out:
+	up_history_stream_free (stream);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * up_history_get_data_fd:
+ *
+ * Returns the reading end of a socket the raw records for @type are
+ * streamed into from the main loop, oldest first, without building a
+ * copy of the data. Each record is a #UpHistorySample in host byte
+ * order. The caller owns the returned descriptor.
+ **/
+gint
+up_history_get_data_fd (UpHistory *history, UpHistoryType type, guint timespan, GError **error)
+{
 	GPtrArray *array;
-	GPtrArray *data;
-	guint time_s;
-	gdouble value;
-	gdouble total_value = 0.0f;
+	UpHistoryStream *stream;
+	GTimeVal timeval;
+	gint fds[2];
+	guint id;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), -1);
+
+	array = up_history_get_array (history, type);
+	if (history->priv->id == NULL || array == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+				     "no history");
+		return -1;
+	}
+
+	if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+			     "failed to create socket: %s", g_strerror (errno));
+		return -1;
+	}
+	fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl (fds[1], F_SETFD, FD_CLOEXEC);
+	shutdown (fds[0], SHUT_WR);
+	shutdown (fds[1], SHUT_RD);
+	if (!g_unix_set_fd_nonblocking (fds[1], TRUE, error)) {
+		close (fds[0]);
+		close (fds[1]);
+		return -1;
+	}
+
+	/* items are only ever appended, so stop at the current end */
+	stream = g_new0 (UpHistoryStream, 1);
+	stream->history = g_object_ref (history);
+	stream->array = g_ptr_array_ref (array);
+	stream->end = array->len;
+	stream->fd = fds[1];
+	if (timespan > 0) {
+		g_get_current_time (&timeval);
+		if (timeval.tv_sec > timespan)
+			stream->cutoff = timeval.tv_sec - timespan;
+	}
+
+	id = g_unix_fd_add (fds[1], G_IO_OUT,
+			    (GUnixFDSourceFunc) up_history_stream_write_cb, stream);
+	g_source_set_name_by_id (id, "[upower] up_history_stream_write_cb");
+
+	return fds[0];
+}
+
+/**
+ * up_history_find_first:
+ *
+ * Returns the index of the first item no older than @cutoff, relying on
+ * items being appended in time order.
+ **/
+static guint
+up_history_find_first (GPtrArray *array, guint cutoff)
+{
+	UpHistoryItem *item;
+	guint lo = 0;
+	guint hi = array->len;
+	guint mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		item = (UpHistoryItem *) g_ptr_array_index (array, mid);
+		if (up_history_item_get_time (item) < cutoff)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * up_history_get_data_series:
+ * @types: the series to return, at most %UP_HISTORY_TYPE_UNKNOWN
+ *
+ * Returns @resolution or fewer #UpHistorySeriesPoint's sharing one time
+ * axis, computed in a single pass over all of the series. Each value is
+ * the average of the samples in the bucket, or the previous value of
+ * the series if it has no sample there, or NaN if it has none yet.
+ **/
+GArray *
+up_history_get_data_series (UpHistory *history, const UpHistoryType *types, guint n_types, guint timespan, guint resolution)
+{
+	GPtrArray *arrays[UP_HISTORY_TYPE_UNKNOWN];
+	guint idx[UP_HISTORY_TYPE_UNKNOWN];
+	gdouble sum[UP_HISTORY_TYPE_UNKNOWN];
+	guint count[UP_HISTORY_TYPE_UNKNOWN];
+	gdouble last[UP_HISTORY_TYPE_UNKNOWN];
+	UpHistorySeriesPoint point;
+	UpHistoryItem *item;
+	GTimeVal timeval;
+	GArray *data;
+	guint cutoff = 0;
+	guint first = G_MAXUINT;
+	guint end = 0;
+	guint n = 0;
+	guint newest;
+	guint bucket;
+	guint time_count;
+	guint64 time_sum;
+	gdouble width;
+	gdouble bucket_end;
+	guint i;
 
 	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
+	g_return_val_if_fail (n_types > 0 && n_types <= UP_HISTORY_TYPE_UNKNOWN, NULL);
 
-	/* create 100 item list and set to zero */
-	data = g_ptr_array_new_full (101, g_object_unref);
-	for (i=0; i<101; i++) {
-		stats = up_stats_item_new ();
-		g_ptr_array_add (data, stats);
+	if (history->priv->id == NULL)
+		return NULL;
+
+	for (i = 0; i < n_types; i++) {
+		arrays[i] = up_history_get_array (history, types[i]);
+		if (arrays[i] == NULL)
+			return NULL;
 	}
 
-	array = history->priv->data_charge;
-	for (i=0; i<array->len; i++) {
-		item = (UpHistoryItem *) g_ptr_array_index (array, i);
-		if (item_last == NULL ||
-		    up_history_item_get_state (item) != up_history_item_get_state (item_last)) {
-			item_old = NULL;
-			goto cont;
-		}
+	/* only return a certain time */
+	if (timespan > 0) {
+		g_get_current_time (&timeval);
+		if (timeval.tv_sec > timespan)
+			cutoff = timeval.tv_sec - timespan;
+	}
 
-		/* round to the nearest int */
-		bin = rint (up_history_item_get_value (item));
-
-		/* ensure bin is in range */
-		if (bin >= data->len)
-			bin = data->len - 1;
-
-		/* different */
-		if (oldbin != bin) {
-			oldbin = bin;
-			if (item_old != NULL) {
-				/* not enough or too much difference */
-				value = fabs (up_history_item_get_value (item) - up_history_item_get_value (item_old));
-				if (value < 0.01f) {
-					item_old = NULL;
-					goto cont;
-				}
-				if (value > 3.0f) {
-					item_old = NULL;
-					goto cont;
+	/* find the common range */
+	for (i = 0; i < n_types; i++) {
+		idx[i] = up_history_find_first (arrays[i], cutoff);
+		last[i] = NAN;
+		if (idx[i] == arrays[i]->len)
+			continue;
+		n += arrays[i]->len - idx[i];
+		item = (UpHistoryItem *) g_ptr_array_index (arrays[i], idx[i]);
+		first = MIN (first, up_history_item_get_time (item));
+		item = (UpHistoryItem *) g_ptr_array_index (arrays[i], arrays[i]->len - 1);
+		end = MAX (end, up_history_item_get_time (item));
+	}
+
+	data = g_array_new (FALSE, TRUE, sizeof (UpHistorySeriesPoint));
+	if (first == G_MAXUINT)
+		return data;
+	/* there can't be more points than samples */
+	if (resolution == 0 || resolution > n)
+		resolution = n;
+	width = (end - first) / (gdouble) resolution;
+
+	/* walk all the series together, one bucket at a time */
+	for (bucket = 1; bucket <= resolution; bucket++) {
+		bucket_end = first + width * bucket;
+		time_sum = 0;
+		time_count = 0;
+		newest = 0;
+		memset (&point, 0, sizeof (point));
+
+		for (i = 0; i < n_types; i++) {
+			sum[i] = 0;
+			count[i] = 0;
+			for (; idx[i] < arrays[i]->len; idx[i]++) {
+				item = (UpHistoryItem *) g_ptr_array_index (arrays[i], idx[i]);
+				if (bucket < resolution &&
+				    up_history_item_get_time (item) >= bucket_end)
+					break;
+				sum[i] += up_history_item_get_value (item);
+				count[i]++;
+				time_sum += up_history_item_get_time (item);
+				time_count++;
+				if (up_history_item_get_time (item) >= newest) {
+					newest = up_history_item_get_time (item);
+					point.state = up_history_item_get_state (item);
 				}
+			}
+		}
+
+		/* nothing happened in this bucket */
+		if (time_count == 0)
+			continue;
+
+		point.time = time_sum / time_count;
+		for (i = 0; i < n_types; i++) {
+			if (count[i] > 0)
+				last[i] = sum[i] / count[i];
+			point.values[i] = last[i];
+		}
+		g_array_append_val (data, point);
+	}
+
+	return data;
+}
+
+/**
+ * up_history_reducer_from_string:
+ **/
+UpHistoryReducer
+up_history_reducer_from_string (const gchar *reducer)
+{
+	if (g_strcmp0 (reducer, "avg") == 0)
+		return UP_HISTORY_REDUCER_AVERAGE;
+	if (g_strcmp0 (reducer, "min") == 0)
+		return UP_HISTORY_REDUCER_MIN;
+	if (g_strcmp0 (reducer, "max") == 0)
+		return UP_HISTORY_REDUCER_MAX;
+	if (g_strcmp0 (reducer, "last") == 0)
+		return UP_HISTORY_REDUCER_LAST;
+	if (g_strcmp0 (reducer, "lttb") == 0)
+		return UP_HISTORY_REDUCER_LTTB;
+	return UP_HISTORY_REDUCER_UNKNOWN;
+}
+
+/* the reducers run over either flat samples or the stored items */
+typedef struct {
+	const UpHistorySample	*samples;
+	UpHistoryItem		**items;
+} UpHistoryInput;
+
+/**
+ * up_history_input_get:
+ **/
+static inline void
+up_history_input_get (const UpHistoryInput *in, guint i, UpHistorySample *sample)
+{
+	UpHistoryItem *item;
+
+	if (in->samples != NULL) {
+		*sample = in->samples[i];
+		return;
+	}
+	item = in->items[i];
+	sample->time = up_history_item_get_time (item);
+	sample->state = up_history_item_get_state (item);
+	sample->value = up_history_item_get_value (item);
+}
 
-				time_s = up_history_item_get_time (item) - up_history_item_get_time (item_old);
-				/* use the accuracy field as a counter for now */
-				if ((charging && up_history_item_get_state (item) == UP_DEVICE_STATE_CHARGING) ||
-				    (!charging && up_history_item_get_state (item) == UP_DEVICE_STATE_DISCHARGING)) {
-					stats = (UpStatsItem *) g_ptr_array_index (data, bin);
-					up_stats_item_set_value (stats, up_stats_item_get_value (stats) + time_s);
-					up_stats_item_set_accuracy (stats, up_stats_item_get_accuracy (stats) + 1);
+/**
+ * up_history_reduce_buckets:
+ *
+ * Splits the samples into @max_out buckets of equal duration and
+ * outputs one sample for each bucket that is not empty.
+ **/
+static guint
+up_history_reduce_buckets (const UpHistoryInput *in, guint n_in,
+			   UpHistoryReducer reducer,
+			   UpHistorySample *out, guint max_out)
+{
+	UpHistorySample first;
+	UpHistorySample last;
+	UpHistorySample sample;
+	UpHistorySample pick;
+	gdouble width;
+	gdouble bucket_end;
+	gdouble value_sum = 0;
+	guint64 time_sum = 0;
+	guint count = 0;
+	guint bucket = 1;
+	guint n_out = 0;
+	guint i;
+
+	up_history_input_get (in, 0, &first);
+	up_history_input_get (in, n_in - 1, &last);
+	pick = first;
+	width = (last.time - first.time) / (gdouble) max_out;
+	bucket_end = first.time + width;
+
+	for (i = 0; i <= n_in; i++) {
+		if (i < n_in)
+			up_history_input_get (in, i, &sample);
+
+		/* flush the bucket when leaving it, and at the end */
+		if (i == n_in || (bucket < max_out && sample.time >= bucket_end)) {
+			if (count > 0) {
+				out[n_out] = pick;
+				if (reducer == UP_HISTORY_REDUCER_AVERAGE) {
+					out[n_out].time = time_sum / count;
+					out[n_out].value = value_sum / count;
 				}
+				n_out++;
 			}
-			item_old = item;
+			if (i == n_in)
+				break;
+			count = 0;
+			time_sum = 0;
+			value_sum = 0;
+			do {
+				bucket++;
+				bucket_end = first.time + width * bucket;
+			} while (bucket < max_out && sample.time >= bucket_end);
+		}
+
+		count++;
+		switch (reducer) {
+		case UP_HISTORY_REDUCER_MIN:
+			if (count == 1 || sample.value < pick.value)
+				pick = sample;
+			break;
+		case UP_HISTORY_REDUCER_MAX:
+			if (count == 1 || sample.value > pick.value)
+				pick = sample;
+			break;
+		case UP_HISTORY_REDUCER_AVERAGE:
+			time_sum += sample.time;
+			value_sum += sample.value;
+			/* fall through, the state is the last one */
+		default:
+			pick = sample;
+			break;
 		}
-cont:
-		item_last = item;
 	}
+	return n_out;
+}
 
-	/* divide the value by the number of samples to make the average */
-	for (i=0; i<101; i++) {
-		stats = (UpStatsItem *) g_ptr_array_index (data, i);
-		if (up_stats_item_get_accuracy (stats) != 0)
-			up_stats_item_set_value (stats, up_stats_item_get_value (stats) / up_stats_item_get_accuracy (stats));
+/**
+ * up_history_reduce_lttb:
+ *
+ * Largest-Triangle-Three-Buckets: keeps the first and last samples, and
+ * from each bucket in between the one forming the largest triangle with
+ * the previously kept sample and the average of the next bucket, which
+ * preserves the visual shape of the data.
+ **/
+static guint
+up_history_reduce_lttb (const UpHistoryInput *in, guint n_in,
+			UpHistorySample *out, guint max_out)
+{
+	UpHistorySample prev;
+	UpHistorySample last;
+	UpHistorySample sample;
+	UpHistorySample pick;
+	gdouble every;
+	gdouble avg_time;
+	gdouble avg_value;
+	gdouble area;
+	gdouble max_area;
+	guint avg_start;
+	guint avg_end;
+	guint range_start;
+	guint range_end;
+	guint n_out = 0;
+	guint i, j;
+
+	up_history_input_get (in, 0, &prev);
+	up_history_input_get (in, n_in - 1, &last);
+	if (max_out < 3) {
+		out[n_out++] = prev;
+		if (max_out == 2)
+			out[n_out++] = last;
+		return n_out;
 	}
 
-	/* find non-zero accuracy values for the average */
-	for (i=0; i<101; i++) {
-		stats = (UpStatsItem *) g_ptr_array_index (data, i);
-		if (up_stats_item_get_accuracy (stats) > 0) {
-			total_value += up_stats_item_get_value (stats);
-			non_zero_accuracy++;
+	every = (gdouble) (n_in - 2) / (max_out - 2);
+	out[n_out++] = prev;
+	for (i = 0; i < max_out - 2; i++) {
+		/* average of the next bucket */
+		avg_start = (guint) ((i + 1) * every) + 1;
+		avg_end = MIN ((guint) ((i + 2) * every) + 1, n_in);
+		avg_time = 0;
+		avg_value = 0;
+		for (j = avg_start; j < avg_end; j++) {
+			up_history_input_get (in, j, &sample);
+			avg_time += sample.time;
+			avg_value += sample.value;
 		}
+		if (avg_end > avg_start) {
+			avg_time /= avg_end - avg_start;
+			avg_value /= avg_end - avg_start;
+		} else {
+			avg_time = last.time;
+			avg_value = last.value;
+		}
+
+		/* the point of this bucket with the largest triangle */
+		range_start = (guint) (i * every) + 1;
+		range_end = MIN ((guint) ((i + 1) * every) + 1, n_in - 1);
+		up_history_input_get (in, range_start, &pick);
+		max_area = -1;
+		for (j = range_start; j < range_end; j++) {
+			up_history_input_get (in, j, &sample);
+			area = fabs (((gdouble) prev.time - avg_time) * (sample.value - prev.value) -
+				     ((gdouble) prev.time - sample.time) * (avg_value - prev.value));
+			if (area > max_area) {
+				max_area = area;
+				pick = sample;
+			}
+		}
+		out[n_out++] = pick;
+		prev = pick;
 	}
+	out[n_out++] = last;
+	return n_out;
+}
 
-	/* average */
-	if (non_zero_accuracy != 0)
-		average = total_value / non_zero_accuracy;
-	g_debug ("average is %f", average);
+/**
+ * up_history_reduce_input:
+ **/
+static guint
+up_history_reduce_input (const UpHistoryInput *in, guint n_in,
+			 UpHistoryReducer reducer,
+			 UpHistorySample *out, guint max_out)
+{
+	guint i;
 
-	/* make the values a factor of 0, so that 1.0 is twice the
-	 * average, and -1.0 is half the average */
-	for (i=0; i<101; i++) {
-		stats = (UpStatsItem *) g_ptr_array_index (data, i);
-		if (up_stats_item_get_accuracy (stats) > 0)
-			up_stats_item_set_value (stats, (up_stats_item_get_value (stats) - average) / average);
+	if (n_in == 0 || max_out == 0)
+		return 0;
+	if (n_in <= max_out) {
+		for (i = 0; i < n_in; i++)
+			up_history_input_get (in, i, &out[i]);
+		return n_in;
+	}
+	if (reducer == UP_HISTORY_REDUCER_LTTB)
+		return up_history_reduce_lttb (in, n_in, out, max_out);
+	return up_history_reduce_buckets (in, n_in, reducer, out, max_out);
+}
+
+/**
+ * up_history_reduce:
+ * @in: samples, oldest first
+ * @out: room for at least @max_out samples
+ *
+ * Reduces @in to at most @max_out samples without allocating.
+ *
+ * Return value: the number of samples written to @out
+ **/
+guint
+up_history_reduce (const UpHistorySample *in, guint n_in,
+		   UpHistoryReducer reducer,
+		   UpHistorySample *out, guint max_out)
+{
+	UpHistoryInput input = { in, NULL };
+
+	if (n_in <= max_out) {
+		memcpy (out, in, n_in * sizeof (UpHistorySample));
+		return n_in;
+	}
+	return up_history_reduce_input (&input, n_in, reducer, out, max_out);
+}
+
+/**
+ * up_history_get_data_reduced:
+ *
+ * Like up_history_get_data() but oldest first, with a choice of how the
+ * samples are reduced to @resolution points, or all of them if zero.
+ * The reducers read the stored items directly, so only the result is
+ * allocated.
+ **/
+GArray *
+up_history_get_data_reduced (UpHistory *history, UpHistoryType type, guint timespan, guint resolution, UpHistoryReducer reducer)
+{
+	GPtrArray *array;
+	GArray *data;
+	GTimeVal timeval;
+	UpHistoryInput input = { NULL, NULL };
+	guint cutoff = 0;
+	guint first;
+	guint n;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
+
+	if (history->priv->id == NULL)
+		return NULL;
+	array = up_history_get_array (history, type);
+	if (array == NULL)
+		return NULL;
+
+	/* only return a certain time */
+	if (timespan > 0) {
+		g_get_current_time (&timeval);
+		if (timeval.tv_sec > timespan)
+			cutoff = timeval.tv_sec - timespan;
+	}
+	first = up_history_find_first (array, cutoff);
+	n = array->len - first;
+	input.items = (UpHistoryItem **) array->pdata + first;
+
+	if (resolution == 0 || resolution > n)
+		resolution = n;
+	data = g_array_sized_new (FALSE, FALSE, sizeof (UpHistorySample), resolution);
+	g_array_set_size (data, resolution);
+	g_array_set_size (data, up_history_reduce_input (&input, n, reducer,
+							 (UpHistorySample *) data->data, resolution));
+
+	return data;
+}
+
+/**
+ * up_history_get_data_merged:
+ * @histories: the histories of the devices to combine
+ * @weights: the weight of each device, e.g. its full energy
+ *
+ * Combines one type of data of several devices onto a single time axis
+ * with a k-way merge over the stored samples, without copying them.
+ * Charge is averaged using @weights, other types are summed, and the
+ * state is charging if any device charges, else discharging if any
+ * device discharges. Samples with an unknown state mark gaps in the
+ * data of a device, which is left out until it has data again.
+ *
+ * Return value: a #GArray of #UpHistorySample, oldest first, or %NULL
+ **/
+GArray *
+up_history_get_data_merged (UpHistory **histories, const gdouble *weights, guint n_histories, UpHistoryType type, guint timespan)
+{
+	GPtrArray **arrays;
+	guint *idx;
+	UpHistorySample *heads;
+	UpHistorySample sample;
+	UpHistoryItem *item;
+	GTimeVal timeval;
+	GArray *data = NULL;
+	gdouble weight_total;
+	gdouble value_total;
+	guint cutoff = 0;
+	guint next;
+	guint i;
+
+	arrays = g_new0 (GPtrArray *, n_histories);
+	idx = g_new0 (guint, n_histories);
+	heads = g_new0 (UpHistorySample, n_histories);
+
+	if (timespan > 0) {
+		g_get_current_time (&timeval);
+		if (timeval.tv_sec > timespan)
+			cutoff = timeval.tv_sec - timespan;
+	}
+	for (i = 0; i < n_histories; i++) {
+		if (histories[i]->priv->id == NULL)
+			continue;
+		arrays[i] = up_history_get_array (histories[i], type);
+		if (arrays[i] == NULL)
+			goto out;
+		idx[i] = up_history_find_first (arrays[i], cutoff);
+	}
+
+	data = g_array_new (FALSE, FALSE, sizeof (UpHistorySample));
+	while (TRUE) {
+		/* find the oldest sample at the head of any series */
+		next = G_MAXUINT;
+		for (i = 0; i < n_histories; i++) {
+			if (arrays[i] == NULL || idx[i] == arrays[i]->len)
+				continue;
+			item = (UpHistoryItem *) g_ptr_array_index (arrays[i], idx[i]);
+			if (next == G_MAXUINT || up_history_item_get_time (item) < sample.time) {
+				next = i;
+				sample.time = up_history_item_get_time (item);
+			}
+		}
+		if (next == G_MAXUINT)
+			break;
+
+		/* take every sample at that time */
+		for (i = 0; i < n_histories; i++) {
+			while (arrays[i] != NULL && idx[i] < arrays[i]->len) {
+				item = (UpHistoryItem *) g_ptr_array_index (arrays[i], idx[i]);
+				if (up_history_item_get_time (item) != sample.time)
+					break;
+				heads[i].state = up_history_item_get_state (item);
+				heads[i].value = up_history_item_get_value (item);
+				idx[i]++;
+			}
+		}
+
+		/* combine the current value of every device */
+		sample.state = UP_DEVICE_STATE_UNKNOWN;
+		weight_total = 0;
+		value_total = 0;
+		for (i = 0; i < n_histories; i++) {
+			if (heads[i].state == UP_DEVICE_STATE_UNKNOWN)
+				continue;
+			if (heads[i].state == UP_DEVICE_STATE_CHARGING)
+				sample.state = UP_DEVICE_STATE_CHARGING;
+			else if (heads[i].state == UP_DEVICE_STATE_DISCHARGING &&
+				 sample.state != UP_DEVICE_STATE_CHARGING)
+				sample.state = UP_DEVICE_STATE_DISCHARGING;
+			else if (sample.state == UP_DEVICE_STATE_UNKNOWN)
+				sample.state = heads[i].state;
+
+			if (type == UP_HISTORY_TYPE_CHARGE) {
+				value_total += heads[i].value * weights[i];
+				weight_total += weights[i];
+			} else {
+				value_total += heads[i].value;
+			}
+		}
+		if (sample.state == UP_DEVICE_STATE_UNKNOWN)
+			continue;
+		if (type == UP_HISTORY_TYPE_CHARGE) {
+			if (weight_total <= 0)
+				continue;
+			value_total /= weight_total;
+		}
+		sample.value = value_total;
+		g_array_append_val (data, sample);
+	}
+out:
+	g_free (arrays);
+	g_free (idx);
+	g_free (heads);
+	return data;
+}
+
+/**
+ * up_history_profile_add:
+ *
+ * Accounts for a new charge item, in the order they were recorded.
+ **/
+static void
+up_history_profile_add (UpHistory *history, UpHistoryItem *item)
+{
+	UpHistoryPrivate *priv = history->priv;
+	UpHistoryProfile *profile;
+	UpDeviceState state;
+	gdouble value;
+	guint bin;
+
+	state = up_history_item_get_state (item);
+	if (!priv->profile_has_state || state != priv->profile_state) {
+		priv->profile_has_old = FALSE;
+		goto out;
+	}
+
+	/* round to the nearest int */
+	bin = rint (up_history_item_get_value (item));
+
+	/* ensure bin is in range */
+	if (bin >= UP_HISTORY_PROFILE_BINS)
+		bin = UP_HISTORY_PROFILE_BINS - 1;
+
+	/* same */
+	if (priv->profile_bin == bin)
+		goto out;
+	priv->profile_bin = bin;
+
+	if (priv->profile_has_old) {
+		/* not enough or too much difference */
+		value = fabs (up_history_item_get_value (item) - priv->profile_old_value);
+		if (value < 0.01f || value > 3.0f) {
+			priv->profile_has_old = FALSE;
+			goto out;
+		}
+
+		profile = NULL;
+		if (state == UP_DEVICE_STATE_DISCHARGING)
+			profile = &priv->profiles[0];
+		else if (state == UP_DEVICE_STATE_CHARGING)
+			profile = &priv->profiles[1];
+		if (profile != NULL) {
+			profile->time[bin] += (guint) (up_history_item_get_time (item) - priv->profile_old_time);
+			profile->count[bin]++;
+			profile->dirty = TRUE;
+		}
+	}
+	priv->profile_old_time = up_history_item_get_time (item);
+	priv->profile_old_value = up_history_item_get_value (item);
+	priv->profile_has_old = TRUE;
+out:
+	priv->profile_state = state;
+	priv->profile_has_state = TRUE;
+}
+
+/**
+ * up_history_profile_get_average:
+ *
+ * Return value: the average time per bin over the bins with data, or 0
+ **/
+static gdouble
+up_history_profile_get_average (UpHistoryProfile *profile)
+{
+	gdouble total = 0.0f;
+	guint non_zero = 0;
+	guint i;
+
+	for (i = 0; i < UP_HISTORY_PROFILE_BINS; i++) {
+		if (profile->count[i] == 0)
+			continue;
+		total += profile->time[i] / profile->count[i];
+		non_zero++;
+	}
+	if (non_zero == 0)
+		return 0.0f;
+	return total / non_zero;
+}
+
+/**
+ * up_history_profile_refresh:
+ *
+ * Rebuilds the cumulative tables, using the average for the bins that
+ * have not been seen yet.
+ **/
+static void
+up_history_profile_refresh (UpHistoryProfile *profile)
+{
+	gdouble average;
+	gdouble time_s;
+	guint i;
+
+	if (!profile->dirty)
+		return;
+
+	average = up_history_profile_get_average (profile);
+	profile->cumulative[0] = 0.0f;
+	profile->known[0] = 0;
+	for (i = 0; i < UP_HISTORY_PROFILE_BINS; i++) {
+		if (profile->count[i] > 0)
+			time_s = profile->time[i] / profile->count[i];
 		else
-			up_stats_item_set_value (stats, 0.0f);
+			time_s = average;
+		profile->cumulative[i + 1] = profile->cumulative[i] + time_s;
+		profile->known[i + 1] = profile->known[i] + (profile->count[i] > 0 ? 1 : 0);
 	}
+	profile->dirty = FALSE;
+}
+
+/**
+ * up_history_profile_get_cumulative:
+ *
+ * Return value: the time spent in the bins below @position, interpolating
+ * within the last one
+ **/
+static gdouble
+up_history_profile_get_cumulative (UpHistoryProfile *profile, gdouble position)
+{
+	guint i;
+
+	if (position <= 0.0f)
+		return 0.0f;
+	if (position >= UP_HISTORY_PROFILE_BINS)
+		return profile->cumulative[UP_HISTORY_PROFILE_BINS];
+	i = (guint) position;
+	return profile->cumulative[i] +
+	       (position - i) * (profile->cumulative[i + 1] - profile->cumulative[i]);
+}
 
-	/* accuracy is a percentage scale, where each cycle = 20% */
-	for (i=0; i<101; i++) {
-		stats = (UpStatsItem *) g_ptr_array_index (data, i);
-		up_stats_item_set_accuracy (stats, up_stats_item_get_accuracy (stats) * 20.0f);
+/**
+ * up_history_get_profile_time:
+ * @charging: whether to use the charging or the discharging profile
+ * @percentage: the current charge level
+ * @time_s: (out): the time until empty, or until full when charging
+ * @coverage: (out): the fraction of the bins in between that have data
+ *
+ * Predicts the remaining time from the learned profile, in constant time.
+ * Bins that have no data yet count as the average of the others.
+ *
+ * Return value: %FALSE if nothing has been learned yet
+ **/
+gboolean
+up_history_get_profile_time (UpHistory *history, gboolean charging, gdouble percentage,
+			     gdouble *time_s, gdouble *coverage)
+{
+	UpHistoryProfile *profile;
+	guint first;
+	guint last;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
+
+	profile = &history->priv->profiles[charging ? 1 : 0];
+	up_history_profile_refresh (profile);
+	if (profile->known[UP_HISTORY_PROFILE_BINS] == 0)
+		return FALSE;
+
+	percentage = CLAMP (percentage, 0.0f, 100.0f);
+
+	/* discharging from p goes through bins 0..p-1, and the time in
+	 * bin b is how long it took to get down to b; charging from p goes
+	 * through bins p+1..100, and bin b is how long it took to get up to b */
+	if (charging) {
+		*time_s = profile->cumulative[UP_HISTORY_PROFILE_BINS] -
+			  up_history_profile_get_cumulative (profile, percentage + 1.0f);
+		first = MIN ((guint) percentage + 1, UP_HISTORY_PROFILE_BINS);
+		last = UP_HISTORY_PROFILE_BINS;
+	} else {
+		*time_s = up_history_profile_get_cumulative (profile, percentage);
+		first = 0;
+		last = (guint) percentage;
+	}
+
+	if (last > first)
+		*coverage = (gdouble) (profile->known[last] - profile->known[first]) / (last - first);
+	else
+		*coverage = 1.0f;
+	return TRUE;
+}
+
+/**
+ * up_history_get_profile_data:
+ **/
+GPtrArray *
+up_history_get_profile_data (UpHistory *history, gboolean charging)
+{
+	guint i;
+	gfloat average;
+	UpHistoryProfile *profile;
+	UpStatsItem *stats;
+	GPtrArray *data;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
+
+	profile = &history->priv->profiles[charging ? 1 : 0];
+	average = up_history_profile_get_average (profile);
+	g_debug ("average is %f", average);
+
+	data = g_ptr_array_new_full (UP_HISTORY_PROFILE_BINS, g_object_unref);
+	for (i = 0; i < UP_HISTORY_PROFILE_BINS; i++) {
+		stats = up_stats_item_new ();
+
+		/* make the values a factor of 0, so that 1.0 is twice the
+		 * average, and -1.0 is half the average */
+		if (profile->count[i] > 0)
+			up_stats_item_set_value (stats, (profile->time[i] / profile->count[i] - average) / average);
+
+		/* accuracy is a percentage scale, where each cycle = 20% */
+		up_stats_item_set_accuracy (stats, profile->count[i] * 20.0f);
+		g_ptr_array_add (data, stats);
 	}
 
 	return data;
@@ -553,6 +1393,8 @@ up_history_save_data (UpHistory *history)
 	gchar *filename_charge = NULL;
 	gchar *filename_time_full = NULL;
 	gchar *filename_time_empty = NULL;
+	gint64 start;
+	static UpStatsCounter *stats = NULL;
 
 	/* we have an ID? */
 	if (history->priv->id == NULL) {
@@ -560,6 +1402,10 @@ up_history_save_data (UpHistory *history)
 		goto out;
 	}
 
+	if (stats == NULL)
+		stats = up_stats_get_counter ("history", "save");
+	start = g_get_monotonic_time ();
+
 	/* get filenames */
 	filename_rate = up_history_get_filename (history, "rate");
 	filename_charge = up_history_get_filename (history, "charge");
@@ -579,6 +1425,8 @@ up_history_save_data (UpHistory *history)
 	ret = up_history_array_to_file (history, history->priv->data_time_empty, filename_time_empty);
 	if (!ret)
 		goto out;
+	up_stats_counter_add (stats, start);
+	UP_PROBE2 (history_save, history->priv->id, g_get_monotonic_time () - start);
 out:
 	g_free (filename_rate);
 	g_free (filename_charge);
@@ -667,6 +1515,13 @@ up_history_load_data (UpHistory *history)
 {
 	gchar *filename;
 	UpHistoryItem *item;
+	guint i;
+	gint64 start;
+	static UpStatsCounter *stats = NULL;
+
+	if (stats == NULL)
+		stats = up_stats_get_counter ("history", "load");
+	start = g_get_monotonic_time ();
 
 	/* load rate history from disk */
 	filename = up_history_get_filename (history, "rate");
@@ -698,6 +1553,11 @@ up_history_load_data (UpHistory *history)
 	g_object_unref (item);
 	up_history_schedule_save (history);
 
+	/* learn from what happened before */
+	for (i = 0; i < history->priv->data_charge->len; i++)
+		up_history_profile_add (history, g_ptr_array_index (history->priv->data_charge, i));
+
+	up_stats_counter_add (stats, start);
 	return TRUE;
 }
 
@@ -760,6 +1620,7 @@ up_history_set_charge_data (UpHistory *history, gdouble percentage)
 	up_history_item_set_value (item, percentage);
 	up_history_item_set_state (item, history->priv->state);
 	g_ptr_array_add (history->priv->data_charge, item);
+	up_history_profile_add (history, item);
 	up_history_schedule_save (history);
 
 	/* save last value */
@@ -890,6 +1751,7 @@ up_history_init (UpHistory *history)
 	history->priv->data_time_full = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 	history->priv->data_time_empty = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 	history->priv->max_data_age = UP_HISTORY_DEFAULT_MAX_DATA_AGE;
+	history->priv->profile_bin = G_MAXUINT;
 
 	up_history_set_directory (history, HISTORY_DIR);
 }
@@ -58,6 +58,28 @@ typedef enum {
 	UP_HISTORY_TYPE_UNKNOWN
 } UpHistoryType;
 
+typedef enum {
+	UP_HISTORY_REDUCER_AVERAGE,
+	UP_HISTORY_REDUCER_MIN,
+	UP_HISTORY_REDUCER_MAX,
+	UP_HISTORY_REDUCER_LAST,
+	UP_HISTORY_REDUCER_LTTB,
+	UP_HISTORY_REDUCER_UNKNOWN
+} UpHistoryReducer;
+
+/* also the record format of up_history_get_data_fd() */
+typedef struct {
+	guint32			 time;
+	guint32			 state;
+	gdouble			 value;
+} UpHistorySample;
+
+typedef struct {
+	guint			 time;
+	UpDeviceState		 state;
+	gdouble			 values[UP_HISTORY_TYPE_UNKNOWN];
+} UpHistorySeriesPoint;
+
 
 GType		 up_history_get_type			(void);
 UpHistory	*up_history_new				(void);
@@ -66,8 +88,38 @@ GPtrArray	*up_history_get_data			(UpHistory		*history,
 							 UpHistoryType		 type,
 							 guint			 timespan,
 							 guint			 resolution);
+GArray		*up_history_get_data_reduced		(UpHistory		*history,
+							 UpHistoryType		 type,
+							 guint			 timespan,
+							 guint			 resolution,
+							 UpHistoryReducer	 reducer);
+GArray		*up_history_get_data_merged		(UpHistory		**histories,
+							 const gdouble		*weights,
+							 guint			 n_histories,
+							 UpHistoryType		 type,
+							 guint			 timespan);
+guint		 up_history_reduce			(const UpHistorySample	*in,
+							 guint			 n_in,
+							 UpHistoryReducer	 reducer,
+							 UpHistorySample	*out,
+							 guint			 max_out);
+UpHistoryReducer up_history_reducer_from_string	(const gchar		*reducer);
+GArray		*up_history_get_data_series		(UpHistory		*history,
+							 const UpHistoryType	*types,
+							 guint			 n_types,
+							 guint			 timespan,
+							 guint			 resolution);
+gint		 up_history_get_data_fd			(UpHistory		*history,
+							 UpHistoryType		 type,
+							 guint			 timespan,
+							 GError			**error);
 GPtrArray	*up_history_get_profile_data		(UpHistory		*history,
 							 gboolean		 charging);
+gboolean	 up_history_get_profile_time		(UpHistory		*history,
+							 gboolean		 charging,
+							 gdouble		 percentage,
+							 gdouble		*time_s,
+							 gdouble		*coverage);
 gboolean	 up_history_set_id			(UpHistory		*history,
 							 const gchar		*id);
 gboolean	 up_history_set_state			(UpHistory		*history,
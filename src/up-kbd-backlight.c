@@ -32,8 +32,10 @@
 #include <string.h>
 #include <dirent.h>
 
+#include "up-config.h"
 #include "up-kbd-backlight.h"
 #include "up-daemon.h"
+#include "up-stats.h"
 #include "up-types.h"
 
 static void     up_kbd_backlight_finalize   (GObject	*object);
@@ -244,6 +246,7 @@ up_kbd_backlight_find (UpKbdBacklight *kbd_backlight)
 	gchar *path_max = NULL;
 	gchar *path_now = NULL;
 	gchar *path_hw_changed = NULL;
+	gchar *leds_path = NULL;
 	gchar *buf_max = NULL;
 	gchar *buf_now = NULL;
 	GError *error = NULL;
@@ -251,7 +254,8 @@ up_kbd_backlight_find (UpKbdBacklight *kbd_backlight)
 	kbd_backlight->priv->fd = -1;
 
 	/* open directory */
-	dir = g_dir_open ("/sys/class/leds", 0, &error);
+	leds_path = up_config_build_path ("/sys/class/leds");
+	dir = g_dir_open (leds_path, 0, &error);
 	if (dir == NULL) {
 		if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
 			g_warning ("failed to open directory: %s", error->message);
@@ -262,7 +266,7 @@ up_kbd_backlight_find (UpKbdBacklight *kbd_backlight)
 	/* find a led device that is a keyboard device */
 	while ((filename = g_dir_read_name (dir)) != NULL) {
 		if (g_strstr_len (filename, -1, "kbd_backlight") != NULL) {
-			dir_path = g_build_filename ("/sys/class/leds",
+			dir_path = g_build_filename (leds_path,
 						    filename, NULL);
 			break;
 		}
@@ -307,6 +311,7 @@ up_kbd_backlight_find (UpKbdBacklight *kbd_backlight)
 out:
 	if (dir != NULL)
 		g_dir_close (dir);
+	g_free (leds_path);
 	g_free (dir_path);
 	g_free (path_max);
 	g_free (path_now);
@@ -382,6 +387,7 @@ up_kbd_backlight_register (UpKbdBacklight *kbd_backlight,
 		return;
 	}
 
+	up_stats_watch_skeleton (G_DBUS_INTERFACE_SKELETON (kbd_backlight));
 	g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (kbd_backlight),
 					  connection,
 					  "/org/freedesktop/UPower/KbdBacklight",
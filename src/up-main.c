@@ -37,6 +37,7 @@
 #include <locale.h>
 
 #include "up-daemon.h"
+#include "up-debug.h"
 #include "up-kbd-backlight.h"
 #include "up-wakeups.h"
 
@@ -45,6 +46,7 @@
 typedef struct UpState {
 	UpKbdBacklight *kbd_backlight;
 	UpWakeups *wakeups;
+	UpDebug *debug;
 	UpDaemon *daemon;
 	GMainLoop *loop;
 } UpState;
@@ -56,6 +58,7 @@ up_state_free (UpState *state)
 
 	g_clear_object (&state->kbd_backlight);
 	g_clear_object (&state->wakeups);
+	g_clear_object (&state->debug);
 	g_clear_object (&state->daemon);
 	g_clear_pointer (&state->loop, g_main_loop_unref);
 
@@ -69,6 +72,7 @@ up_state_new (void)
 
 	state->kbd_backlight = up_kbd_backlight_new ();
 	state->wakeups = up_wakeups_new ();
+	state->debug = up_debug_new ();
 	state->daemon = up_daemon_new ();
 	state->loop = g_main_loop_new (NULL, FALSE);
 
@@ -87,6 +91,7 @@ up_main_bus_acquired (GDBusConnection *connection,
 
 	up_kbd_backlight_register (state->kbd_backlight, connection);
 	up_wakeups_register (state->wakeups, connection);
+	up_debug_register (state->debug, connection);
 	if (!up_daemon_startup (state->daemon, connection)) {
 		g_warning ("Could not startup; bailing out");
 		g_main_loop_quit (state->loop);
@@ -0,0 +1,50 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __UP_PROBES_H
+#define __UP_PROBES_H
+
+/*
+ * Static probes for perf and bpftrace, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/libexec/upowerd:upower:device_refresh_done
+ *                { printf("%s %d us\n", str(arg0), arg1); }'
+ *
+ * When configured without --enable-usdt they expand to nothing, and the
+ * arguments are not evaluated.
+ */
+#ifdef ENABLE_USDT
+
+#include <sys/sdt.h>
+
+#define UP_PROBE_CLOCK()		g_get_monotonic_time ()
+#define UP_PROBE1(name, a)		STAP_PROBE1 (upower, name, a)
+#define UP_PROBE2(name, a, b)		STAP_PROBE2 (upower, name, a, b)
+#define UP_PROBE3(name, a, b, c)	STAP_PROBE3 (upower, name, a, b, c)
+
+#else
+
+#define UP_PROBE_CLOCK()		0
+#define UP_PROBE1(name, a)		do { (void) sizeof (a); } while (0)
+#define UP_PROBE2(name, a, b)		do { (void) sizeof (a); (void) sizeof (b); } while (0)
+#define UP_PROBE3(name, a, b, c)	do { (void) sizeof (a); (void) sizeof (b); (void) sizeof (c); } while (0)
+
+#endif
+
+#endif /* __UP_PROBES_H */
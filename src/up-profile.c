@@ -0,0 +1,387 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib-object.h>
+
+#include "up-profile.h"
+
+static void	up_profile_finalize	(GObject		*object);
+
+#define UP_PROFILE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), UP_TYPE_PROFILE, UpProfilePrivate))
+
+/* a power of two, enough for 40 seconds at the highest frequency */
+#define UP_PROFILE_RING_SIZE		4096
+#define UP_PROFILE_RING_MASK		(UP_PROFILE_RING_SIZE - 1)
+#define UP_PROFILE_DRAIN_INTERVAL	250 /* ms */
+
+/*
+ * The sampling thread is the only writer of ring_head and the main
+ * thread the only writer of ring_tail, so the ring needs no lock.
+ */
+struct UpProfilePrivate
+{
+	UpProfileSampleFunc	 func;
+	gpointer		 user_data;
+	GDestroyNotify		 destroy;
+	GThread			*thread;
+	guint			 frequency;
+	guint			 duration;
+	UpProfileSample		*ring;
+	volatile gint		 ring_head;
+	volatile gint		 ring_tail;
+	volatile gint		 dropped;
+	volatile gint		 stopping;
+	volatile gint		 finished;
+	guint			 drain_id;
+	GArray			*samples;
+};
+
+G_DEFINE_TYPE (UpProfile, up_profile, G_TYPE_OBJECT)
+
+/**
+ * up_profile_ring_push:
+ *
+ * Only called from the sampling thread.
+ **/
+static void
+up_profile_ring_push (UpProfile *profile, const UpProfileSample *sample)
+{
+	UpProfilePrivate *priv = profile->priv;
+	guint head;
+	guint tail;
+
+	head = (guint) g_atomic_int_get (&priv->ring_head);
+	tail = (guint) g_atomic_int_get (&priv->ring_tail);
+	if (head - tail == UP_PROFILE_RING_SIZE) {
+		g_atomic_int_inc (&priv->dropped);
+		return;
+	}
+	priv->ring[head & UP_PROFILE_RING_MASK] = *sample;
+	g_atomic_int_set (&priv->ring_head, (gint) (head + 1));
+}
+
+/**
+ * up_profile_ring_drain:
+ *
+ * Only called from the main thread.
+ **/
+static void
+up_profile_ring_drain (UpProfile *profile)
+{
+	UpProfilePrivate *priv = profile->priv;
+	guint head;
+	guint tail;
+
+	head = (guint) g_atomic_int_get (&priv->ring_head);
+	tail = (guint) g_atomic_int_get (&priv->ring_tail);
+	for (; tail != head; tail++)
+		g_array_append_val (priv->samples, priv->ring[tail & UP_PROFILE_RING_MASK]);
+	g_atomic_int_set (&priv->ring_tail, (gint) tail);
+}
+
+/**
+ * up_profile_thread_cb:
+ **/
+static gpointer
+up_profile_thread_cb (UpProfile *profile)
+{
+	UpProfilePrivate *priv = profile->priv;
+	UpProfileSample sample;
+	gint64 start;
+	gint64 end;
+	gint64 next;
+	gint64 now;
+	gint64 period;
+
+	period = G_USEC_PER_SEC / priv->frequency;
+	start = g_get_monotonic_time ();
+	end = start + (gint64) priv->duration * G_USEC_PER_SEC;
+	for (next = start; !g_atomic_int_get (&priv->stopping); next += period) {
+		now = g_get_monotonic_time ();
+		if (next > now) {
+			g_usleep (next - now);
+			now = g_get_monotonic_time ();
+		} else if (now - next > period) {
+			/* we fell behind, don't try to catch up in a burst */
+			next = now;
+		}
+		if (now >= end)
+			break;
+
+		memset (&sample, 0, sizeof (sample));
+		if (!priv->func (&sample, priv->user_data))
+			continue;
+		sample.time = now - start;
+		up_profile_ring_push (profile, &sample);
+	}
+	g_atomic_int_set (&priv->finished, TRUE);
+	return NULL;
+}
+
+/**
+ * up_profile_join:
+ **/
+static void
+up_profile_join (UpProfile *profile)
+{
+	UpProfilePrivate *priv = profile->priv;
+
+	if (priv->thread == NULL)
+		return;
+	g_thread_join (priv->thread);
+	priv->thread = NULL;
+	up_profile_ring_drain (profile);
+	if (priv->drain_id != 0) {
+		g_source_remove (priv->drain_id);
+		priv->drain_id = 0;
+	}
+}
+
+/**
+ * up_profile_drain_cb:
+ **/
+static gboolean
+up_profile_drain_cb (UpProfile *profile)
+{
+	up_profile_ring_drain (profile);
+
+	/* the session ran out of time */
+	if (g_atomic_int_get (&profile->priv->finished)) {
+		profile->priv->drain_id = 0;
+		up_profile_join (profile);
+		return G_SOURCE_REMOVE;
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+/**
+ * up_profile_set_sampler:
+ *
+ * Sets the function used to take a sample. @user_data is only used by the
+ * sampling thread while a session is running.
+ **/
+void
+up_profile_set_sampler (UpProfile *profile, UpProfileSampleFunc func,
+			gpointer user_data, GDestroyNotify destroy)
+{
+	UpProfilePrivate *priv;
+
+	g_return_if_fail (UP_IS_PROFILE (profile));
+	g_return_if_fail (profile->priv->thread == NULL);
+
+	priv = profile->priv;
+	if (priv->destroy != NULL)
+		priv->destroy (priv->user_data);
+	priv->func = func;
+	priv->user_data = user_data;
+	priv->destroy = destroy;
+}
+
+/**
+ * up_profile_start:
+ *
+ * Starts sampling on a new thread. The session stops by itself after
+ * @duration seconds, and the samples are kept until the object goes away.
+ **/
+gboolean
+up_profile_start (UpProfile *profile, guint frequency, guint duration, GError **error)
+{
+	UpProfilePrivate *priv;
+
+	g_return_val_if_fail (UP_IS_PROFILE (profile), FALSE);
+	g_return_val_if_fail (profile->priv->func != NULL, FALSE);
+	g_return_val_if_fail (profile->priv->thread == NULL, FALSE);
+	g_return_val_if_fail (frequency > 0, FALSE);
+
+	priv = profile->priv;
+	priv->frequency = frequency;
+	priv->duration = duration;
+	g_array_set_size (priv->samples, 0);
+	g_atomic_int_set (&priv->ring_head, 0);
+	g_atomic_int_set (&priv->ring_tail, 0);
+	g_atomic_int_set (&priv->dropped, 0);
+	g_atomic_int_set (&priv->stopping, FALSE);
+	g_atomic_int_set (&priv->finished, FALSE);
+
+	priv->thread = g_thread_try_new ("upower-profile",
+					 (GThreadFunc) up_profile_thread_cb,
+					 profile, error);
+	if (priv->thread == NULL)
+		return FALSE;
+
+	priv->drain_id = g_timeout_add (UP_PROFILE_DRAIN_INTERVAL,
+					(GSourceFunc) up_profile_drain_cb, profile);
+	g_source_set_name_by_id (priv->drain_id, "[upower] up_profile_drain_cb");
+	return TRUE;
+}
+
+/**
+ * up_profile_stop:
+ *
+ * Stops sampling and waits for the thread to finish.
+ **/
+void
+up_profile_stop (UpProfile *profile)
+{
+	g_return_if_fail (UP_IS_PROFILE (profile));
+
+	g_atomic_int_set (&profile->priv->stopping, TRUE);
+	up_profile_join (profile);
+}
+
+/**
+ * up_profile_is_running:
+ **/
+gboolean
+up_profile_is_running (UpProfile *profile)
+{
+	g_return_val_if_fail (UP_IS_PROFILE (profile), FALSE);
+	return profile->priv->thread != NULL &&
+	       !g_atomic_int_get (&profile->priv->finished);
+}
+
+/**
+ * up_profile_get_samples:
+ *
+ * Return value: (transfer none): a #GArray of #UpProfileSample, oldest first
+ **/
+GArray *
+up_profile_get_samples (UpProfile *profile)
+{
+	g_return_val_if_fail (UP_IS_PROFILE (profile), NULL);
+	if (profile->priv->thread != NULL)
+		up_profile_ring_drain (profile);
+	return profile->priv->samples;
+}
+
+/**
+ * up_profile_compare_double:
+ **/
+static gint
+up_profile_compare_double (const gdouble *a, const gdouble *b)
+{
+	if (*a < *b)
+		return -1;
+	if (*a > *b)
+		return 1;
+	return 0;
+}
+
+/**
+ * up_profile_get_stats:
+ *
+ * The percentiles use the nearest rank, and the energy is the integral of
+ * the power using the trapezoidal rule.
+ **/
+void
+up_profile_get_stats (UpProfile *profile, UpProfileStats *stats)
+{
+	UpProfileSample *samples;
+	GArray *array;
+	gdouble *power;
+	gdouble total = 0.0f;
+	guint n;
+	guint i;
+
+	g_return_if_fail (UP_IS_PROFILE (profile));
+	g_return_if_fail (stats != NULL);
+
+	array = up_profile_get_samples (profile);
+	samples = (UpProfileSample *) array->data;
+	n = array->len;
+
+	memset (stats, 0, sizeof (UpProfileStats));
+	stats->n_samples = n;
+	stats->n_dropped = g_atomic_int_get (&profile->priv->dropped);
+	if (n == 0)
+		return;
+
+	power = g_new (gdouble, n);
+	for (i = 0; i < n; i++) {
+		power[i] = samples[i].power;
+		total += samples[i].power;
+		if (i > 0)
+			stats->energy += (samples[i].power + samples[i - 1].power) / 2.0f *
+					 (samples[i].time - samples[i - 1].time) / G_USEC_PER_SEC;
+	}
+	stats->power_mean = total / n;
+	stats->duration = (samples[n - 1].time - samples[0].time) / (gdouble) G_USEC_PER_SEC;
+
+	qsort (power, n, sizeof (gdouble), (GCompareFunc) up_profile_compare_double);
+	stats->power_p50 = power[(guint) ceil (0.50f * n) - 1];
+	stats->power_p99 = power[(guint) ceil (0.99f * n) - 1];
+	g_free (power);
+}
+
+/**
+ * up_profile_class_init:
+ **/
+static void
+up_profile_class_init (UpProfileClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = up_profile_finalize;
+
+	g_type_class_add_private (klass, sizeof (UpProfilePrivate));
+}
+
+/**
+ * up_profile_init:
+ **/
+static void
+up_profile_init (UpProfile *profile)
+{
+	profile->priv = UP_PROFILE_GET_PRIVATE (profile);
+	profile->priv->ring = g_new0 (UpProfileSample, UP_PROFILE_RING_SIZE);
+	profile->priv->samples = g_array_new (FALSE, FALSE, sizeof (UpProfileSample));
+}
+
+/**
+ * up_profile_finalize:
+ **/
+static void
+up_profile_finalize (GObject *object)
+{
+	UpProfile *profile;
+
+	g_return_if_fail (UP_IS_PROFILE (object));
+
+	profile = UP_PROFILE (object);
+	up_profile_stop (profile);
+	if (profile->priv->destroy != NULL)
+		profile->priv->destroy (profile->priv->user_data);
+	g_array_unref (profile->priv->samples);
+	g_free (profile->priv->ring);
+
+	G_OBJECT_CLASS (up_profile_parent_class)->finalize (object);
+}
+
+/**
+ * up_profile_new:
+ **/
+UpProfile *
+up_profile_new (void)
+{
+	return g_object_new (UP_TYPE_PROFILE, NULL);
+}
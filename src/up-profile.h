@@ -0,0 +1,93 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __UP_PROFILE_H
+#define __UP_PROFILE_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define UP_TYPE_PROFILE		(up_profile_get_type ())
+#define UP_PROFILE(o)			(G_TYPE_CHECK_INSTANCE_CAST ((o), UP_TYPE_PROFILE, UpProfile))
+#define UP_PROFILE_CLASS(k)		(G_TYPE_CHECK_CLASS_CAST((k), UP_TYPE_PROFILE, UpProfileClass))
+#define UP_IS_PROFILE(o)		(G_TYPE_CHECK_INSTANCE_TYPE ((o), UP_TYPE_PROFILE))
+#define UP_IS_PROFILE_CLASS(k)		(G_TYPE_CHECK_CLASS_TYPE ((k), UP_TYPE_PROFILE))
+#define UP_PROFILE_GET_CLASS(o)	(G_TYPE_INSTANCE_GET_CLASS ((o), UP_TYPE_PROFILE, UpProfileClass))
+
+#define UP_PROFILE_FREQUENCY_MIN	10	/* Hz */
+#define UP_PROFILE_FREQUENCY_MAX	100	/* Hz */
+#define UP_PROFILE_DURATION_MAX		3600	/* seconds */
+
+typedef struct UpProfilePrivate UpProfilePrivate;
+
+typedef struct
+{
+	 GObject		 parent;
+	 UpProfilePrivate	*priv;
+} UpProfile;
+
+typedef struct
+{
+	GObjectClass		 parent_class;
+} UpProfileClass;
+
+/* also the record format returned by StopProfiling */
+typedef struct {
+	guint64			 time;		/* us since the start */
+	gdouble			 power;		/* W */
+	gdouble			 voltage;	/* V */
+	gdouble			 current;	/* A */
+} UpProfileSample;
+G_STATIC_ASSERT (sizeof (UpProfileSample) == 32);
+
+typedef struct {
+	guint			 n_samples;
+	guint			 n_dropped;
+	gdouble			 duration;	/* s */
+	gdouble			 power_mean;	/* W */
+	gdouble			 power_p50;	/* W */
+	gdouble			 power_p99;	/* W */
+	gdouble			 energy;	/* J */
+} UpProfileStats;
+
+/* called from the sampling thread, so must not touch any shared state */
+typedef gboolean (*UpProfileSampleFunc)	(UpProfileSample	*sample,
+					 gpointer		 user_data);
+
+GType		 up_profile_get_type		(void);
+UpProfile	*up_profile_new			(void);
+
+void		 up_profile_set_sampler		(UpProfile		*profile,
+						 UpProfileSampleFunc	 func,
+						 gpointer		 user_data,
+						 GDestroyNotify		 destroy);
+gboolean	 up_profile_start		(UpProfile		*profile,
+						 guint			 frequency,
+						 guint			 duration,
+						 GError			**error);
+void		 up_profile_stop		(UpProfile		*profile);
+gboolean	 up_profile_is_running		(UpProfile		*profile);
+GArray		*up_profile_get_samples		(UpProfile		*profile);
+void		 up_profile_get_stats		(UpProfile		*profile,
+						 UpProfileStats		*stats);
+
+G_END_DECLS
+
+#endif /* __UP_PROFILE_H */
@@ -0,0 +1,199 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+
+#include "up-rate-estimator.h"
+
+/* how much data we need before trusting the fit */
+#define UP_RATE_ESTIMATOR_MIN_SAMPLES		3
+#define UP_RATE_ESTIMATOR_MIN_SPAN		60.0f	/* s */
+
+/* a sample this many standard deviations off the fit is an outlier... */
+#define UP_RATE_ESTIMATOR_OUTLIER_SIGMA		4.0f
+/* ...unless it is within the resolution most batteries report */
+#define UP_RATE_ESTIMATOR_OUTLIER_MIN		0.2f	/* Wh */
+/* this many outliers in a row means the level really changed */
+#define UP_RATE_ESTIMATOR_OUTLIER_MAX		3
+#define UP_RATE_ESTIMATOR_RESIDUAL_WEIGHT	0.2f
+
+/**
+ * up_rate_estimator_init:
+ * @window: the time constant of the fit in seconds, or 0 for the default
+ * @smoothing: how much of each new estimate is used, in percent, or 0
+ * for the default
+ **/
+void
+up_rate_estimator_init (UpRateEstimator *estimator, guint window, guint smoothing)
+{
+	if (window == 0)
+		window = UP_RATE_ESTIMATOR_DEFAULT_WINDOW;
+	if (smoothing == 0 || smoothing > 100)
+		smoothing = UP_RATE_ESTIMATOR_DEFAULT_SMOOTHING;
+	estimator->window = window;
+	estimator->smoothing = smoothing / 100.0f;
+	up_rate_estimator_reset (estimator);
+}
+
+/**
+ * up_rate_estimator_reset:
+ *
+ * Forgets all the samples, keeping the configuration.
+ **/
+void
+up_rate_estimator_reset (UpRateEstimator *estimator)
+{
+	gdouble window = estimator->window;
+	gdouble smoothing = estimator->smoothing;
+
+	memset (estimator, 0, sizeof (UpRateEstimator));
+	estimator->window = window;
+	estimator->smoothing = smoothing;
+}
+
+/**
+ * up_rate_estimator_fit:
+ *
+ * Gets the line through the weighted samples, as the energy at the time
+ * of the newest sample and the slope in Wh per second.
+ **/
+static gboolean
+up_rate_estimator_fit (UpRateEstimator *estimator, gdouble *intercept, gdouble *slope)
+{
+	gdouble det;
+
+	det = estimator->s0 * estimator->stt - estimator->st * estimator->st;
+	if (det <= 0.0f)
+		return FALSE;
+	*slope = (estimator->s0 * estimator->ste - estimator->st * estimator->se) / det;
+	*intercept = (estimator->se - *slope * estimator->st) / estimator->s0;
+	return TRUE;
+}
+
+/**
+ * up_rate_estimator_add:
+ * @time: a monotonic time in microseconds
+ * @energy: the energy in Wh
+ *
+ * Adds a sample in constant time. Older samples are weighted down by
+ * exp(-age / window), so there is no buffer of old values to walk.
+ *
+ * Return value: %FALSE if the sample was rejected as an outlier
+ **/
+gboolean
+up_rate_estimator_add (UpRateEstimator *estimator, gint64 time, gdouble energy)
+{
+	gdouble intercept;
+	gdouble slope;
+	gdouble residual;
+	gdouble decay;
+	gdouble dt;
+	gdouble rate;
+
+	/* the first sample */
+	if (estimator->n_samples == 0) {
+		estimator->last_time = time;
+		estimator->s0 = 1.0f;
+		estimator->se = energy;
+		estimator->n_samples = 1;
+		return TRUE;
+	}
+
+	dt = (time - estimator->last_time) / (gdouble) G_USEC_PER_SEC;
+	if (dt <= 0.0f)
+		return FALSE;
+
+	/* compare with what the fit predicts */
+	if (estimator->n_samples >= UP_RATE_ESTIMATOR_MIN_SAMPLES &&
+	    up_rate_estimator_fit (estimator, &intercept, &slope)) {
+		residual = energy - (intercept + slope * dt);
+		if (estimator->residual_var > 0.0f &&
+		    fabs (residual) > UP_RATE_ESTIMATOR_OUTLIER_MIN &&
+		    residual * residual > UP_RATE_ESTIMATOR_OUTLIER_SIGMA * UP_RATE_ESTIMATOR_OUTLIER_SIGMA * estimator->residual_var) {
+			if (++estimator->n_rejected < UP_RATE_ESTIMATOR_OUTLIER_MAX) {
+				g_debug ("ignoring outlier %.3fWh, expected %.3fWh",
+					 energy, intercept + slope * dt);
+				return FALSE;
+			}
+			g_debug ("energy moved to %.3fWh, starting again", energy);
+			up_rate_estimator_reset (estimator);
+			return up_rate_estimator_add (estimator, time, energy);
+		}
+		estimator->n_rejected = 0;
+		if (estimator->residual_var == 0.0f)
+			estimator->residual_var = residual * residual;
+		else
+			estimator->residual_var += UP_RATE_ESTIMATOR_RESIDUAL_WEIGHT *
+						   (residual * residual - estimator->residual_var);
+	}
+
+	/* move the origin to the new sample... */
+	estimator->stt += dt * (dt * estimator->s0 - 2.0f * estimator->st);
+	estimator->ste -= dt * estimator->se;
+	estimator->st -= dt * estimator->s0;
+
+	/* ...age the old ones... */
+	decay = exp (-dt / estimator->window);
+	estimator->s0 *= decay;
+	estimator->st *= decay;
+	estimator->se *= decay;
+	estimator->stt *= decay;
+	estimator->ste *= decay;
+
+	/* ...and add it, which at t = 0 only affects two of the sums */
+	estimator->s0 += 1.0f;
+	estimator->se += energy;
+
+	estimator->last_time = time;
+	estimator->span += dt;
+	estimator->n_samples++;
+
+	/* smooth the result */
+	if (estimator->n_samples < UP_RATE_ESTIMATOR_MIN_SAMPLES ||
+	    estimator->span < UP_RATE_ESTIMATOR_MIN_SPAN)
+		return TRUE;
+	if (!up_rate_estimator_fit (estimator, &intercept, &slope))
+		return TRUE;
+	rate = fabs (slope) * 3600.0f;
+	if (!estimator->has_rate)
+		estimator->rate = rate;
+	else
+		estimator->rate += estimator->smoothing * (rate - estimator->rate);
+	estimator->has_rate = TRUE;
+	return TRUE;
+}
+
+/**
+ * up_rate_estimator_get_rate:
+ * @rate: (out): the energy rate in W
+ *
+ * Return value: %FALSE if there is not enough data yet
+ **/
+gboolean
+up_rate_estimator_get_rate (UpRateEstimator *estimator, gdouble *rate)
+{
+	if (!estimator->has_rate)
+		return FALSE;
+	*rate = estimator->rate;
+	return TRUE;
+}
@@ -0,0 +1,60 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __UP_RATE_ESTIMATOR_H
+#define __UP_RATE_ESTIMATOR_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define UP_RATE_ESTIMATOR_DEFAULT_WINDOW	600	/* s */
+#define UP_RATE_ESTIMATOR_DEFAULT_SMOOTHING	30	/* % */
+
+/* exponentially weighted least squares fit of energy against time */
+typedef struct {
+	gdouble			 window;	/* s */
+	gdouble			 smoothing;	/* weight of a new estimate */
+	gint64			 last_time;	/* us */
+	gdouble			 span;		/* s */
+	guint			 n_samples;
+	guint			 n_rejected;
+	gdouble			 s0;		/* weighted sums, with the */
+	gdouble			 st;		/* newest sample at t = 0 */
+	gdouble			 se;
+	gdouble			 stt;
+	gdouble			 ste;
+	gdouble			 residual_var;
+	gdouble			 rate;		/* W */
+	gboolean		 has_rate;
+} UpRateEstimator;
+
+void		 up_rate_estimator_init		(UpRateEstimator	*estimator,
+						 guint			 window,
+						 guint			 smoothing);
+void		 up_rate_estimator_reset	(UpRateEstimator	*estimator);
+gboolean	 up_rate_estimator_add		(UpRateEstimator	*estimator,
+						 gint64			 time,
+						 gdouble		 energy);
+gboolean	 up_rate_estimator_get_rate	(UpRateEstimator	*estimator,
+						 gdouble		*rate);
+
+G_END_DECLS
+
+#endif /* __UP_RATE_ESTIMATOR_H */
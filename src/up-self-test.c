@@ -24,7 +24,9 @@
 #include <glib-object.h>
 #include <glib/gstdio.h>
 #include <up-history-item.h>
+#include <up-stats-item.h>
 #include <stdlib.h>
+#include <math.h>
 #include <unistd.h>
 #include <errno.h>
 #include "up-backend.h"
@@ -33,6 +35,9 @@
 #include "up-device-list.h"
 #include "up-history.h"
 #include "up-native.h"
+#include "up-profile.h"
+#include "up-rate-estimator.h"
+#include "up-stats.h"
 #include "up-wakeups.h"
 
 gchar *history_dir = NULL;
@@ -84,6 +89,69 @@ up_test_device_func (void)
 	g_object_unref (device);
 }
 
+static void
+up_test_device_changed_cb (UpDevice *device, guint *count)
+{
+	(*count)++;
+}
+
+static void
+up_test_device_transaction_func (void)
+{
+	UpDevice *device;
+	guint count = 0;
+
+	device = up_device_new ();
+	g_signal_connect (device, "changed",
+			  G_CALLBACK (up_test_device_changed_cb), &count);
+
+	/* outside a transaction, each change is published */
+	g_object_set (device, "is-present", TRUE, NULL);
+	g_assert_cmpint (count, ==, 1);
+
+	/* inside nested transactions, only once on the outermost thaw */
+	count = 0;
+	up_device_freeze (device);
+	up_device_freeze (device);
+	g_object_set (device,
+		      "type", UP_DEVICE_KIND_BATTERY,
+		      "state", UP_DEVICE_STATE_DISCHARGING,
+		      "percentage", 50.0,
+		      "energy", 10.0,
+		      NULL);
+	up_device_thaw (device);
+	g_assert_cmpint (count, ==, 0);
+	up_device_thaw (device);
+	g_assert_cmpint (count, ==, 1);
+
+	/* derived properties are computed on commit */
+	g_assert_cmpstr (up_exported_device_get_icon_name (UP_EXPORTED_DEVICE (device)), ==, "battery-good-symbolic");
+
+	/* unref */
+	g_object_unref (device);
+}
+
+static void
+up_test_device_display_func (void)
+{
+	UpDaemon *daemon;
+	UpDevice *device;
+
+	daemon = up_daemon_new ();
+	device = up_device_new ();
+	g_assert (up_device_get_history_store (device) != NULL);
+
+	/* the display device only has the merged history of the others,
+	 * so GetHistorySeries and GetHistoryFd are rejected */
+	up_device_register_display_device (device, daemon);
+	g_assert (up_exported_device_get_has_history (UP_EXPORTED_DEVICE (device)));
+	g_assert (up_device_get_history_store (device) == NULL);
+
+	/* unref */
+	g_object_unref (device);
+	g_object_unref (daemon);
+}
+
 static void
 up_test_device_list_func (void)
 {
@@ -112,6 +180,24 @@ up_test_device_list_func (void)
 	g_assert (ret);
 
 	/* unref */
+	g_object_unref (native);
+	g_object_unref (device);
+
+	/* devices are indexed by kind, and follow type changes */
+	native = g_object_new (G_TYPE_OBJECT, NULL);
+	device = G_OBJECT (up_device_new ());
+	g_object_set (device, "type", UP_DEVICE_KIND_BATTERY, NULL);
+	ret = up_device_list_insert (list, native, device);
+	g_assert (ret);
+	g_assert_cmpint (up_device_list_get_num_devices_of_kind (list, UP_DEVICE_KIND_BATTERY), ==, 1);
+	g_assert_cmpint (up_device_list_get_num_devices_of_kind (list, UP_DEVICE_KIND_UPS), ==, 0);
+	g_object_set (device, "type", UP_DEVICE_KIND_UPS, NULL);
+	g_assert_cmpint (up_device_list_get_num_devices_of_kind (list, UP_DEVICE_KIND_BATTERY), ==, 0);
+	g_assert_cmpint (up_device_list_get_num_devices_of_kind (list, UP_DEVICE_KIND_UPS), ==, 1);
+	ret = up_device_list_remove (list, device);
+	g_assert (ret);
+	g_assert_cmpint (up_device_list_get_num_devices_of_kind (list, UP_DEVICE_KIND_UPS), ==, 0);
+
 	g_object_unref (native);
 	g_object_unref (device);
 	g_object_unref (list);
@@ -135,6 +221,209 @@ up_test_history_remove_temp_files (void)
 	g_free (filename);
 }
 
+static void
+up_test_history_reduce_func (void)
+{
+	UpHistorySample in[100];
+	UpHistorySample out[10];
+	guint n_out;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (in); i++) {
+		in[i].time = 1000 + i;
+		in[i].state = UP_DEVICE_STATE_DISCHARGING;
+		in[i].value = 10.0f;
+	}
+	in[42].value = 50.0f;
+
+	/* averaging dilutes the spike */
+	n_out = up_history_reduce (in, G_N_ELEMENTS (in), UP_HISTORY_REDUCER_AVERAGE, out, G_N_ELEMENTS (out));
+	g_assert_cmpint (n_out, ==, 10);
+	for (i = 0; i < n_out; i++)
+		g_assert_cmpfloat (out[i].value, <, 50.0f);
+
+	/* but max and lttb keep it */
+	n_out = up_history_reduce (in, G_N_ELEMENTS (in), UP_HISTORY_REDUCER_MAX, out, G_N_ELEMENTS (out));
+	g_assert_cmpint (n_out, ==, 10);
+	g_assert_cmpfloat (out[4].value, ==, 50.0f);
+	g_assert_cmpint (out[4].time, ==, 1042);
+
+	n_out = up_history_reduce (in, G_N_ELEMENTS (in), UP_HISTORY_REDUCER_LTTB, out, G_N_ELEMENTS (out));
+	g_assert_cmpint (n_out, ==, 10);
+	g_assert_cmpint (out[0].time, ==, 1000);
+	g_assert_cmpint (out[9].time, ==, 1099);
+	for (i = 1; i < n_out; i++) {
+		g_assert_cmpint (out[i].time, >, out[i - 1].time);
+		if (out[i].time == 1042)
+			break;
+	}
+	g_assert_cmpint (i, <, n_out);
+
+	/* short input is copied through */
+	n_out = up_history_reduce (in, 5, UP_HISTORY_REDUCER_MIN, out, G_N_ELEMENTS (out));
+	g_assert_cmpint (n_out, ==, 5);
+	g_assert_cmpint (out[4].time, ==, 1004);
+}
+
+static void
+up_test_history_merge_func (void)
+{
+	UpHistory *histories[2];
+	const gdouble weights[] = { 1.0f, 3.0f };
+	const gchar *ids[] = { "merge-a", "merge-b" };
+	const gchar *types[] = { "charge", "rate", "time-full", "time-empty" };
+	UpHistorySample *sample;
+	GArray *data;
+	gboolean ret;
+	gchar *dir;
+	gchar *filename;
+	gchar *basename;
+	guint i, j;
+
+	dir = g_build_filename (g_get_tmp_dir(), "upower-test.XXXXXX", NULL);
+	if (mkdtemp (dir) == NULL)
+		g_error ("Cannot create temporary directory: %s", g_strerror(errno));
+
+	for (i = 0; i < G_N_ELEMENTS (histories); i++) {
+		histories[i] = up_history_new ();
+		up_history_set_directory (histories[i], dir);
+		ret = up_history_set_id (histories[i], ids[i]);
+		g_assert (ret);
+		up_history_set_state (histories[i], UP_DEVICE_STATE_DISCHARGING);
+	}
+	up_history_set_charge_data (histories[0], 50);
+	up_history_set_rate_data (histories[0], 5.0f);
+	up_history_set_charge_data (histories[1], 100);
+	up_history_set_rate_data (histories[1], 7.0f);
+
+	/* charge is weighted by capacity */
+	data = up_history_get_data_merged (histories, weights, 2, UP_HISTORY_TYPE_CHARGE, 10);
+	g_assert (data != NULL);
+	g_assert_cmpint (data->len, >=, 1);
+	sample = &g_array_index (data, UpHistorySample, data->len - 1);
+	g_assert_cmpfloat (sample->value, ==, 87.5f);
+	g_assert_cmpint (sample->state, ==, UP_DEVICE_STATE_DISCHARGING);
+	g_array_unref (data);
+
+	/* rate is summed */
+	data = up_history_get_data_merged (histories, weights, 2, UP_HISTORY_TYPE_RATE, 10);
+	g_assert (data != NULL);
+	g_assert_cmpint (data->len, >=, 1);
+	sample = &g_array_index (data, UpHistorySample, data->len - 1);
+	g_assert_cmpfloat (sample->value, ==, 12.0f);
+	g_array_unref (data);
+
+	/* one charging battery makes the whole system charging */
+	up_history_set_state (histories[1], UP_DEVICE_STATE_CHARGING);
+	up_history_set_charge_data (histories[1], 99);
+	data = up_history_get_data_merged (histories, weights, 2, UP_HISTORY_TYPE_CHARGE, 10);
+	g_assert (data != NULL);
+	sample = &g_array_index (data, UpHistorySample, data->len - 1);
+	g_assert_cmpint (sample->state, ==, UP_DEVICE_STATE_CHARGING);
+	g_array_unref (data);
+
+	for (i = 0; i < G_N_ELEMENTS (histories); i++) {
+		g_object_unref (histories[i]);
+		for (j = 0; j < G_N_ELEMENTS (types); j++) {
+			basename = g_strdup_printf ("history-%s-%s.dat", types[j], ids[i]);
+			filename = g_build_filename (dir, basename, NULL);
+			g_unlink (filename);
+			g_free (filename);
+			g_free (basename);
+		}
+	}
+	rmdir (dir);
+	g_free (dir);
+}
+
+static void
+up_test_history_profile_func (void)
+{
+	UpHistory *history;
+	UpStatsItem *stats;
+	GPtrArray *array;
+	GString *string;
+	const gchar *types[] = { "charge", "rate", "time-full", "time-empty" };
+	gdouble time_s;
+	gdouble coverage;
+	gboolean ret;
+	gchar *dir;
+	gchar *filename;
+	gchar *basename;
+	guint64 now;
+	guint i;
+
+	dir = g_build_filename (g_get_tmp_dir(), "upower-test.XXXXXX", NULL);
+	if (mkdtemp (dir) == NULL)
+		g_error ("Cannot create temporary directory: %s", g_strerror(errno));
+
+	/* a full discharge, one percent a minute until the last 20% which
+	 * take two minutes each */
+	now = g_get_real_time () / G_USEC_PER_SEC;
+	string = g_string_new ("");
+	for (i = 0; i <= 100; i++) {
+		now += i <= 80 ? 60 : 120;
+		g_string_append_printf (string, "%" G_GUINT64_FORMAT "\t%i.000\tdischarging\n",
+					now - 24 * 60 * 60, 100 - i);
+	}
+	filename = g_build_filename (dir, "history-charge-profile.dat", NULL);
+	ret = g_file_set_contents (filename, string->str, -1, NULL);
+	g_assert (ret);
+	g_free (filename);
+	g_string_free (string, TRUE);
+
+	history = up_history_new ();
+	up_history_set_directory (history, dir);
+	ret = up_history_set_id (history, "profile");
+	g_assert (ret);
+
+	/* nothing learned about charging */
+	ret = up_history_get_profile_time (history, TRUE, 50.0f, &time_s, &coverage);
+	g_assert (!ret);
+
+	/* the slow end is taken into account */
+	ret = up_history_get_profile_time (history, FALSE, 50.0f, &time_s, &coverage);
+	g_assert (ret);
+	g_assert_cmpfloat (time_s, ==, 20 * 120 + 30 * 60);
+	g_assert_cmpfloat (coverage, ==, 1.0f);
+	ret = up_history_get_profile_time (history, FALSE, 10.5f, &time_s, &coverage);
+	g_assert (ret);
+	g_assert_cmpfloat (time_s, ==, 10 * 120 + 60);
+
+	/* the statistics come from the same data */
+	array = up_history_get_profile_data (history, FALSE);
+	g_assert_cmpint (array->len, ==, 101);
+	stats = g_ptr_array_index (array, 10);
+	g_assert_cmpfloat (up_stats_item_get_accuracy (stats), ==, 20.0f);
+	g_assert_cmpfloat (up_stats_item_get_value (stats), >, 0.0f);
+	stats = g_ptr_array_index (array, 50);
+	g_assert_cmpfloat (up_stats_item_get_value (stats), <, 0.0f);
+	g_ptr_array_unref (array);
+
+	/* new data is learned as it comes in */
+	up_history_set_state (history, UP_DEVICE_STATE_CHARGING);
+	up_history_set_charge_data (history, 1);
+	g_usleep (G_USEC_PER_SEC);
+	up_history_set_charge_data (history, 2);
+	g_usleep (G_USEC_PER_SEC);
+	up_history_set_charge_data (history, 3);
+	ret = up_history_get_profile_time (history, TRUE, 2.0f, &time_s, &coverage);
+	g_assert (ret);
+	g_assert_cmpfloat (coverage, >, 0.0f);
+	g_assert_cmpfloat (coverage, <, 0.02f);
+
+	g_object_unref (history);
+	for (i = 0; i < G_N_ELEMENTS (types); i++) {
+		basename = g_strdup_printf ("history-%s-profile.dat", types[i]);
+		filename = g_build_filename (dir, basename, NULL);
+		g_unlink (filename);
+		g_free (filename);
+		g_free (basename);
+	}
+	rmdir (dir);
+	g_free (dir);
+}
+
 static void
 up_test_history_func (void)
 {
@@ -143,6 +432,16 @@ up_test_history_func (void)
 	GPtrArray *array;
 	gchar *filename;
 	UpHistoryItem *item, *item2, *item3;
+	struct {
+		guint32 time;
+		guint32 state;
+		gdouble value;
+	} records[8];
+	gssize len;
+	gint fd;
+	const UpHistoryType types[] = { UP_HISTORY_TYPE_CHARGE, UP_HISTORY_TYPE_RATE };
+	UpHistorySeriesPoint *point;
+	GArray *series;
 
 	history = up_history_new ();
 	g_assert (history != NULL);
@@ -228,6 +527,37 @@ up_test_history_func (void)
 
 	g_ptr_array_unref (array);
 
+	/* stream the raw records, which come oldest first and include
+	 * the marker inserted when loading */
+	fd = up_history_get_data_fd (history, UP_HISTORY_TYPE_CHARGE, 10, NULL);
+	g_assert_cmpint (fd, >=, 0);
+	while (g_main_context_iteration (NULL, FALSE));
+	len = read (fd, records, sizeof (records));
+	g_assert_cmpint (len, ==, 4 * sizeof (records[0]));
+	g_assert_cmpint (read (fd, records, sizeof (records)), ==, 0);
+	close (fd);
+	g_assert_cmpfloat (records[1].value, ==, 85);
+	g_assert_cmpint (records[1].state, ==, UP_DEVICE_STATE_CHARGING);
+	g_assert_cmpfloat (records[3].value, ==, 95);
+	g_assert_cmpint (records[3].time, >=, records[1].time);
+
+	/* get two series on one time axis */
+	series = up_history_get_data_series (history, types, G_N_ELEMENTS (types), 10, 100);
+	g_assert (series != NULL);
+	g_assert_cmpint (series->len, >=, 3);
+	point = &g_array_index (series, UpHistorySeriesPoint, series->len - 1);
+	g_assert_cmpfloat (point->values[0], ==, 95);
+	g_assert_cmpfloat (fabs (point->values[1] - 1.01f), <, 0.001);
+	g_assert_cmpint (point->state, ==, UP_DEVICE_STATE_CHARGING);
+	g_array_unref (series);
+
+	/* a huge resolution is capped at the number of samples */
+	series = up_history_get_data_series (history, types, G_N_ELEMENTS (types), 10, G_MAXUINT);
+	g_assert (series != NULL);
+	g_assert_cmpint (series->len, >=, 3);
+	g_assert_cmpint (series->len, <=, 8);
+	g_array_unref (series);
+
 	/* force a save to disk */
 	ret = up_history_save_data (history);
 	g_assert (ret);
@@ -275,6 +605,128 @@ up_test_history_func (void)
 	rmdir (history_dir);
 }
 
+static gboolean
+up_test_profile_sample_cb (UpProfileSample *sample, gpointer user_data)
+{
+	sample->voltage = 10.0f;
+	sample->current = 0.5f;
+	sample->power = 5.0f;
+	return TRUE;
+}
+
+static void
+up_test_profile_func (void)
+{
+	UpProfile *profile;
+	UpProfileSample *samples;
+	UpProfileStats stats;
+	GArray *array;
+	gboolean ret;
+	guint i;
+
+	profile = up_profile_new ();
+	g_assert (profile != NULL);
+	up_profile_set_sampler (profile, up_test_profile_sample_cb, NULL, NULL);
+
+	/* stop early */
+	ret = up_profile_start (profile, 100, 10, NULL);
+	g_assert (ret);
+	g_assert (up_profile_is_running (profile));
+	g_usleep (300 * 1000);
+	up_profile_stop (profile);
+	g_assert (!up_profile_is_running (profile));
+
+	array = up_profile_get_samples (profile);
+	g_assert_cmpint (array->len, >=, 10);
+	g_assert_cmpint (array->len, <=, 40);
+	samples = (UpProfileSample *) array->data;
+	for (i = 1; i < array->len; i++)
+		g_assert_cmpint (samples[i].time, >, samples[i - 1].time);
+
+	up_profile_get_stats (profile, &stats);
+	g_assert_cmpint (stats.n_samples, ==, array->len);
+	g_assert_cmpint (stats.n_dropped, ==, 0);
+	g_assert_cmpfloat (stats.power_mean, ==, 5.0f);
+	g_assert_cmpfloat (stats.power_p50, ==, 5.0f);
+	g_assert_cmpfloat (stats.power_p99, ==, 5.0f);
+	g_assert_cmpfloat (fabs (stats.energy - 5.0f * stats.duration), <, 0.001f);
+
+	/* the session is time boxed */
+	ret = up_profile_start (profile, 10, 1, NULL);
+	g_assert (ret);
+	g_usleep (1200 * 1000);
+	g_assert (!up_profile_is_running (profile));
+	array = up_profile_get_samples (profile);
+	g_assert_cmpint (array->len, >=, 5);
+	g_assert_cmpint (array->len, <=, 11);
+
+	g_object_unref (profile);
+}
+
+/**
+ * up_test_rate_estimator_replay:
+ *
+ * Feeds a battery that only reports its energy in steps of 0.1Wh every
+ * 30 seconds, which is what many embedded controllers do.
+ **/
+static void
+up_test_rate_estimator_replay (UpRateEstimator *estimator, gdouble *energy,
+			       gint64 from, gint64 to, gdouble rate, gint64 settle)
+{
+	gdouble rate_tmp;
+	gint64 t;
+
+	for (t = from; t < to; t += 30) {
+		*energy -= rate * 30.0f / 3600.0f;
+		g_assert (up_rate_estimator_add (estimator, t * G_USEC_PER_SEC,
+						 floor (*energy * 10.0f) / 10.0f));
+
+		/* once settled the estimate should stay close */
+		if (t - from >= settle && up_rate_estimator_get_rate (estimator, &rate_tmp))
+			g_assert_cmpfloat (fabs (rate_tmp - rate), <, 1.0f);
+	}
+}
+
+static void
+up_test_rate_estimator_func (void)
+{
+	UpRateEstimator estimator;
+	gdouble energy = 50.0f;
+	gdouble rate;
+	gboolean ret;
+
+	up_rate_estimator_init (&estimator, 300, 50);
+
+	/* not enough data */
+	ret = up_rate_estimator_get_rate (&estimator, &rate);
+	g_assert (!ret);
+
+	/* steady 10W */
+	up_test_rate_estimator_replay (&estimator, &energy, 0, 900, 10.0f, 300);
+	ret = up_rate_estimator_get_rate (&estimator, &rate);
+	g_assert (ret);
+	g_assert_cmpfloat (fabs (rate - 10.0f), <, 0.5f);
+
+	/* a single bogus reading is ignored */
+	ret = up_rate_estimator_add (&estimator, 900 * G_USEC_PER_SEC, 0.0f);
+	g_assert (!ret);
+	ret = up_rate_estimator_get_rate (&estimator, &rate);
+	g_assert (ret);
+	g_assert_cmpfloat (fabs (rate - 10.0f), <, 0.5f);
+
+	/* the load doubles */
+	up_test_rate_estimator_replay (&estimator, &energy, 930, 1800, 10.0f, 0);
+	up_test_rate_estimator_replay (&estimator, &energy, 1800, 3600, 20.0f, 1500);
+	ret = up_rate_estimator_get_rate (&estimator, &rate);
+	g_assert (ret);
+	g_assert_cmpfloat (fabs (rate - 20.0f), <, 1.0f);
+
+	/* starting again */
+	up_rate_estimator_reset (&estimator);
+	ret = up_rate_estimator_get_rate (&estimator, &rate);
+	g_assert (!ret);
+}
+
 static void
 up_test_wakeups_func (void)
 {
@@ -287,6 +739,58 @@ up_test_wakeups_func (void)
 	g_object_unref (wakeups);
 }
 
+static void
+up_test_stats_func (void)
+{
+	UpStatsCounter *counter;
+	GVariant *variant;
+	GVariantIter iter;
+	const gchar *subsystem;
+	const gchar *name;
+	guint calls, p50, p99;
+	guint64 total, bytes;
+	gboolean found = FALSE;
+	gint64 now;
+	guint i;
+
+	/* looked up by name */
+	counter = up_stats_get_counter ("test", "op");
+	g_assert (counter != NULL);
+	g_assert (up_stats_get_counter ("test", "op") == counter);
+	g_assert (up_stats_get_counter ("test", "other") != counter);
+	g_assert_cmpint (up_stats_counter_get_percentile (counter, 0.5f), ==, 0);
+
+	/* a clock going backwards counts as instant */
+	now = g_get_monotonic_time ();
+	for (i = 0; i < 98; i++)
+		up_stats_counter_add (counter, now + G_USEC_PER_SEC);
+
+	/* two slow ones land in the [65536, 131072) us bucket */
+	up_stats_counter_add (counter, now - 100000);
+	up_stats_counter_add (counter, now - 100000);
+	up_stats_counter_add_bytes (counter, 42);
+	g_assert_cmpint (counter->calls, ==, 100);
+	g_assert_cmpint (up_stats_counter_get_percentile (counter, 0.5f), ==, 0);
+	g_assert_cmpint (up_stats_counter_get_percentile (counter, 0.99f), ==, 131072);
+
+	/* exported */
+	variant = up_stats_get_variant ();
+	g_variant_ref_sink (variant);
+	g_variant_iter_init (&iter, variant);
+	while (g_variant_iter_next (&iter, "(&s&suuutt)",
+				    &subsystem, &name, &calls, &p50, &p99, &total, &bytes)) {
+		if (g_strcmp0 (subsystem, "test") != 0 || g_strcmp0 (name, "op") != 0)
+			continue;
+		g_assert_cmpint (calls, ==, 100);
+		g_assert_cmpint (p99, ==, 131072);
+		g_assert_cmpint (total, >=, 200000);
+		g_assert_cmpint (bytes, ==, 42);
+		found = TRUE;
+	}
+	g_assert (found);
+	g_variant_unref (variant);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -300,9 +804,17 @@ main (int argc, char **argv)
 	/* tests go here */
 	g_test_add_func ("/power/backend", up_test_backend_func);
 	g_test_add_func ("/power/device", up_test_device_func);
+	g_test_add_func ("/power/device_transaction", up_test_device_transaction_func);
+	g_test_add_func ("/power/device_display", up_test_device_display_func);
 	g_test_add_func ("/power/device_list", up_test_device_list_func);
 	g_test_add_func ("/power/history", up_test_history_func);
+	g_test_add_func ("/power/history_reduce", up_test_history_reduce_func);
+	g_test_add_func ("/power/history_merge", up_test_history_merge_func);
+	g_test_add_func ("/power/history_profile", up_test_history_profile_func);
 	g_test_add_func ("/power/native", up_test_native_func);
+	g_test_add_func ("/power/profile", up_test_profile_func);
+	g_test_add_func ("/power/rate_estimator", up_test_rate_estimator_func);
+	g_test_add_func ("/power/stats", up_test_stats_func);
 	g_test_add_func ("/power/wakeups", up_test_wakeups_func);
 	g_test_add_func ("/power/daemon", up_test_daemon_func);
 
@@ -0,0 +1,300 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+#include <gio/gio.h>
+
+#include "up-stats.h"
+
+/*
+ * The counters are updated with atomic operations only, so they can be
+ * used from any thread. Looking one up by name takes a lock, so callers
+ * on hot paths keep the pointer.
+ */
+static GMutex up_stats_lock;
+static GHashTable *up_stats_counters = NULL;
+
+/* a D-Bus method call that hasn't been replied to yet */
+typedef struct {
+	UpStatsCounter		*counter;
+	gint64			 start;
+} UpStatsCall;
+
+/**
+ * up_stats_get_counter:
+ * @subsystem: e.g. "history"
+ * @name: e.g. "save"
+ *
+ * Gets the counter with the given names, creating it if it doesn't exist.
+ *
+ * Return value: (transfer none): the counter, valid for the life of the process
+ **/
+UpStatsCounter *
+up_stats_get_counter (const gchar *subsystem, const gchar *name)
+{
+	UpStatsCounter *counter;
+	gchar *key;
+
+	g_return_val_if_fail (subsystem != NULL, NULL);
+	g_return_val_if_fail (name != NULL, NULL);
+
+	key = g_strdup_printf ("%s/%s", subsystem, name);
+	g_mutex_lock (&up_stats_lock);
+	if (up_stats_counters == NULL)
+		up_stats_counters = g_hash_table_new (g_str_hash, g_str_equal);
+	counter = g_hash_table_lookup (up_stats_counters, key);
+	if (counter == NULL) {
+		counter = g_new0 (UpStatsCounter, 1);
+		counter->subsystem = g_strdup (subsystem);
+		counter->name = g_strdup (name);
+		g_hash_table_insert (up_stats_counters, key, counter);
+		key = NULL;
+	}
+	g_mutex_unlock (&up_stats_lock);
+	g_free (key);
+	return counter;
+}
+
+/**
+ * up_stats_counter_add:
+ * @start: the monotonic time the operation started at
+ *
+ * Counts an operation that has just finished.
+ **/
+void
+up_stats_counter_add (UpStatsCounter *counter, gint64 start)
+{
+	gint64 elapsed;
+	guint bucket = 0;
+
+	elapsed = g_get_monotonic_time () - start;
+	if (elapsed > 0)
+		bucket = MIN (g_bit_storage (elapsed), UP_STATS_BUCKETS - 1);
+	else
+		elapsed = 0;
+
+	g_atomic_int_inc (&counter->calls);
+	g_atomic_int_inc (&counter->buckets[bucket]);
+	g_atomic_pointer_add (&counter->total, (gssize) elapsed);
+}
+
+/**
+ * up_stats_counter_add_bytes:
+ **/
+void
+up_stats_counter_add_bytes (UpStatsCounter *counter, gsize bytes)
+{
+	g_atomic_pointer_add (&counter->bytes, (gssize) bytes);
+}
+
+/**
+ * up_stats_counter_get_percentile:
+ * @fraction: e.g. 0.99
+ *
+ * The histogram only knows powers of two, so this is the upper bound of
+ * the bucket the percentile falls in.
+ *
+ * Return value: the latency in microseconds
+ **/
+guint
+up_stats_counter_get_percentile (UpStatsCounter *counter, gdouble fraction)
+{
+	guint buckets[UP_STATS_BUCKETS];
+	guint total = 0;
+	guint sum = 0;
+	guint rank;
+	guint i;
+
+	for (i = 0; i < UP_STATS_BUCKETS; i++) {
+		buckets[i] = g_atomic_int_get (&counter->buckets[i]);
+		total += buckets[i];
+	}
+	if (total == 0)
+		return 0;
+
+	rank = MAX (ceil (fraction * total), 1);
+	for (i = 0; i < UP_STATS_BUCKETS; i++) {
+		sum += buckets[i];
+		if (sum >= rank)
+			break;
+	}
+	if (i == 0)
+		return 0;
+	return 1u << MIN (i, UP_STATS_BUCKETS - 1);
+}
+
+/**
+ * up_stats_call_done_cb:
+ *
+ * The invocation goes away once the reply has been sent.
+ **/
+static void
+up_stats_call_done_cb (UpStatsCall *call, GObject *where_the_object_was)
+{
+	up_stats_counter_add (call->counter, call->start);
+	g_free (call);
+}
+
+/**
+ * up_stats_watched_quark:
+ **/
+static GQuark
+up_stats_watched_quark (void)
+{
+	return g_quark_from_static_string ("up-stats-watched");
+}
+
+/**
+ * up_stats_method_hook:
+ *
+ * Runs before the handle-* handlers of any skeleton, on the thread that
+ * dispatches the call, whichever order the handlers were connected in.
+ **/
+static gboolean
+up_stats_method_hook (GSignalInvocationHint *ihint,
+		      guint n_param_values,
+		      const GValue *param_values,
+		      gpointer user_data)
+{
+	GDBusMethodInvocation *invocation;
+	const gchar *interface;
+	UpStatsCall *call;
+	gchar *name;
+
+	if (n_param_values < 2 ||
+	    !G_VALUE_HOLDS (&param_values[1], G_TYPE_DBUS_METHOD_INVOCATION))
+		return TRUE;
+	if (g_object_get_qdata (g_value_get_object (&param_values[0]),
+				up_stats_watched_quark ()) == NULL)
+		return TRUE;
+
+	invocation = g_value_get_object (&param_values[1]);
+	interface = g_dbus_method_invocation_get_interface_name (invocation);
+	if (g_str_has_prefix (interface, "org.freedesktop."))
+		interface += strlen ("org.freedesktop.");
+	name = g_strdup_printf ("%s.%s", interface,
+				g_dbus_method_invocation_get_method_name (invocation));
+
+	call = g_new (UpStatsCall, 1);
+	call->counter = up_stats_get_counter ("dbus", name);
+	call->start = g_get_monotonic_time ();
+	g_object_weak_ref (G_OBJECT (invocation), (GWeakNotify) up_stats_call_done_cb, call);
+	g_free (name);
+
+	/* stay installed */
+	return TRUE;
+}
+
+/**
+ * up_stats_watch_skeleton:
+ *
+ * Counts the method calls on @skeleton, from when they are dispatched
+ * until the reply is sent, so handlers that finish asynchronously are
+ * included. This uses emission hooks on the handle-* signals rather than
+ * GDBusInterfaceSkeleton::g-authorize-method, as connecting to that moves
+ * every call through a worker thread.
+ **/
+void
+up_stats_watch_skeleton (GDBusInterfaceSkeleton *skeleton)
+{
+	GQuark quark = up_stats_watched_quark ();
+	GType *interfaces;
+	guint *ids;
+	guint n_interfaces;
+	guint n_ids;
+	guint i, j;
+
+	g_object_set_qdata (G_OBJECT (skeleton), quark, GINT_TO_POINTER (TRUE));
+
+	/* the hooks are per signal, so only install them once per interface */
+	interfaces = g_type_interfaces (G_OBJECT_TYPE (skeleton), &n_interfaces);
+	for (i = 0; i < n_interfaces; i++) {
+		if (g_type_get_qdata (interfaces[i], quark) != NULL)
+			continue;
+		g_type_set_qdata (interfaces[i], quark, GINT_TO_POINTER (TRUE));
+		ids = g_signal_list_ids (interfaces[i], &n_ids);
+		for (j = 0; j < n_ids; j++) {
+			if (!g_str_has_prefix (g_signal_name (ids[j]), "handle-"))
+				continue;
+			g_signal_add_emission_hook (ids[j], 0, up_stats_method_hook, NULL, NULL);
+		}
+		g_free (ids);
+	}
+	g_free (interfaces);
+}
+
+/**
+ * up_stats_compare_counter:
+ **/
+static gint
+up_stats_compare_counter (UpStatsCounter **a, UpStatsCounter **b)
+{
+	gint ret;
+
+	ret = g_strcmp0 ((*a)->subsystem, (*b)->subsystem);
+	if (ret != 0)
+		return ret;
+	return g_strcmp0 ((*a)->name, (*b)->name);
+}
+
+/**
+ * up_stats_get_variant:
+ *
+ * Return value: (transfer floating): the counters as a(ssuuutt), which
+ * is the subsystem, the name, the number of calls, the 50th and 99th
+ * percentile latency and the total time in microseconds, and the bytes
+ * read, sorted by subsystem and name
+ **/
+GVariant *
+up_stats_get_variant (void)
+{
+	UpStatsCounter *counter;
+	GVariantBuilder builder;
+	GHashTableIter iter;
+	GPtrArray *array;
+	guint i;
+
+	array = g_ptr_array_new ();
+	g_mutex_lock (&up_stats_lock);
+	if (up_stats_counters != NULL) {
+		g_hash_table_iter_init (&iter, up_stats_counters);
+		while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &counter))
+			g_ptr_array_add (array, counter);
+	}
+	g_mutex_unlock (&up_stats_lock);
+	g_ptr_array_sort (array, (GCompareFunc) up_stats_compare_counter);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssuuutt)"));
+	for (i = 0; i < array->len; i++) {
+		counter = g_ptr_array_index (array, i);
+		g_variant_builder_add (&builder, "(ssuuutt)",
+				       counter->subsystem,
+				       counter->name,
+				       (guint) g_atomic_int_get (&counter->calls),
+				       up_stats_counter_get_percentile (counter, 0.50f),
+				       up_stats_counter_get_percentile (counter, 0.99f),
+				       (guint64) (gsize) g_atomic_pointer_get (&counter->total),
+				       (guint64) (gsize) g_atomic_pointer_get (&counter->bytes));
+	}
+	g_ptr_array_unref (array);
+	return g_variant_builder_end (&builder);
+}
@@ -0,0 +1,53 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __UP_STATS_H
+#define __UP_STATS_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* bucket 0 is under a microsecond, bucket i is [2^(i-1), 2^i) us */
+#define UP_STATS_BUCKETS		32
+
+/* only ever updated with atomic operations, and never freed */
+typedef struct {
+	gchar			*subsystem;
+	gchar			*name;
+	volatile gint		 calls;
+	volatile gint		 buckets[UP_STATS_BUCKETS];
+	volatile gsize		 total;		/* us */
+	volatile gsize		 bytes;
+} UpStatsCounter;
+
+UpStatsCounter	*up_stats_get_counter		(const gchar		*subsystem,
+						 const gchar		*name);
+void		 up_stats_counter_add		(UpStatsCounter		*counter,
+						 gint64			 start);
+void		 up_stats_counter_add_bytes	(UpStatsCounter		*counter,
+						 gsize			 bytes);
+guint		 up_stats_counter_get_percentile (UpStatsCounter	*counter,
+						 gdouble		 fraction);
+void		 up_stats_watch_skeleton	(GDBusInterfaceSkeleton	*skeleton);
+GVariant	*up_stats_get_variant		(void);
+
+G_END_DECLS
+
+#endif /* __UP_STATS_H */
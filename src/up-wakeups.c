@@ -25,35 +25,94 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
 
+#include "up-config.h"
 #include "up-wakeups.h"
 #include "up-daemon.h"
 #include "up-wakeup-item.h"
+#include "up-stats.h"
 
 static void     up_wakeups_finalize   (GObject		*object);
-static gboolean	up_wakeups_timerstats_enable (UpWakeups *wakeups);
+static void	up_wakeups_poll_once (UpWakeups *wakeups);
 
 #define UP_WAKEUPS_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), UP_TYPE_WAKEUPS, UpWakeupsPrivate))
 
-#define UP_WAKEUPS_POLL_INTERVAL_KERNEL	2 /* seconds */
-#define UP_WAKEUPS_POLL_INTERVAL_USERSPACE	2 /* seconds */
-#define UP_WAKEUPS_DISABLE_INTERVAL		30 /* seconds */
+#define UP_WAKEUPS_POLL_INTERVAL		2 /* seconds */
+#define UP_WAKEUPS_POLL_INTERVAL_MAX		3600 /* seconds */
 #define UP_WAKEUPS_SOURCE_KERNEL		"/proc/interrupts"
 #define UP_WAKEUPS_SOURCE_USERSPACE		"/proc/timer_stats"
+#define UP_WAKEUPS_SOURCE_SCHEDSTAT		"/proc/self/schedstat"
+#define UP_WAKEUPS_PF_KTHREAD			0x00200000 /* from linux/sched.h */
 #define UP_WAKEUPS_SMALLEST_VALUE		0.1f /* seconds */
 #define UP_WAKEUPS_TOTAL_SMOOTH_FACTOR		0.125f
+#define UP_WAKEUPS_DATA_MAX_ITEMS		100 /* returned by GetData */
 
 struct UpWakeupsPrivate
 {
 	GPtrArray		*data;
+	GHashTable		*data_index;
+	GHashTable		*irq_names;
+	gint			 kernel_fd;
+	gchar			*kernel_buf;
+	gsize			 kernel_buf_size;
+	guint			*cpu_counts;
+	guint			 cpu_counts_size;
+	guint			*cpu_ids;
+	guint			 cpus;
+	GPtrArray		*irqs;
+	guint			 irqs_size;
+	guint			*cpu_old;
+	gfloat			*cpu_rate;
 	guint			 total_old;
 	guint			 total_ave;
-	guint			 poll_userspace_id;
-	guint			 poll_kernel_id;
-	guint			 disable_id;
+	gchar			*source_proc;
+	gchar			*source_kernel;
+	gchar			*source_userspace;
+	gchar			*source_schedstat;
+	gboolean		 has_timer_stats;
+	GHashTable		*processes;
+	guint			 processes_generation;
+	gint64			 processes_last_poll;
+	gint64			 kernel_last_poll;
+	gfloat			 kernel_interval;
+	guint			 poll_id;
+	guint			 poll_interval;
+	gboolean		 (*poll_userspace) (UpWakeups *wakeups);
 	gboolean		 polling_enabled;
+	GHashTable		*subscribers;
+	guint			 changed_interval;
+	guint			 changed_id;
+	gboolean		 pending_total_changed;
+	gboolean		 pending_data_changed;
 };
 
+/* one line of /proc/interrupts, and its row in the per-CPU matrix */
+typedef struct {
+	UpWakeupItem		*item;
+	guint			 row;
+	gboolean		 primed;
+} UpWakeupsIrq;
+
+/* a bus name that asked for wakeup data */
+typedef struct {
+	guint			 watch_id;
+	guint			 interval;
+} UpWakeupsSubscriber;
+
+/* what we remember about a process between polls */
+typedef struct {
+	guint64			 starttime;
+	guint64			 switches;
+	guint			 generation;
+	gboolean		 reported;
+	gchar			*cmdline;
+	gchar			 comm[32];
+} UpWakeupsProcess;
+
 G_DEFINE_TYPE (UpWakeups, up_wakeups, UP_TYPE_EXPORTED_WAKEUPS_SKELETON)
 
 /**
@@ -68,7 +127,7 @@ up_wakeups_get_cmdline (guint pid)
 	GError *error = NULL;
 
 	/* get command line from proc */
-	filename = g_strdup_printf ("/proc/%i/cmdline", pid);
+	filename = g_strdup_printf ("%s/proc/%i/cmdline", up_config_get_root (), pid);
 	ret = g_file_get_contents (filename, &cmdline, NULL, &error);
 	if (!ret) {
 		g_debug ("failed to get cmdline: %s", error->message);
@@ -97,27 +156,104 @@ up_wakeups_data_item_compare (UpWakeupItem **item1, UpWakeupItem **item2)
 	return -0;
 }
 
+/**
+ * up_wakeups_data_select_top:
+ *
+ * Partially orders @items so that the @k with the largest values come
+ * first, in no particular order. This is a quickselect, so it is linear
+ * on average rather than sorting everything just to throw most of it away.
+ **/
+static void
+up_wakeups_data_select_top (UpWakeupItem **items, guint len, guint k)
+{
+	UpWakeupItem *tmp;
+	gdouble pivot;
+	gint left = 0;
+	gint right = len - 1;
+	gint i;
+	gint j;
+
+	if (k == 0 || k >= len)
+		return;
+
+	while (left < right) {
+		pivot = up_wakeup_item_get_value (items[left + (right - left) / 2]);
+		i = left;
+		j = right;
+		while (i <= j) {
+			while (up_wakeup_item_get_value (items[i]) > pivot)
+				i++;
+			while (up_wakeup_item_get_value (items[j]) < pivot)
+				j--;
+			if (i <= j) {
+				tmp = items[i];
+				items[i] = items[j];
+				items[j] = tmp;
+				i++;
+				j--;
+			}
+		}
+		/* everything in [left, j] >= pivot >= everything in [i, right] */
+		if ((gint) k - 1 <= j)
+			right = j;
+		else if ((gint) k - 1 >= i)
+			left = i;
+		else
+			break;
+	}
+}
+
+/**
+ * up_wakeups_data_key:
+ *
+ * IRQ numbers and PIDs share the same id space, so the source is part
+ * of the key.
+ **/
+static inline gpointer
+up_wakeups_data_key (gboolean is_userspace, guint id)
+{
+	return GSIZE_TO_POINTER (((gsize) id << 1) | (is_userspace ? 1 : 0));
+}
+
 /**
  * up_wakeups_data_get_or_create:
  **/
 static UpWakeupItem *
-up_wakeups_data_get_or_create (UpWakeups *wakeups, guint id)
+up_wakeups_data_get_or_create (UpWakeups *wakeups, gboolean is_userspace, guint id)
 {
-	guint i;
+	gpointer key;
 	UpWakeupItem *item;
 
-	for (i=0; i<wakeups->priv->data->len; i++) {
-		item = g_ptr_array_index (wakeups->priv->data, i);
-		if (up_wakeup_item_get_id (item) == id)
-			goto out;
-	}
+	key = up_wakeups_data_key (is_userspace, id);
+	item = g_hash_table_lookup (wakeups->priv->data_index, key);
+	if (item != NULL)
+		return item;
+
 	item = up_wakeup_item_new ();
 	up_wakeup_item_set_id (item, id);
+	up_wakeup_item_set_is_userspace (item, is_userspace);
 	g_ptr_array_add (wakeups->priv->data, item);
-out:
+	g_hash_table_insert (wakeups->priv->data_index, key, item);
 	return item;
 }
 
+/**
+ * up_wakeups_data_remove:
+ **/
+static void
+up_wakeups_data_remove (UpWakeups *wakeups, gboolean is_userspace, guint id)
+{
+	gpointer key;
+	UpWakeupItem *item;
+
+	key = up_wakeups_data_key (is_userspace, id);
+	item = g_hash_table_lookup (wakeups->priv->data_index, key);
+	if (item == NULL)
+		return;
+	g_hash_table_remove (wakeups->priv->data_index, key);
+	g_ptr_array_remove (wakeups->priv->data, item);
+}
+
 /**
  * up_wakeups_data_get_total:
  **/
@@ -145,8 +281,6 @@ up_wakeups_get_total (UpExportedWakeups *skeleton,
 		      GDBusMethodInvocation *invocation,
 		      UpWakeups *wakeups)
 {
-	gboolean ret;
-
 	/* no capability */
 	if (!up_exported_wakeups_get_has_capability (skeleton)) {
 		g_dbus_method_invocation_return_error_literal (invocation,
@@ -155,16 +289,8 @@ up_wakeups_get_total (UpExportedWakeups *skeleton,
 		return TRUE;
 	}
 
-	/* start if not already started */
-	ret = up_wakeups_timerstats_enable (wakeups);
-
-	/* no data */
-	if (!ret) {
-		g_dbus_method_invocation_return_error_literal (invocation,
-							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
-							       "cannot enable timerstats");
-		return TRUE;
-	}
+	/* refresh if nobody is subscribed */
+	up_wakeups_poll_once (wakeups);
 
 	/* return total averaged */
 	up_exported_wakeups_complete_get_total (skeleton, invocation, wakeups->priv->total_ave);
@@ -192,19 +318,27 @@ up_wakeups_get_data (UpExportedWakeups *skeleton,
 		return TRUE;
 	}
 
-	/* start if not already started */
-	up_wakeups_timerstats_enable (wakeups);
+	/* refresh if nobody is subscribed */
+	up_wakeups_poll_once (wakeups);
 
-	/* sort data */
-	g_ptr_array_sort (wakeups->priv->data, (GCompareFunc) up_wakeups_data_item_compare);
+	/* only the busiest sources are interesting */
+	array = g_ptr_array_sized_new (wakeups->priv->data->len);
+	for (i = 0; i < wakeups->priv->data->len; i++) {
+		item = g_ptr_array_index (wakeups->priv->data, i);
+		if (up_wakeup_item_get_value (item) < UP_WAKEUPS_SMALLEST_VALUE)
+			continue;
+		g_ptr_array_add (array, item);
+	}
+	if (array->len > UP_WAKEUPS_DATA_MAX_ITEMS) {
+		up_wakeups_data_select_top ((UpWakeupItem **) array->pdata, array->len,
+					    UP_WAKEUPS_DATA_MAX_ITEMS);
+		g_ptr_array_set_size (array, UP_WAKEUPS_DATA_MAX_ITEMS);
+	}
+	g_ptr_array_sort (array, (GCompareFunc) up_wakeups_data_item_compare);
 
 	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(budss)"));
-	array = wakeups->priv->data;
 	for (i = 0; i < array->len; i++) {
 		item = g_ptr_array_index (array, i);
-		if (up_wakeup_item_get_value (item) < UP_WAKEUPS_SMALLEST_VALUE)
-			continue;
-
 		g_variant_builder_add (&builder, "(budss)",
 				       up_wakeup_item_get_is_userspace (item),
 				       up_wakeup_item_get_id (item),
@@ -212,6 +346,7 @@ up_wakeups_get_data (UpExportedWakeups *skeleton,
 				       up_wakeup_item_get_cmdline (item),
 				       up_wakeup_item_get_details (item));
 	}
+	g_ptr_array_unref (array);
 
 	up_exported_wakeups_complete_get_data (skeleton, invocation,
 					       g_variant_builder_end (&builder));
@@ -219,6 +354,86 @@ up_wakeups_get_data (UpExportedWakeups *skeleton,
 	return TRUE;
 }
 
+/**
+ * up_wakeups_get_data_per_cpu:
+ **/
+static gboolean
+up_wakeups_get_data_per_cpu (UpExportedWakeups *skeleton,
+			     GDBusMethodInvocation *invocation,
+			     GVariant *cpus,
+			     UpWakeups *wakeups)
+{
+	UpWakeupsPrivate *priv = wakeups->priv;
+	UpWakeupsIrq *irq;
+	GVariantBuilder builder;
+	GVariantBuilder rates;
+	GVariant *cpus_used;
+	const guint32 *mask;
+	const gfloat *rate;
+	gsize n_mask;
+	GArray *columns;
+	gdouble total;
+	guint col;
+	guint i;
+	guint j;
+
+	/* no capability */
+	if (!up_exported_wakeups_get_has_capability (skeleton)) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "no hardware support");
+		return TRUE;
+	}
+
+	/* refresh if nobody is subscribed */
+	up_wakeups_poll_once (wakeups);
+
+	/* only the processors asked for, or all of them */
+	mask = g_variant_get_fixed_array (cpus, &n_mask, sizeof (guint32));
+	columns = g_array_sized_new (FALSE, FALSE, sizeof (guint), priv->cpus);
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("au"));
+	for (i = 0; i < priv->cpus; i++) {
+		for (j = 0; j < n_mask; j++) {
+			if (mask[j] == priv->cpu_ids[i])
+				break;
+		}
+		if (n_mask > 0 && j == n_mask)
+			continue;
+		g_array_append_val (columns, i);
+		g_variant_builder_add (&builder, "u", priv->cpu_ids[i]);
+	}
+	cpus_used = g_variant_builder_end (&builder);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(usad)"));
+	for (i = 0; i < priv->irqs->len; i++) {
+		irq = g_ptr_array_index (priv->irqs, i);
+		rate = &priv->cpu_rate[irq->row * priv->cpus];
+
+		/* skip the quiet ones to keep the reply small */
+		total = 0;
+		for (j = 0; j < columns->len; j++)
+			total += rate[g_array_index (columns, guint, j)];
+		if (total < UP_WAKEUPS_SMALLEST_VALUE)
+			continue;
+
+		g_variant_builder_init (&rates, G_VARIANT_TYPE ("ad"));
+		for (j = 0; j < columns->len; j++) {
+			col = g_array_index (columns, guint, j);
+			g_variant_builder_add (&rates, "d", (gdouble) rate[col]);
+		}
+		g_variant_builder_add (&builder, "(usad)",
+				       up_wakeup_item_get_id (irq->item),
+				       up_wakeup_item_get_details (irq->item) != NULL ?
+					up_wakeup_item_get_details (irq->item) : "",
+				       &rates);
+	}
+	g_array_unref (columns);
+
+	up_exported_wakeups_complete_get_data_per_cpu (skeleton, invocation, cpus_used,
+						       g_variant_builder_end (&builder));
+	return TRUE;
+}
+
 /**
  * up_is_in:
  **/
@@ -280,8 +495,38 @@ up_strsplit_complete_set (const gchar *string, const gchar *delimiters, guint ma
 	return array;
 }
 
+/**
+ * up_wakeups_emit_changed:
+ **/
+static void
+up_wakeups_emit_changed (UpWakeups *wakeups)
+{
+	if (wakeups->priv->pending_total_changed)
+		up_exported_wakeups_emit_total_changed (UP_EXPORTED_WAKEUPS (wakeups),
+							wakeups->priv->total_ave);
+	if (wakeups->priv->pending_data_changed)
+		up_exported_wakeups_emit_data_changed (UP_EXPORTED_WAKEUPS (wakeups));
+
+	wakeups->priv->pending_total_changed = FALSE;
+	wakeups->priv->pending_data_changed = FALSE;
+}
+
+/**
+ * up_wakeups_changed_cb:
+ **/
+static gboolean
+up_wakeups_changed_cb (UpWakeups *wakeups)
+{
+	wakeups->priv->changed_id = 0;
+	up_wakeups_emit_changed (wakeups);
+	return G_SOURCE_REMOVE;
+}
+
 /**
  * up_wakeups_perhaps_data_changed:
+ *
+ * Both pollers call this; the signals are emitted at most once per
+ * ChangedSignalsInterval milliseconds, with the latest values.
  **/
 static void
 up_wakeups_perhaps_data_changed (UpWakeups *wakeups)
@@ -296,148 +541,344 @@ up_wakeups_perhaps_data_changed (UpWakeups *wakeups)
 			wakeups->priv->total_ave = total;
 		else
 			wakeups->priv->total_ave = UP_WAKEUPS_TOTAL_SMOOTH_FACTOR * (gfloat) (total - wakeups->priv->total_old);
+		wakeups->priv->pending_total_changed = TRUE;
+	}
 
-		up_exported_wakeups_emit_total_changed (UP_EXPORTED_WAKEUPS (wakeups),
-							wakeups->priv->total_ave);
+	/* the data itself changes on every poll */
+	wakeups->priv->pending_data_changed = TRUE;
+
+	/* not rate limited */
+	if (wakeups->priv->changed_interval == 0) {
+		up_wakeups_emit_changed (wakeups);
+		return;
 	}
 
-	/* unconditionally emit */
-	up_exported_wakeups_emit_data_changed (UP_EXPORTED_WAKEUPS (wakeups));
+	if (wakeups->priv->changed_id != 0)
+		return;
+	wakeups->priv->changed_id =
+		g_timeout_add (wakeups->priv->changed_interval,
+			       (GSourceFunc) up_wakeups_changed_cb, wakeups);
+	g_source_set_name_by_id (wakeups->priv->changed_id, "[upower] up_wakeups_changed_cb");
 }
 
 /**
- * up_wakeups_poll_kernel_cb:
+ * up_wakeups_irq_from_name:
  **/
-static gboolean
-up_wakeups_poll_kernel_cb (UpWakeups *wakeups)
+static guint
+up_wakeups_irq_from_name (const gchar *name, gboolean *special_ipi)
 {
-	guint i;
-	guint j;
-	gboolean ret;
-	gboolean special_ipi;
-	gchar *data = NULL;
-	gchar **lines = NULL;
-	GError *error = NULL;
-	guint cpus = 0;
-	const gchar *found;
-	const gchar *found2;
-	guint irq;
-	guint interrupts;
-	GPtrArray *sections;
-	UpWakeupItem *item;
+	*special_ipi = TRUE;
+	if (strcmp (name, "NMI") == 0)
+		return 0xff0;
+	if (strcmp (name, "LOC") == 0)
+		return 0xff1;
+	if (strcmp (name, "RES") == 0)
+		return 0xff2;
+	if (strcmp (name, "CAL") == 0)
+		return 0xff3;
+	if (strcmp (name, "TLB") == 0)
+		return 0xff4;
+	if (strcmp (name, "TRM") == 0)
+		return 0xff5;
+	if (strcmp (name, "SPU") == 0)
+		return 0xff6;
+	if (strcmp (name, "ERR") == 0)
+		return 0xff7;
+	if (strcmp (name, "MIS") == 0)
+		return 0xff8;
+	*special_ipi = FALSE;
+	return atoi (name);
+}
 
-	g_debug ("event");
+/**
+ * up_wakeups_read_kernel:
+ *
+ * Reads the whole of /proc/interrupts into a buffer that is kept between
+ * polls, using a file descriptor that also stays open.
+ *
+ * Return value: the number of bytes read, or -1 for failure
+ **/
+static gssize
+up_wakeups_read_kernel (UpWakeups *wakeups)
+{
+	UpWakeupsPrivate *priv = wakeups->priv;
+	gssize len = 0;
+	gssize ret;
+
+	if (priv->kernel_fd < 0) {
+		priv->kernel_fd = open (priv->source_kernel, O_RDONLY | O_CLOEXEC);
+		if (priv->kernel_fd < 0) {
+			g_warning ("failed to open %s: %s",
+				   priv->source_kernel, g_strerror (errno));
+			return -1;
+		}
+	}
 
-	/* set all kernel data objs to zero */
-	for (i=0; i<wakeups->priv->data->len; i++) {
-		item = g_ptr_array_index (wakeups->priv->data, i);
-		if (!up_wakeup_item_get_is_userspace (item))
-			up_wakeup_item_set_value (item, 0.0f);
+	while (TRUE) {
+		/* leave space for the terminator */
+		if (len + 1 >= (gssize) priv->kernel_buf_size) {
+			priv->kernel_buf_size = MAX (priv->kernel_buf_size * 2, 4096);
+			priv->kernel_buf = g_realloc (priv->kernel_buf, priv->kernel_buf_size);
+		}
+		ret = pread (priv->kernel_fd, priv->kernel_buf + len,
+			     priv->kernel_buf_size - len - 1, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			g_warning ("failed to read %s: %s",
+				   priv->source_kernel, g_strerror (errno));
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		len += ret;
 	}
+	priv->kernel_buf[len] = '\0';
+	return len;
+}
 
-	/* get the data */
-	ret = g_file_get_contents (UP_WAKEUPS_SOURCE_KERNEL, &data, NULL, &error);
-	if (!ret) {
-		g_warning ("failed to get data: %s", error->message);
-		g_error_free (error);
-		goto out;
+/**
+ * up_wakeups_parse_kernel_header:
+ *
+ * Gets the processors from a header like "     CPU0    CPU1    CPU3". Only
+ * online processors are listed, so if the set changes the per-CPU
+ * matrix no longer lines up and is started again.
+ *
+ * Return value: the number of processors
+ **/
+static guint
+up_wakeups_parse_kernel_header (UpWakeups *wakeups, const gchar *header)
+{
+	UpWakeupsPrivate *priv = wakeups->priv;
+	const gchar *p;
+	gboolean changed;
+	guint cpus = 0;
+	guint i;
+
+	for (p = header; *p != '\0'; ) {
+		while (*p == ' ')
+			p++;
+		if (*p == '\0')
+			break;
+		cpus++;
+		while (*p != ' ' && *p != '\0')
+			p++;
+	}
+	if (cpus == 0)
+		return 0;
+	if (cpus > priv->cpu_counts_size) {
+		priv->cpu_counts = g_renew (guint, priv->cpu_counts, cpus);
+		priv->cpu_counts_size = cpus;
 	}
 
-	/* split */
-	lines = g_strsplit (data, "\n", 0);
+	/* use the scratch counters to hold the processor numbers */
+	for (p = header, i = 0; i < cpus; i++) {
+		while (*p == ' ')
+			p++;
+		if (g_str_has_prefix (p, "CPU"))
+			priv->cpu_counts[i] = atoi (p + 3);
+		else
+			priv->cpu_counts[i] = i;
+		while (*p != ' ' && *p != '\0')
+			p++;
+	}
+	changed = cpus != priv->cpus ||
+		  memcmp (priv->cpu_counts, priv->cpu_ids, cpus * sizeof (guint)) != 0;
+	if (!changed)
+		return cpus;
+
+	g_debug ("processors changed, %u now online", cpus);
+	priv->cpu_ids = g_renew (guint, priv->cpu_ids, cpus);
+	memcpy (priv->cpu_ids, priv->cpu_counts, cpus * sizeof (guint));
+	priv->cpus = cpus;
+	priv->cpu_old = g_renew (guint, priv->cpu_old, priv->irqs_size * cpus);
+	priv->cpu_rate = g_renew (gfloat, priv->cpu_rate, priv->irqs_size * cpus);
+	for (i = 0; i < priv->irqs->len; i++)
+		((UpWakeupsIrq *) g_ptr_array_index (priv->irqs, i))->primed = FALSE;
+	return cpus;
+}
 
-	/* find out how many processors we have */
-	sections = up_strsplit_complete_set (lines[0], " ", 0);
-	cpus = sections->len;
-	g_ptr_array_unref (sections);
+/**
+ * up_wakeups_irq_new:
+ **/
+static UpWakeupsIrq *
+up_wakeups_irq_new (UpWakeups *wakeups, UpWakeupItem *item)
+{
+	UpWakeupsPrivate *priv = wakeups->priv;
+	UpWakeupsIrq *irq;
+
+	/* add a row to the per-CPU matrix */
+	if (priv->irqs->len == priv->irqs_size) {
+		priv->irqs_size = MAX (priv->irqs_size * 2, 64);
+		priv->cpu_old = g_renew (guint, priv->cpu_old, priv->irqs_size * priv->cpus);
+		priv->cpu_rate = g_renew (gfloat, priv->cpu_rate, priv->irqs_size * priv->cpus);
+	}
+	irq = g_new0 (UpWakeupsIrq, 1);
+	irq->item = item;
+	irq->row = priv->irqs->len;
+	memset (&priv->cpu_rate[irq->row * priv->cpus], 0, priv->cpus * sizeof (gfloat));
+	g_ptr_array_add (priv->irqs, irq);
+	return irq;
+}
 
-	/* get the data from " 9:      29730        365   IO-APIC-fasteoi   acpi" */
-	for (i=1; lines[i] != NULL; i++) {
+/**
+ * up_wakeups_parse_kernel:
+ *
+ * Parses lines like " 9:      29730        365   IO-APIC-fasteoi   acpi"
+ * in place, terminating the fields inside @data. Nothing is allocated
+ * unless an interrupt is seen for the first time.
+ **/
+static void
+up_wakeups_parse_kernel (UpWakeups *wakeups, gchar *data)
+{
+	UpWakeupsPrivate *priv = wakeups->priv;
+	UpWakeupsIrq *irq;
+	UpWakeupItem *item;
+	gboolean special_ipi;
+	gchar *line;
+	gchar *next;
+	gchar *name;
+	gchar *details;
+	gchar *found;
+	gchar *p;
+	guint *old;
+	gfloat *rate;
+	guint cpus;
+	guint interrupts;
+	guint id;
+	guint value;
+	guint i;
 
-		/* get sections and check correct length */
-		sections = up_strsplit_complete_set (lines[i], " :", 2 + cpus);
-		if (sections->len != 2 + cpus)
-			goto skip;
+	/* find out how many processors we have */
+	next = strchr (data, '\n');
+	if (next == NULL)
+		return;
+	*next++ = '\0';
+	cpus = up_wakeups_parse_kernel_header (wakeups, data);
+	if (cpus == 0)
+		return;
+
+	/* interrupts that have gone away have no rate */
+	memset (priv->cpu_rate, 0, priv->irqs->len * cpus * sizeof (gfloat));
+
+	for (line = next; line != NULL && *line != '\0'; line = next) {
+		next = strchr (line, '\n');
+		if (next != NULL)
+			*next++ = '\0';
+
+		/* get irq name */
+		for (p = line; *p == ' '; p++);
+		name = p;
+		while (*p != ':' && *p != ' ' && *p != '\0')
+			p++;
+		if (*p != ':' || p == name)
+			continue;
+		*p++ = '\0';
 
-		/* get irq */
-		special_ipi = TRUE;
-		found = g_ptr_array_index (sections, 0);
-		if (strcmp (found, "NMI") == 0)
-			irq = 0xff0;
-		else if (strcmp (found, "LOC") == 0)
-			irq = 0xff1;
-		else if (strcmp (found, "RES") == 0)
-			irq = 0xff2;
-		else if (strcmp (found, "CAL") == 0)
-			irq = 0xff3;
-		else if (strcmp (found, "TLB") == 0)
-			irq = 0xff4;
-		else if (strcmp (found, "TRM") == 0)
-			irq = 0xff5;
-		else if (strcmp (found, "SPU") == 0)
-			irq = 0xff6;
-		else if (strcmp (found, "ERR") == 0)
-			irq = 0xff7;
-		else if (strcmp (found, "MIS") == 0)
-			irq = 0xff8;
-		else {
-			irq = atoi (found);
-			special_ipi = FALSE;
+		/* get the counter for each processor */
+		for (i = 0; i < cpus; i++) {
+			while (*p == ' ')
+				p++;
+			if (!g_ascii_isdigit (*p))
+				break;
+			for (value = 0; g_ascii_isdigit (*p); p++)
+				value = value * 10 + (*p - '0');
+			priv->cpu_counts[i] = value;
 		}
+		if (i != cpus)
+			continue;
 
 		/* get the number of interrupts over all processors */
 		interrupts = 0;
-		for (j=1; j<cpus; j++) {
-			found = g_ptr_array_index (sections, j);
-			interrupts += atoi (found);
-		}
+		for (i = 0; i < cpus; i++)
+			interrupts += priv->cpu_counts[i];
 		if (interrupts == 0)
-			goto skip;
-
-		/* get the detail string */
-		found = g_ptr_array_index (sections, cpus+1);
+			continue;
 
 		/* save in database */
-		item = up_wakeups_data_get_or_create (wakeups, irq);
-		if (up_wakeup_item_get_details (item) == NULL) {
-
-			/* remove the interrupt type */
-			found2 = strstr (found, "IO-APIC-fasteoi");
-			if (found2 != NULL)
-				found = g_strchug ((gchar*)found2+16);
-			found2 = strstr (found, "IO-APIC-edge");
-			if (found2 != NULL)
-				found = g_strchug ((gchar*)found2+14);
-			up_wakeup_item_set_details (item, found);
-
-			/* we special */
-			if (special_ipi)
-				up_wakeup_item_set_cmdline (item, "kernel-ipi");
-			else
-				up_wakeup_item_set_cmdline (item, "interrupt");
-			up_wakeup_item_set_is_userspace (item, FALSE);
+		irq = g_hash_table_lookup (priv->irq_names, name);
+		if (irq == NULL) {
+			id = up_wakeups_irq_from_name (name, &special_ipi);
+			item = up_wakeups_data_get_or_create (wakeups, FALSE, id);
+			irq = up_wakeups_irq_new (wakeups, item);
+			g_hash_table_insert (priv->irq_names, g_strdup (name), irq);
+			if (up_wakeup_item_get_details (item) == NULL) {
+
+				/* remove the interrupt type */
+				details = g_strchug (p);
+				found = strstr (details, "IO-APIC-fasteoi");
+				if (found != NULL)
+					details = g_strchug (found + 16);
+				found = strstr (details, "IO-APIC-edge");
+				if (found != NULL)
+					details = g_strchug (found + 14);
+				up_wakeup_item_set_details (item, details);
+
+				/* we special */
+				if (special_ipi)
+					up_wakeup_item_set_cmdline (item, "kernel-ipi");
+				else
+					up_wakeup_item_set_cmdline (item, "interrupt");
+			}
 		}
+		item = irq->item;
+
+		/* per-CPU rates */
+		old = &priv->cpu_old[irq->row * cpus];
+		rate = &priv->cpu_rate[irq->row * cpus];
+		if (irq->primed) {
+			for (i = 0; i < cpus; i++)
+				rate[i] = (priv->cpu_counts[i] - old[i]) / priv->kernel_interval;
+		}
+		memcpy (old, priv->cpu_counts, cpus * sizeof (guint));
+		irq->primed = TRUE;
+
 		/* we report this in minutes, not seconds */
 		if (up_wakeup_item_get_old (item) > 0)
-			up_wakeup_item_set_value (item, (interrupts - up_wakeup_item_get_old (item)) / (gfloat) UP_WAKEUPS_POLL_INTERVAL_KERNEL);
+			up_wakeup_item_set_value (item, (interrupts - up_wakeup_item_get_old (item)) / priv->kernel_interval);
 		up_wakeup_item_set_old (item, interrupts);
-skip:
-		g_ptr_array_unref (sections);
 	}
+}
+
+/**
+ * up_wakeups_poll_kernel:
+ *
+ * Reads and parses /proc/interrupts once, as the poll timer does.
+ **/
+void
+up_wakeups_poll_kernel (UpWakeups *wakeups)
+{
+	guint i;
+	UpWakeupItem *item;
+	gint64 now;
+
+	/* set all kernel data objs to zero */
+	for (i=0; i<wakeups->priv->data->len; i++) {
+		item = g_ptr_array_index (wakeups->priv->data, i);
+		if (!up_wakeup_item_get_is_userspace (item))
+			up_wakeup_item_set_value (item, 0.0f);
+	}
+
+	/* get the data */
+	if (up_wakeups_read_kernel (wakeups) < 0)
+		return;
+
+	/* the rates are over the time since the last poll, however long */
+	now = g_get_monotonic_time ();
+	if (wakeups->priv->kernel_last_poll > 0)
+		wakeups->priv->kernel_interval = MAX (now - wakeups->priv->kernel_last_poll, 1) / (gfloat) G_USEC_PER_SEC;
+	wakeups->priv->kernel_last_poll = now;
+	up_wakeups_parse_kernel (wakeups, wakeups->priv->kernel_buf);
 
 	/* tell GUI we've changed */
 	up_wakeups_perhaps_data_changed (wakeups);
-out:
-	g_free (data);
-	g_strfreev (lines);
-	return TRUE;
 }
 
 /**
- * up_wakeups_poll_userspace_cb:
+ * up_wakeups_poll_userspace:
  **/
 static gboolean
-up_wakeups_poll_userspace_cb (UpWakeups *wakeups)
+up_wakeups_poll_userspace (UpWakeups *wakeups)
 {
 	guint i;
 	gboolean ret;
@@ -451,8 +892,13 @@ up_wakeups_poll_userspace_cb (UpWakeups *wakeups)
 	guint interrupts;
 	gfloat interval = 5.0f;
 	gchar *cmdline;
+	gint64 start;
+	static UpStatsCounter *stats = NULL;
 
 	g_debug ("event");
+	if (stats == NULL)
+		stats = up_stats_get_counter ("wakeups", "userspace");
+	start = g_get_monotonic_time ();
 
 	/* set all userspace data objs to zero */
 	for (i=0; i<wakeups->priv->data->len; i++) {
@@ -462,7 +908,7 @@ up_wakeups_poll_userspace_cb (UpWakeups *wakeups)
 	}
 
 	/* get the data */
-	ret = g_file_get_contents (UP_WAKEUPS_SOURCE_USERSPACE, &data, NULL, &error);
+	ret = g_file_get_contents (wakeups->priv->source_userspace, &data, NULL, &error);
 	if (!ret) {
 		g_warning ("failed to get data: %s", error->message);
 		g_error_free (error);
@@ -517,7 +963,7 @@ up_wakeups_poll_userspace_cb (UpWakeups *wakeups)
 		/* get details */
 
 		/* save in database */
-		item = up_wakeups_data_get_or_create (wakeups, pid);
+		item = up_wakeups_data_get_or_create (wakeups, TRUE, pid);
 		if (up_wakeup_item_get_details (item) == NULL) {
 			/* get process name (truncated) */
 			string = g_ptr_array_index (sections, 2);
@@ -549,11 +995,257 @@ skip:
 	/* tell GUI we've changed */
 	up_wakeups_perhaps_data_changed (wakeups);
 out:
+	up_stats_counter_add (stats, start);
 	g_free (data);
 	g_strfreev (lines);
 	return ret;
 }
 
+/**
+ * up_wakeups_read_proc_file:
+ *
+ * Reads a small file from /proc into @buf without allocating.
+ **/
+static gssize
+up_wakeups_read_proc_file (const gchar *filename, gchar *buf, gsize size)
+{
+	gssize len;
+	gint fd;
+
+	fd = open (filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	do {
+		len = read (fd, buf, size - 1);
+	} while (len < 0 && errno == EINTR);
+	close (fd);
+	if (len < 0)
+		return -1;
+	buf[len] = '\0';
+	return len;
+}
+
+/**
+ * up_wakeups_process_read_stat:
+ *
+ * Gets the name, flags and start time of a process from
+ * "1234 (name) S 1 1234 1234 0 -1 4194560 ...".
+ **/
+static gboolean
+up_wakeups_process_read_stat (guint pid, gchar *comm, gsize comm_size,
+			      guint64 *flags, guint64 *starttime)
+{
+	gchar filename[PATH_MAX];
+	gchar buf[1024];
+	gchar *start;
+	gchar *end;
+	gchar *p;
+	guint field;
+
+	g_snprintf (filename, sizeof (filename), "%s/proc/%u/stat", up_config_get_root (), pid);
+	if (up_wakeups_read_proc_file (filename, buf, sizeof (buf)) < 0)
+		return FALSE;
+
+	/* the name can contain spaces and brackets */
+	start = strchr (buf, '(');
+	end = strrchr (buf, ')');
+	if (start == NULL || end == NULL || end < start || end[1] != ' ')
+		return FALSE;
+	g_strlcpy (comm, start + 1, MIN (comm_size, (gsize) (end - start)));
+
+	/* the state is field 3, the flags field 9 and the start time field 22 */
+	p = end + 2;
+	for (field = 3; field < 22; field++) {
+		if (field == 9)
+			*flags = g_ascii_strtoull (p, NULL, 10);
+		p = strchr (p, ' ');
+		if (p == NULL)
+			return FALSE;
+		p++;
+	}
+	*starttime = g_ascii_strtoull (p, NULL, 10);
+	return TRUE;
+}
+
+/**
+ * up_wakeups_process_get_switches:
+ *
+ * Gets how many times the threads of a process have been put on a
+ * processor, which is the third field of schedstat. For an idle process
+ * almost every one of these is a wakeup.
+ **/
+static guint64
+up_wakeups_process_get_switches (guint pid)
+{
+	GDir *dir;
+	const gchar *name;
+	gchar filename[PATH_MAX];
+	gchar buf[128];
+	gchar *p;
+	guint64 switches = 0;
+
+	g_snprintf (filename, sizeof (filename), "%s/proc/%u/task", up_config_get_root (), pid);
+	dir = g_dir_open (filename, 0, NULL);
+	if (dir == NULL)
+		return 0;
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		g_snprintf (filename, sizeof (filename), "%s/proc/%u/task/%s/schedstat",
+			    up_config_get_root (), pid, name);
+		if (up_wakeups_read_proc_file (filename, buf, sizeof (buf)) < 0)
+			continue;
+		p = strchr (buf, ' ');
+		if (p != NULL)
+			p = strchr (p + 1, ' ');
+		if (p == NULL)
+			continue;
+		switches += g_ascii_strtoull (p + 1, NULL, 10);
+	}
+	g_dir_close (dir);
+	return switches;
+}
+
+/**
+ * up_wakeups_process_free:
+ **/
+static void
+up_wakeups_process_free (UpWakeupsProcess *process)
+{
+	g_free (process->cmdline);
+	g_free (process);
+}
+
+/**
+ * up_wakeups_process_forget_cb:
+ *
+ * Drops the data for the process too, so PIDs that have gone away are
+ * not reported with a value of zero forever.
+ **/
+static gboolean
+up_wakeups_process_forget_cb (gpointer key, UpWakeupsProcess *process, UpWakeups *wakeups)
+{
+	up_wakeups_data_remove (wakeups, TRUE, GPOINTER_TO_UINT (key));
+	return TRUE;
+}
+
+/**
+ * up_wakeups_process_is_stale_cb:
+ **/
+static gboolean
+up_wakeups_process_is_stale_cb (gpointer key, UpWakeupsProcess *process, UpWakeups *wakeups)
+{
+	if (process->generation == wakeups->priv->processes_generation)
+		return FALSE;
+	return up_wakeups_process_forget_cb (key, process, wakeups);
+}
+
+/**
+ * up_wakeups_poll_processes:
+ *
+ * Used instead of up_wakeups_poll_userspace() when the kernel has no
+ * /proc/timer_stats. The scheduler counters of every process are
+ * compared with the previous poll, and the command line is only looked
+ * up once for each process, using the start time to notice reused PIDs.
+ **/
+static gboolean
+up_wakeups_poll_processes (UpWakeups *wakeups)
+{
+	UpWakeupsPrivate *priv = wakeups->priv;
+	UpWakeupsProcess *process;
+	UpWakeupItem *item;
+	GDir *dir;
+	GError *error = NULL;
+	const gchar *name;
+	gchar comm[32];
+	guint64 flags = 0;
+	guint64 starttime;
+	guint64 switches;
+	gint64 now;
+	gfloat interval = 0.0f;
+	guint pid;
+	guint i;
+	gint64 start;
+	static UpStatsCounter *stats = NULL;
+
+	g_debug ("event");
+	if (stats == NULL)
+		stats = up_stats_get_counter ("wakeups", "processes");
+	start = g_get_monotonic_time ();
+
+	/* set all userspace data objs to zero */
+	for (i=0; i<priv->data->len; i++) {
+		item = g_ptr_array_index (priv->data, i);
+		if (up_wakeup_item_get_is_userspace (item))
+			up_wakeup_item_set_value (item, 0.0f);
+	}
+
+	dir = g_dir_open (priv->source_proc, 0, &error);
+	if (dir == NULL) {
+		g_warning ("failed to get data: %s", error->message);
+		g_error_free (error);
+		return TRUE;
+	}
+
+	now = g_get_monotonic_time ();
+	if (priv->processes_last_poll > 0)
+		interval = (now - priv->processes_last_poll) / (gfloat) G_USEC_PER_SEC;
+	priv->processes_last_poll = now;
+	priv->processes_generation++;
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		if (!g_ascii_isdigit (name[0]))
+			continue;
+		pid = atoi (name);
+		if (!up_wakeups_process_read_stat (pid, comm, sizeof (comm), &flags, &starttime))
+			continue;
+
+		/* kernel threads show up as interrupts */
+		if (flags & UP_WAKEUPS_PF_KTHREAD)
+			continue;
+		switches = up_wakeups_process_get_switches (pid);
+
+		/* new process, or the PID has been reused */
+		process = g_hash_table_lookup (priv->processes, GUINT_TO_POINTER (pid));
+		if (process != NULL && process->starttime != starttime)
+			up_wakeups_data_remove (wakeups, TRUE, pid);
+		if (process == NULL || process->starttime != starttime) {
+			process = g_new0 (UpWakeupsProcess, 1);
+			process->starttime = starttime;
+			process->switches = switches;
+			g_strlcpy (process->comm, comm, sizeof (process->comm));
+			g_hash_table_insert (priv->processes, GUINT_TO_POINTER (pid), process);
+		}
+		process->generation = priv->processes_generation;
+		if (interval <= 0.0f || switches <= process->switches) {
+			process->switches = switches;
+			continue;
+		}
+
+		/* save in database */
+		item = up_wakeups_data_get_or_create (wakeups, TRUE, pid);
+		if (!process->reported) {
+			process->cmdline = up_wakeups_get_cmdline (pid);
+			if (process->cmdline != NULL && process->cmdline[0] != '\0')
+				up_wakeup_item_set_cmdline (item, process->cmdline);
+			else
+				up_wakeup_item_set_cmdline (item, process->comm);
+			up_wakeup_item_set_details (item, process->comm);
+			process->reported = TRUE;
+		}
+		up_wakeup_item_set_value (item, (switches - process->switches) / interval);
+		process->switches = switches;
+	}
+	g_dir_close (dir);
+
+	/* forget processes that have exited */
+	g_hash_table_foreach_remove (priv->processes,
+				     (GHRFunc) up_wakeups_process_is_stale_cb, wakeups);
+
+	/* tell GUI we've changed */
+	up_wakeups_perhaps_data_changed (wakeups);
+	up_stats_counter_add (stats, start);
+	return TRUE;
+}
+
 /**
  * up_wakeups_timerstats_disable:
  **/
@@ -569,82 +1261,238 @@ up_wakeups_timerstats_disable (UpWakeups *wakeups)
 	g_debug ("disabling timer stats");
 
 	/* clear polling */
-	if (wakeups->priv->poll_kernel_id != 0) {
-		g_source_remove (wakeups->priv->poll_kernel_id);
-		wakeups->priv->poll_kernel_id = 0;
+	if (wakeups->priv->poll_id != 0) {
+		g_source_remove (wakeups->priv->poll_id);
+		wakeups->priv->poll_id = 0;
 	}
-	if (wakeups->priv->poll_userspace_id != 0) {
-		g_source_remove (wakeups->priv->poll_userspace_id);
-		wakeups->priv->poll_userspace_id = 0;
-	}
-	if (wakeups->priv->disable_id != 0) {
-		g_source_remove (wakeups->priv->disable_id);
-		wakeups->priv->disable_id = 0;
+	wakeups->priv->poll_interval = 0;
+	if (wakeups->priv->kernel_fd >= 0) {
+		close (wakeups->priv->kernel_fd);
+		wakeups->priv->kernel_fd = -1;
 	}
+	g_hash_table_foreach_remove (wakeups->priv->processes,
+				     (GHRFunc) up_wakeups_process_forget_cb, wakeups);
+	wakeups->priv->processes_last_poll = 0;
+	wakeups->priv->polling_enabled = FALSE;
 
-	file = fopen (UP_WAKEUPS_SOURCE_USERSPACE, "w");
+	if (!wakeups->priv->has_timer_stats)
+		return TRUE;
+	file = fopen (wakeups->priv->source_userspace, "w");
 	if (file == NULL)
 		return FALSE;
 	fprintf (file, "0\n");
 	fclose (file);
-	wakeups->priv->polling_enabled = FALSE;
 	return TRUE;
 }
 
 /**
- * up_wakeups_disable_cb:
+ * up_wakeups_poll_cb:
+ *
+ * The one timer that serves every subscriber.
  **/
 static gboolean
-up_wakeups_disable_cb (UpWakeups *wakeups)
+up_wakeups_poll_cb (UpWakeups *wakeups)
 {
-	g_debug ("disabling timer stats as we are idle");
-	up_wakeups_timerstats_disable (wakeups);
+	gint64 start;
+	static UpStatsCounter *stats = NULL;
 
-	/* never repeat */
-	return FALSE;
+	g_debug ("event");
+	if (stats == NULL)
+		stats = up_stats_get_counter ("wakeups", "kernel");
+	start = g_get_monotonic_time ();
+	up_wakeups_poll_kernel (wakeups);
+	up_stats_counter_add (stats, start);
+
+	/* stop trying if the source went away */
+	if (wakeups->priv->poll_userspace != NULL &&
+	    !wakeups->priv->poll_userspace (wakeups))
+		wakeups->priv->poll_userspace = NULL;
+	return TRUE;
 }
 
 /**
  * up_wakeups_timerstats_enable:
+ * @interval: how often to poll, in seconds
  **/
 static gboolean
-up_wakeups_timerstats_enable (UpWakeups *wakeups)
+up_wakeups_timerstats_enable (UpWakeups *wakeups, guint interval)
 {
 	FILE *file;
 
-	/* reset timeout */
-	if (wakeups->priv->disable_id != 0)
-		g_source_remove (wakeups->priv->disable_id);
-	wakeups->priv->disable_id =
-		g_timeout_add_seconds (UP_WAKEUPS_DISABLE_INTERVAL,
-				       (GSourceFunc) up_wakeups_disable_cb, wakeups);
-	g_source_set_name_by_id (wakeups->priv->disable_id, "[upower] up_wakeups_disable_cb");
-
 	/* already same state */
+	if (wakeups->priv->polling_enabled &&
+	    wakeups->priv->poll_interval == interval)
+		return TRUE;
+
+	if (!wakeups->priv->polling_enabled) {
+		g_debug ("enabling timer stats");
+
+		/* enable timer stats */
+		if (wakeups->priv->has_timer_stats) {
+			file = fopen (wakeups->priv->source_userspace, "w");
+			if (file == NULL)
+				return FALSE;
+			fprintf (file, "1\n");
+			fclose (file);
+			wakeups->priv->poll_userspace = up_wakeups_poll_userspace;
+		} else if (g_file_test (wakeups->priv->source_schedstat, G_FILE_TEST_EXISTS)) {
+			wakeups->priv->poll_userspace = up_wakeups_poll_processes;
+		} else {
+			wakeups->priv->poll_userspace = NULL;
+		}
+	}
+
+	/* setup the poll, or move it to the new interval */
+	g_debug ("polling every %u seconds", interval);
+	if (wakeups->priv->poll_id != 0)
+		g_source_remove (wakeups->priv->poll_id);
+	wakeups->priv->poll_id =
+		g_timeout_add_seconds (interval, (GSourceFunc) up_wakeups_poll_cb, wakeups);
+	g_source_set_name_by_id (wakeups->priv->poll_id, "[upower] up_wakeups_poll_cb");
+	wakeups->priv->poll_interval = interval;
+
+	wakeups->priv->polling_enabled = TRUE;
+	return TRUE;
+}
+
+/**
+ * up_wakeups_poll_once:
+ *
+ * Callers that haven't subscribed get the rates since the previous call,
+ * without the daemon waking up in between.
+ **/
+static void
+up_wakeups_poll_once (UpWakeups *wakeups)
+{
 	if (wakeups->priv->polling_enabled)
+		return;
+	up_wakeups_poll_kernel (wakeups);
+	if (!wakeups->priv->has_timer_stats &&
+	    g_file_test (wakeups->priv->source_schedstat, G_FILE_TEST_EXISTS))
+		up_wakeups_poll_processes (wakeups);
+}
+
+/**
+ * up_wakeups_subscribers_changed:
+ *
+ * Polls at the shortest interval any subscriber asked for, and not at all
+ * when nobody is listening.
+ **/
+static void
+up_wakeups_subscribers_changed (UpWakeups *wakeups)
+{
+	UpWakeupsSubscriber *subscriber;
+	GHashTableIter iter;
+	guint interval = G_MAXUINT;
+
+	g_hash_table_iter_init (&iter, wakeups->priv->subscribers);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &subscriber))
+		interval = MIN (interval, subscriber->interval);
+
+	if (interval == G_MAXUINT) {
+		g_debug ("disabling timer stats as nobody is subscribed");
+		up_wakeups_timerstats_disable (wakeups);
+		return;
+	}
+	if (!up_wakeups_timerstats_enable (wakeups, interval))
+		g_warning ("failed to enable timer stats");
+}
+
+/**
+ * up_wakeups_subscriber_free:
+ **/
+static void
+up_wakeups_subscriber_free (UpWakeupsSubscriber *subscriber)
+{
+	g_bus_unwatch_name (subscriber->watch_id);
+	g_free (subscriber);
+}
+
+/**
+ * up_wakeups_subscriber_vanished_cb:
+ **/
+static void
+up_wakeups_subscriber_vanished_cb (GDBusConnection *connection,
+				   const gchar *name,
+				   UpWakeups *wakeups)
+{
+	g_debug ("%s left, unsubscribing", name);
+	g_hash_table_remove (wakeups->priv->subscribers, name);
+	up_wakeups_subscribers_changed (wakeups);
+}
+
+/**
+ * up_wakeups_subscribe:
+ **/
+static gboolean
+up_wakeups_subscribe (UpExportedWakeups *skeleton,
+		      GDBusMethodInvocation *invocation,
+		      guint interval,
+		      UpWakeups *wakeups)
+{
+	UpWakeupsSubscriber *subscriber;
+	const gchar *sender;
+
+	/* no capability */
+	if (!up_exported_wakeups_get_has_capability (skeleton)) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "no hardware support");
 		return TRUE;
+	}
 
-	g_debug ("enabling timer stats");
+	/* only bus names can be watched */
+	sender = g_dbus_method_invocation_get_sender (invocation);
+	if (sender == NULL) {
+		g_dbus_method_invocation_return_error_literal (invocation,
+							       UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+							       "not on a message bus");
+		return TRUE;
+	}
 
-	/* enable timer stats */
-	file = fopen (UP_WAKEUPS_SOURCE_USERSPACE, "w");
-	if (file == NULL)
-		return FALSE;
-	fprintf (file, "1\n");
-	fclose (file);
+	if (interval == 0)
+		interval = UP_WAKEUPS_POLL_INTERVAL;
+	interval = MIN (interval, UP_WAKEUPS_POLL_INTERVAL_MAX);
+
+	subscriber = g_hash_table_lookup (wakeups->priv->subscribers, sender);
+	if (subscriber == NULL) {
+		subscriber = g_new0 (UpWakeupsSubscriber, 1);
+		subscriber->watch_id =
+			g_bus_watch_name_on_connection (g_dbus_method_invocation_get_connection (invocation),
+							sender,
+							G_BUS_NAME_WATCHER_FLAGS_NONE,
+							NULL,
+							(GBusNameVanishedCallback) up_wakeups_subscriber_vanished_cb,
+							wakeups,
+							NULL);
+		g_hash_table_insert (wakeups->priv->subscribers, g_strdup (sender), subscriber);
+	}
+	g_debug ("%s subscribed every %u seconds", sender, interval);
+	subscriber->interval = interval;
+	up_wakeups_subscribers_changed (wakeups);
 
-	/* setup polls */
-	wakeups->priv->poll_kernel_id =
-		g_timeout_add_seconds (UP_WAKEUPS_POLL_INTERVAL_KERNEL,
-				       (GSourceFunc) up_wakeups_poll_kernel_cb, wakeups);
-	g_source_set_name_by_id (wakeups->priv->poll_kernel_id, "[upower] up_wakeups_poll_kernel_cb");
+	up_exported_wakeups_complete_subscribe (skeleton, invocation);
+	return TRUE;
+}
 
-	wakeups->priv->poll_userspace_id =
-		g_timeout_add_seconds (UP_WAKEUPS_POLL_INTERVAL_USERSPACE,
-				       (GSourceFunc) up_wakeups_poll_userspace_cb, wakeups);
-	g_source_set_name_by_id (wakeups->priv->poll_userspace_id, "[upower] up_wakeups_poll_userspace_cb");
+/**
+ * up_wakeups_unsubscribe:
+ **/
+static gboolean
+up_wakeups_unsubscribe (UpExportedWakeups *skeleton,
+			GDBusMethodInvocation *invocation,
+			UpWakeups *wakeups)
+{
+	const gchar *sender;
 
-	wakeups->priv->polling_enabled = TRUE;
+	sender = g_dbus_method_invocation_get_sender (invocation);
+	if (sender != NULL &&
+	    g_hash_table_remove (wakeups->priv->subscribers, sender)) {
+		g_debug ("%s unsubscribed", sender);
+		up_wakeups_subscribers_changed (wakeups);
+	}
+
+	up_exported_wakeups_complete_unsubscribe (skeleton, invocation);
 	return TRUE;
 }
 
@@ -666,12 +1514,31 @@ up_wakeups_class_init (UpWakeupsClass *klass)
 static void
 up_wakeups_init (UpWakeups *wakeups)
 {
+	UpConfig *config;
+
 	wakeups->priv = UP_WAKEUPS_GET_PRIVATE (wakeups);
 	wakeups->priv->data = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	wakeups->priv->data_index = g_hash_table_new (g_direct_hash, g_direct_equal);
+	wakeups->priv->irq_names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	wakeups->priv->irqs = g_ptr_array_new ();
+	wakeups->priv->kernel_fd = -1;
+	wakeups->priv->kernel_interval = UP_WAKEUPS_POLL_INTERVAL;
+	wakeups->priv->subscribers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+							    (GDestroyNotify) up_wakeups_subscriber_free);
+	wakeups->priv->processes = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+							  (GDestroyNotify) up_wakeups_process_free);
+	wakeups->priv->source_proc = up_config_build_path ("/proc");
+	wakeups->priv->source_kernel = up_config_build_path (UP_WAKEUPS_SOURCE_KERNEL);
+	wakeups->priv->source_userspace = up_config_build_path (UP_WAKEUPS_SOURCE_USERSPACE);
+	wakeups->priv->source_schedstat = up_config_build_path (UP_WAKEUPS_SOURCE_SCHEDSTAT);
+	wakeups->priv->has_timer_stats = g_file_test (wakeups->priv->source_userspace, G_FILE_TEST_EXISTS);
+
+	config = up_config_new ();
+	wakeups->priv->changed_interval = up_config_get_uint (config, "ChangedSignalsInterval");
+	g_object_unref (config);
 
 	/* test if we have an interface */
-	if (g_file_test (UP_WAKEUPS_SOURCE_KERNEL, G_FILE_TEST_EXISTS) ||
-	    g_file_test (UP_WAKEUPS_SOURCE_KERNEL, G_FILE_TEST_EXISTS)) {
+	if (g_file_test (wakeups->priv->source_kernel, G_FILE_TEST_EXISTS)) {
 		up_exported_wakeups_set_has_capability (UP_EXPORTED_WAKEUPS (wakeups), TRUE);
 	}
 
@@ -679,6 +1546,12 @@ up_wakeups_init (UpWakeups *wakeups)
 			  G_CALLBACK (up_wakeups_get_data), wakeups);
 	g_signal_connect (wakeups, "handle-get-total",
 			  G_CALLBACK (up_wakeups_get_total), wakeups);
+	g_signal_connect (wakeups, "handle-get-data-per-cpu",
+			  G_CALLBACK (up_wakeups_get_data_per_cpu), wakeups);
+	g_signal_connect (wakeups, "handle-subscribe",
+			  G_CALLBACK (up_wakeups_subscribe), wakeups);
+	g_signal_connect (wakeups, "handle-unsubscribe",
+			  G_CALLBACK (up_wakeups_unsubscribe), wakeups);
 }
 
 /**
@@ -696,9 +1569,28 @@ up_wakeups_finalize (GObject *object)
 	wakeups->priv = UP_WAKEUPS_GET_PRIVATE (wakeups);
 
 	/* stop timerstats */
+	g_hash_table_unref (wakeups->priv->subscribers);
 	up_wakeups_timerstats_disable (wakeups);
 
+	if (wakeups->priv->changed_id != 0)
+		g_source_remove (wakeups->priv->changed_id);
+
+	if (wakeups->priv->kernel_fd >= 0)
+		close (wakeups->priv->kernel_fd);
+	g_free (wakeups->priv->kernel_buf);
+	g_free (wakeups->priv->cpu_counts);
+	g_hash_table_unref (wakeups->priv->processes);
+	g_free (wakeups->priv->cpu_ids);
+	g_free (wakeups->priv->cpu_old);
+	g_free (wakeups->priv->cpu_rate);
+	g_ptr_array_unref (wakeups->priv->irqs);
+	g_hash_table_unref (wakeups->priv->irq_names);
+	g_hash_table_unref (wakeups->priv->data_index);
 	g_ptr_array_unref (wakeups->priv->data);
+	g_free (wakeups->priv->source_proc);
+	g_free (wakeups->priv->source_kernel);
+	g_free (wakeups->priv->source_userspace);
+	g_free (wakeups->priv->source_schedstat);
 
 	G_OBJECT_CLASS (up_wakeups_parent_class)->finalize (object);
 }
@@ -718,6 +1610,7 @@ up_wakeups_register (UpWakeups *wakeups,
 {
 	GError *error = NULL;
 
+	up_stats_watch_skeleton (G_DBUS_INTERFACE_SKELETON (wakeups));
 	g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (wakeups),
 					  connection,
 					  "/org/freedesktop/UPower/Wakeups",
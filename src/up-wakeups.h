@@ -50,6 +50,7 @@ UpWakeups	*up_wakeups_new			(void);
 GType		 up_wakeups_get_type		(void);
 void		 up_wakeups_register            (UpWakeups *wakeups,
 						 GDBusConnection *connection);
+void		 up_wakeups_poll_kernel		(UpWakeups *wakeups);
 
 G_END_DECLS
 
@@ -222,6 +222,10 @@ up_tool_show_wakeups (void)
 		goto out;
 	}
 
+	/* collect for a couple of polls */
+	if (up_wakeups_subscribe_sync (wakeups, 1, NULL, NULL))
+		g_usleep (2 * G_USEC_PER_SEC);
+
 	/* get total */
 	total = up_wakeups_get_total_sync (wakeups, NULL, NULL);
 	g_print ("Total wakeups per minute: %i\n", total);
@@ -237,10 +241,65 @@ up_tool_show_wakeups (void)
 	}
 	g_ptr_array_unref (array);
 out:
+	up_wakeups_unsubscribe_sync (wakeups, NULL, NULL);
 	g_object_unref (wakeups);
 	return ret;
 }
 
+/**
+ * up_tool_show_stats:
+ **/
+static gboolean
+up_tool_show_stats (void)
+{
+	GDBusConnection *connection;
+	GVariant *result;
+	GVariantIter *iter;
+	GError *error = NULL;
+	const gchar *subsystem;
+	const gchar *name;
+	guint calls;
+	guint p50;
+	guint p99;
+	guint64 total;
+	guint64 bytes;
+
+	connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+	if (connection == NULL) {
+		g_print ("Cannot connect to the system bus: %s\n", error->message);
+		g_error_free (error);
+		return FALSE;
+	}
+	result = g_dbus_connection_call_sync (connection,
+					      "org.freedesktop.UPower",
+					      "/org/freedesktop/UPower/Debug",
+					      "org.freedesktop.UPower.Debug",
+					      "GetStats",
+					      NULL,
+					      G_VARIANT_TYPE ("(a(ssuuutt))"),
+					      G_DBUS_CALL_FLAGS_NONE,
+					      -1, NULL, &error);
+	g_object_unref (connection);
+	if (result == NULL) {
+		g_print ("Cannot get statistics: %s\n", error->message);
+		g_error_free (error);
+		return FALSE;
+	}
+
+	/* latencies are in microseconds */
+	g_print ("%-10s %-40s %10s %10s %10s %12s %12s\n",
+		 "subsystem", "name", "calls", "p50", "p99", "total", "bytes");
+	g_variant_get (result, "(a(ssuuutt))", &iter);
+	while (g_variant_iter_next (iter, "(&s&suuutt)",
+				    &subsystem, &name, &calls, &p50, &p99, &total, &bytes)) {
+		g_print ("%-10s %-40s %10u %10u %10u %12" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT "\n",
+			 subsystem, name, calls, p50, p99, total, bytes);
+	}
+	g_variant_iter_free (iter);
+	g_variant_unref (result);
+	return TRUE;
+}
+
 /**
  * main:
  **/
@@ -252,6 +311,7 @@ main (int argc, char **argv)
 	GOptionContext *context;
 	gboolean opt_dump = FALSE;
 	gboolean opt_wakeups = FALSE;
+	gboolean opt_stats = FALSE;
 	gboolean opt_enumerate = FALSE;
 	gboolean opt_monitor = FALSE;
 	gchar *opt_show_info = FALSE;
@@ -267,6 +327,7 @@ main (int argc, char **argv)
 		{ "enumerate", 'e', 0, G_OPTION_ARG_NONE, &opt_enumerate, _("Enumerate objects paths for devices"), NULL },
 		{ "dump", 'd', 0, G_OPTION_ARG_NONE, &opt_dump, _("Dump all parameters for all objects"), NULL },
 		{ "wakeups", 'w', 0, G_OPTION_ARG_NONE, &opt_wakeups, _("Get the wakeup data"), NULL },
+		{ "stats", 0, 0, G_OPTION_ARG_NONE, &opt_stats, _("Show the daemon's internal statistics"), NULL },
 		{ "monitor", 'm', 0, G_OPTION_ARG_NONE, &opt_monitor, _("Monitor activity from the power daemon"), NULL },
 		{ "monitor-detail", 0, 0, G_OPTION_ARG_NONE, &opt_monitor_detail, _("Monitor with detail"), NULL },
 		{ "show-info", 'i', 0, G_OPTION_ARG_STRING, &opt_show_info, _("Show information about object path"), NULL },
@@ -312,6 +373,13 @@ main (int argc, char **argv)
 		goto out;
 	}
 
+	/* statistics */
+	if (opt_stats) {
+		if (up_tool_show_stats ())
+			retval = EXIT_SUCCESS;
+		goto out;
+	}
+
 	if (opt_enumerate || opt_dump) {
 		GPtrArray *devices;
 		devices = up_client_get_devices2 (client);